@@ -0,0 +1,726 @@
+#include "animation.hpp"
+#include "parallel.hpp"
+#include "trace.hpp"
+
+#include <algorithm>
+#include <cstring>
+#include <cmath>
+#include <map>
+#include <string>
+#include <vector>
+
+namespace
+{
+
+aiVector3D lerp(const aiVector3D& a, const aiVector3D& b, double t)
+{
+    return a + (b - a) * static_cast<ai_real>(t);
+}
+
+aiQuaternion slerp(const aiQuaternion& a, const aiQuaternion& b, double t)
+{
+    aiQuaternion out;
+    aiQuaternion::Interpolate(out, a, b, static_cast<ai_real>(t));
+    return out.Normalize();
+}
+
+double distance(const aiVector3D& a, const aiVector3D& b)
+{
+    return (a - b).Length();
+}
+
+double dot(const aiQuaternion& a, const aiQuaternion& b)
+{
+    return a.x * b.x + a.y * b.y + a.z * b.z + a.w * b.w;
+}
+
+double angle(const aiQuaternion& a, const aiQuaternion& b)
+{
+    return 2.0 * std::acos(std::min(std::abs(dot(a, b)), 1.0));
+}
+
+// Greedy reduction: starting from the last kept key, extend the span for as
+// long as every skipped key can be rebuilt by interpolating across it. When
+// the span breaks, the key before the one that broke it is kept.
+template <typename Key, typename Interpolate, typename Error>
+std::vector<Key> reduce_track(const Key* keys, unsigned int count, double tolerance,
+        Interpolate interpolate, Error error)
+{
+    if (count <= 2)
+    {
+        std::vector<Key> kept(keys, keys + count);
+        if (count == 2 && error(keys[0].mValue, keys[1].mValue) <= tolerance)
+        {
+            kept.pop_back();
+        }
+        return kept;
+    }
+
+    std::vector<Key> kept;
+    kept.push_back(keys[0]);
+
+    unsigned int anchor = 0;
+    for (unsigned int candidate = 2; candidate < count; ++candidate)
+    {
+        const Key& first = keys[anchor];
+        const Key& last = keys[candidate];
+        double span = last.mTime - first.mTime;
+
+        bool fits = true;
+        for (unsigned int k = anchor + 1; k < candidate && fits; ++k)
+        {
+            double t = span > 0.0 ? (keys[k].mTime - first.mTime) / span : 0.0;
+            fits = error(interpolate(first.mValue, last.mValue, t), keys[k].mValue) <= tolerance;
+        }
+
+        if (!fits)
+        {
+            anchor = candidate - 1;
+            kept.push_back(keys[anchor]);
+        }
+    }
+
+    kept.push_back(keys[count - 1]);
+
+    // A track that collapsed to two equal keys is constant.
+    if (kept.size() == 2 && error(kept[0].mValue, kept[1].mValue) <= tolerance)
+    {
+        kept.pop_back();
+    }
+
+    return kept;
+}
+
+template <typename Key>
+void replace_keys(Key*& pKeys, unsigned int& count, const std::vector<Key>& kept)
+{
+    if (kept.size() == count)
+    {
+        return;
+    }
+
+    Key* pReduced = new Key[kept.size()];
+    std::copy(kept.begin(), kept.end(), pReduced);
+
+    delete[] pKeys;
+    pKeys = pReduced;
+    count = static_cast<unsigned int>(kept.size());
+}
+
+const double kRotationRange = 0.70710678118654752440;
+
+unsigned int dropped_component(aiQuaternion& q)
+{
+    q.Normalize();
+
+    const ai_real c[4] = { q.x, q.y, q.z, q.w };
+    unsigned int largest = 0;
+    for (unsigned int i = 1; i < 4; ++i)
+    {
+        if (std::abs(c[i]) > std::abs(c[largest]))
+        {
+            largest = i;
+        }
+    }
+
+    if (c[largest] < 0)
+    {
+        q = aiQuaternion(-q.w, -q.x, -q.y, -q.z);
+    }
+
+    return largest;
+}
+
+// The three components kept for a given dropped index, in x, y, z, w order.
+void kept_components(const aiQuaternion& q, unsigned int dropped, double out[3])
+{
+    const ai_real c[4] = { q.x, q.y, q.z, q.w };
+    for (unsigned int i = 0, k = 0; i < 4; ++i)
+    {
+        if (i != dropped)
+        {
+            out[k++] = c[i];
+        }
+    }
+}
+
+std::uint32_t quantize(double c, unsigned int bits)
+{
+    double max = static_cast<double>((1u << bits) - 1);
+    double t = (c + kRotationRange) / (2.0 * kRotationRange);
+    return static_cast<std::uint32_t>(std::lround(std::min(std::max(t, 0.0), 1.0) * max));
+}
+
+double dequantize(std::uint32_t q, unsigned int bits)
+{
+    double max = static_cast<double>((1u << bits) - 1);
+    return q / max * (2.0 * kRotationRange) - kRotationRange;
+}
+
+aiQuaternion rebuild(unsigned int dropped, const double kept[3])
+{
+    double sum = kept[0] * kept[0] + kept[1] * kept[1] + kept[2] * kept[2];
+    double c[4];
+    for (unsigned int i = 0, k = 0; i < 4; ++i)
+    {
+        c[i] = i == dropped ? std::sqrt(std::max(0.0, 1.0 - sum)) : kept[k++];
+    }
+
+    aiQuaternion q(static_cast<ai_real>(c[3]), static_cast<ai_real>(c[0]),
+            static_cast<ai_real>(c[1]), static_cast<ai_real>(c[2]));
+    return q.Normalize();
+}
+
+template <typename Key>
+nlohmann::json encode_times(const Key* pKeys, unsigned int count, double ticks_per_second,
+        const TrackEncoding& encoding)
+{
+    const KeyTimes times = encoding.times;
+    if (times == KeyTimes::Frames)
+    {
+        const double frames_per_tick = encoding.frame_rate / ticks_per_second;
+        std::vector<long> frames(count);
+        for (unsigned int i = 0; i < count; ++i)
+        {
+            frames[i] = std::lround(pKeys[i].mTime * frames_per_tick);
+        }
+        return frames;
+    }
+
+    if (times == KeyTimes::Float)
+    {
+        std::vector<float> values(count);
+        for (unsigned int i = 0; i < count; ++i)
+        {
+            values[i] = static_cast<float>(pKeys[i].mTime);
+        }
+        return values;
+    }
+
+    std::vector<double> values(count);
+    for (unsigned int i = 0; i < count; ++i)
+    {
+        values[i] = pKeys[i].mTime;
+    }
+    return values;
+}
+
+nlohmann::json encode_rotations(const std::vector<aiQuaternion>& rotations, unsigned int rotation_bits)
+{
+    if (rotation_bits == 32)
+    {
+        std::vector<std::uint32_t> values(rotations.size());
+        for (std::size_t i = 0; i < rotations.size(); ++i)
+        {
+            values[i] = pack_rotation32(rotations[i]);
+        }
+        return values;
+    }
+
+    if (rotation_bits == 48)
+    {
+        std::vector<std::uint16_t> values(rotations.size() * 3);
+        for (std::size_t i = 0; i < rotations.size(); ++i)
+        {
+            pack_rotation48(rotations[i], &values[i * 3]);
+        }
+        return values;
+    }
+
+    std::vector<float> values;
+    values.reserve(rotations.size() * 4);
+    for (const aiQuaternion& q : rotations)
+    {
+        values.insert(values.end(), { q.x, q.y, q.z, q.w });
+    }
+    return values;
+}
+
+// The node hierarchy flattened parents-first, so global transforms can be
+// built with one pass over the array.
+struct FlatNode
+{
+    const aiNode* pNode;
+    int parent;
+};
+
+void flatten(const aiNode* pNode, int parent, std::vector<FlatNode>& nodes)
+{
+    int index = static_cast<int>(nodes.size());
+    nodes.push_back(FlatNode { pNode, parent });
+    for (unsigned int i = 0; i < pNode->mNumChildren; ++i)
+    {
+        flatten(pNode->mChildren[i], index, nodes);
+    }
+}
+
+struct SkinBone
+{
+    std::string name;
+    aiMatrix4x4 offset;
+    int node;
+};
+
+}
+
+std::uint16_t to_half(float value)
+{
+    std::uint32_t bits;
+    std::memcpy(&bits, &value, sizeof(bits));
+
+    std::uint32_t sign = (bits >> 16) & 0x8000;
+    std::uint32_t exponent = (bits >> 23) & 0xff;
+    std::uint32_t mantissa = bits & 0x7fffff;
+
+    if (exponent == 0xff)
+    {
+        return static_cast<std::uint16_t>(sign | 0x7c00 | (mantissa ? 0x200 : 0));
+    }
+
+    int e = static_cast<int>(exponent) - 127 + 15;
+    if (e >= 0x1f)
+    {
+        return static_cast<std::uint16_t>(sign | 0x7c00);
+    }
+
+    if (e <= 0)
+    {
+        if (e < -10)
+        {
+            return static_cast<std::uint16_t>(sign);
+        }
+        mantissa |= 0x800000;
+        unsigned int shift = static_cast<unsigned int>(14 - e);
+        std::uint32_t half = mantissa >> shift;
+        std::uint32_t rest = mantissa & ((1u << shift) - 1);
+        std::uint32_t middle = 1u << (shift - 1);
+        if (rest > middle || (rest == middle && (half & 1)))
+        {
+            ++half;
+        }
+        return static_cast<std::uint16_t>(sign | half);
+    }
+
+    std::uint32_t half = (static_cast<std::uint32_t>(e) << 10) | (mantissa >> 13);
+    std::uint32_t rest = mantissa & 0x1fff;
+    if (rest > 0x1000 || (rest == 0x1000 && (half & 1)))
+    {
+        ++half;
+    }
+    return static_cast<std::uint16_t>(sign | half);
+}
+
+std::uint32_t pack_rotation32(const aiQuaternion& rotation)
+{
+    aiQuaternion q = rotation;
+    unsigned int dropped = dropped_component(q);
+
+    double kept[3];
+    kept_components(q, dropped, kept);
+
+    return (dropped << 30) | (quantize(kept[0], 10) << 20) | (quantize(kept[1], 10) << 10) | quantize(kept[2], 10);
+}
+
+void pack_rotation48(const aiQuaternion& rotation, std::uint16_t words[3])
+{
+    aiQuaternion q = rotation;
+    unsigned int dropped = dropped_component(q);
+
+    double kept[3];
+    kept_components(q, dropped, kept);
+
+    words[0] = static_cast<std::uint16_t>(quantize(kept[0], 15) | ((dropped >> 1) << 15));
+    words[1] = static_cast<std::uint16_t>(quantize(kept[1], 15) | ((dropped & 1) << 15));
+    words[2] = static_cast<std::uint16_t>(quantize(kept[2], 15));
+}
+
+aiQuaternion unpack_rotation32(std::uint32_t packed)
+{
+    const double kept[3] = {
+        dequantize((packed >> 20) & 0x3ff, 10),
+        dequantize((packed >> 10) & 0x3ff, 10),
+        dequantize(packed & 0x3ff, 10)
+    };
+    return rebuild(packed >> 30, kept);
+}
+
+aiQuaternion unpack_rotation48(const std::uint16_t words[3])
+{
+    const double kept[3] = {
+        dequantize(words[0] & 0x7fff, 15),
+        dequantize(words[1] & 0x7fff, 15),
+        dequantize(words[2] & 0x7fff, 15)
+    };
+    return rebuild(((words[0] >> 15) << 1) | (words[1] >> 15), kept);
+}
+
+double ticks_per_second(const aiAnimation* pAnimation)
+{
+    return pAnimation->mTicksPerSecond > 0.0 ? pAnimation->mTicksPerSecond : 25.0;
+}
+
+nlohmann::json encode_track(const aiVectorKey* pKeys, unsigned int count, double ticks_per_second,
+        const TrackEncoding& encoding)
+{
+    std::vector<float> values;
+    values.reserve(count * 3);
+    for (unsigned int i = 0; i < count; ++i)
+    {
+        const aiVector3D& v = pKeys[i].mValue;
+        values.insert(values.end(), { v.x, v.y, v.z });
+    }
+
+    return nlohmann::json {
+        {"times", encode_times(pKeys, count, ticks_per_second, encoding)},
+        {"values", values}
+    };
+}
+
+nlohmann::json encode_track(const aiQuatKey* pKeys, unsigned int count, double ticks_per_second,
+        const TrackEncoding& encoding)
+{
+    std::vector<aiQuaternion> rotations(count);
+    for (unsigned int i = 0; i < count; ++i)
+    {
+        rotations[i] = pKeys[i].mValue;
+    }
+
+    return nlohmann::json {
+        {"times", encode_times(pKeys, count, ticks_per_second, encoding)},
+        {"values", encode_rotations(rotations, encoding.rotation_bits)}
+    };
+}
+
+aiVector3D sample_vector(const aiVectorKey* pKeys, unsigned int count, double time, const aiVector3D& fallback)
+{
+    if (count == 0)
+    {
+        return fallback;
+    }
+
+    const aiVectorKey* pEnd = pKeys + count;
+    const aiVectorKey* pNext = std::upper_bound(pKeys, pEnd, time,
+            [](double t, const aiVectorKey& key) { return t < key.mTime; });
+
+    if (pNext == pKeys)
+    {
+        return pKeys->mValue;
+    }
+    if (pNext == pEnd)
+    {
+        return pKeys[count - 1].mValue;
+    }
+
+    const aiVectorKey* pPrev = pNext - 1;
+    double span = pNext->mTime - pPrev->mTime;
+    return lerp(pPrev->mValue, pNext->mValue, span > 0.0 ? (time - pPrev->mTime) / span : 0.0);
+}
+
+aiQuaternion sample_rotation(const aiQuatKey* pKeys, unsigned int count, double time)
+{
+    if (count == 0)
+    {
+        return aiQuaternion();
+    }
+
+    const aiQuatKey* pEnd = pKeys + count;
+    const aiQuatKey* pNext = std::upper_bound(pKeys, pEnd, time,
+            [](double t, const aiQuatKey& key) { return t < key.mTime; });
+
+    if (pNext == pKeys)
+    {
+        return pKeys->mValue;
+    }
+    if (pNext == pEnd)
+    {
+        return pKeys[count - 1].mValue;
+    }
+
+    const aiQuatKey* pPrev = pNext - 1;
+    double span = pNext->mTime - pPrev->mTime;
+    return slerp(pPrev->mValue, pNext->mValue, span > 0.0 ? (time - pPrev->mTime) / span : 0.0);
+}
+
+nlohmann::json sample_animation(const aiAnimation* pAnimation, double frame_rate, const TrackEncoding& encoding)
+{
+    const double tick_rate = ticks_per_second(pAnimation);
+    double seconds = pAnimation->mDuration / tick_rate;
+    const unsigned int whole_frames = static_cast<unsigned int>(std::floor(seconds * frame_rate + 1e-6)) + 1;
+
+    // One more sample at the end when the duration is not a whole number of
+    // frames, so the last pose is not lost. Frame numbers stay whole by
+    // taking it at the next frame, where the tracks hold their last keys.
+    std::vector<double> times(whole_frames);
+    for (unsigned int f = 0; f < whole_frames; ++f)
+    {
+        times[f] = f / frame_rate;
+    }
+    if (seconds - times.back() > 1e-6 / frame_rate)
+    {
+        times.push_back(encoding.times == KeyTimes::Frames ? whole_frames / frame_rate : seconds);
+    }
+    const unsigned int num_frames = static_cast<unsigned int>(times.size());
+
+    std::vector<nlohmann::json> channels(pAnimation->mNumChannels);
+
+    parallel_for(channels.size(), [&](std::size_t i) {
+        const aiNodeAnim* pChannel = pAnimation->mChannels[i];
+        TraceSpan span("SampleChannel", static_cast<long>(i), pChannel->mNodeName.C_Str());
+
+        std::vector<float> translations;
+        std::vector<aiQuaternion> rotations;
+        std::vector<float> scales;
+        translations.reserve(num_frames * 3);
+        rotations.reserve(num_frames);
+        scales.reserve(num_frames * 3);
+
+        for (unsigned int f = 0; f < num_frames; ++f)
+        {
+            double tick = times[f] * tick_rate;
+
+            aiVector3D t = sample_vector(pChannel->mPositionKeys, pChannel->mNumPositionKeys, tick, aiVector3D(0.f));
+            aiQuaternion r = sample_rotation(pChannel->mRotationKeys, pChannel->mNumRotationKeys, tick);
+            aiVector3D s = sample_vector(pChannel->mScalingKeys, pChannel->mNumScalingKeys, tick, aiVector3D(1.f));
+
+            // q and -q are the same rotation; keeping each sample in the
+            // previous one's hemisphere makes them interpolate the short way.
+            if (!rotations.empty() && dot(rotations.back(), r) < 0.0)
+            {
+                r = aiQuaternion(-r.w, -r.x, -r.y, -r.z);
+            }
+
+            translations.insert(translations.end(), { t.x, t.y, t.z });
+            rotations.push_back(r);
+            scales.insert(scales.end(), { s.x, s.y, s.z });
+        }
+
+        channels[i] = nlohmann::json {
+            {"node_name", pChannel->mNodeName.C_Str()},
+            {"translations", translations},
+            {"rotations", encode_rotations(rotations, encoding.rotation_bits)},
+            {"scales", scales}
+        };
+    });
+
+    nlohmann::json time_track;
+    if (encoding.times == KeyTimes::Frames)
+    {
+        time_track = nlohmann::json::array();
+        for (unsigned int f = 0; f < num_frames; ++f)
+        {
+            time_track.push_back(f);
+        }
+    }
+    else if (encoding.times == KeyTimes::Float)
+    {
+        time_track = std::vector<float>(times.begin(), times.end());
+    }
+    else
+    {
+        time_track = times;
+    }
+
+    return nlohmann::json {
+        {"frame_rate", frame_rate},
+        {"num_frames", num_frames},
+        {"rotation_bits", encoding.rotation_bits},
+        {"times", time_track},
+        {"channels", channels}
+    };
+}
+
+KeyframeStats reduce_keyframes(aiScene* pScene, const KeyframeTolerance& tolerance)
+{
+    std::vector<aiNodeAnim*> channels;
+    for (unsigned int i = 0; i < pScene->mNumAnimations; ++i)
+    {
+        const aiAnimation* pAnimation = pScene->mAnimations[i];
+        channels.insert(channels.end(), pAnimation->mChannels, pAnimation->mChannels + pAnimation->mNumChannels);
+    }
+
+    std::vector<KeyframeStats> stats(channels.size());
+
+    parallel_for(channels.size(), [&](std::size_t i) {
+        aiNodeAnim* pChannel = channels[i];
+        TraceSpan span("ReduceChannel", static_cast<long>(i), pChannel->mNodeName.C_Str());
+        KeyframeStats& s = stats[i];
+
+        s.position_before = pChannel->mNumPositionKeys;
+        s.rotation_before = pChannel->mNumRotationKeys;
+        s.scaling_before = pChannel->mNumScalingKeys;
+
+        replace_keys(pChannel->mPositionKeys, pChannel->mNumPositionKeys,
+                reduce_track(pChannel->mPositionKeys, pChannel->mNumPositionKeys, tolerance.translation, lerp, distance));
+        replace_keys(pChannel->mRotationKeys, pChannel->mNumRotationKeys,
+                reduce_track(pChannel->mRotationKeys, pChannel->mNumRotationKeys, tolerance.rotation, slerp, angle));
+        replace_keys(pChannel->mScalingKeys, pChannel->mNumScalingKeys,
+                reduce_track(pChannel->mScalingKeys, pChannel->mNumScalingKeys, tolerance.scale, lerp, distance));
+
+        s.position_after = pChannel->mNumPositionKeys;
+        s.rotation_after = pChannel->mNumRotationKeys;
+        s.scaling_after = pChannel->mNumScalingKeys;
+    });
+
+    KeyframeStats total;
+    for (const KeyframeStats& s : stats)
+    {
+        total.position_before += s.position_before;
+        total.position_after += s.position_after;
+        total.rotation_before += s.rotation_before;
+        total.rotation_after += s.rotation_after;
+        total.scaling_before += s.scaling_before;
+        total.scaling_after += s.scaling_after;
+    }
+
+    return total;
+}
+
+nlohmann::json bake_skinning(const aiScene* pScene, double frame_rate, bool half)
+{
+    std::vector<FlatNode> nodes;
+    if (pScene->mRootNode)
+    {
+        flatten(pScene->mRootNode, -1, nodes);
+    }
+
+    std::map<std::string, int> node_index;
+    for (std::size_t i = 0; i < nodes.size(); ++i)
+    {
+        node_index.emplace(nodes[i].pNode->mName.C_Str(), static_cast<int>(i));
+    }
+
+    // A bone shared by several meshes shares a palette entry only where its
+    // offset matrix is the same in each; mesh_bones maps every mesh's own
+    // bone indices to palette entries, -1 for bones without a node.
+    std::vector<SkinBone> bones;
+    std::multimap<std::string, std::size_t> bone_index;
+    nlohmann::json mesh_bones = nlohmann::json::array();
+    for (unsigned int m = 0; m < pScene->mNumMeshes; ++m)
+    {
+        const aiMesh* pMesh = pScene->mMeshes[m];
+        std::vector<long> palette(pMesh->mNumBones, -1);
+        for (unsigned int b = 0; b < pMesh->mNumBones; ++b)
+        {
+            const aiBone* pBone = pMesh->mBones[b];
+            std::string name = pBone->mName.C_Str();
+            auto node = node_index.find(name);
+            if (node == node_index.end())
+            {
+                continue;
+            }
+
+            auto same = bone_index.equal_range(name);
+            for (auto it = same.first; it != same.second && palette[b] < 0; ++it)
+            {
+                if (bones[it->second].offset == pBone->mOffsetMatrix)
+                {
+                    palette[b] = static_cast<long>(it->second);
+                }
+            }
+
+            if (palette[b] < 0)
+            {
+                palette[b] = static_cast<long>(bones.size());
+                bone_index.emplace(name, bones.size());
+                bones.push_back(SkinBone { name, pBone->mOffsetMatrix, node->second });
+            }
+        }
+        mesh_bones.push_back(palette);
+    }
+
+    aiMatrix4x4 inverse_root;
+    if (pScene->mRootNode)
+    {
+        inverse_root = pScene->mRootNode->mTransformation;
+        inverse_root.Inverse();
+    }
+
+    std::vector<std::string> bone_names;
+    for (const SkinBone& bone : bones)
+    {
+        bone_names.push_back(bone.name);
+    }
+
+    nlohmann::json animations = nlohmann::json::array();
+
+    for (unsigned int a = 0; a < pScene->mNumAnimations; ++a)
+    {
+        const aiAnimation* pAnimation = pScene->mAnimations[a];
+        TraceSpan span("BakeSkinning", a, pAnimation->mName.C_Str());
+
+        std::vector<const aiNodeAnim*> channel_of(nodes.size(), nullptr);
+        for (unsigned int c = 0; c < pAnimation->mNumChannels; ++c)
+        {
+            auto node = node_index.find(pAnimation->mChannels[c]->mNodeName.C_Str());
+            if (node != node_index.end())
+            {
+                channel_of[node->second] = pAnimation->mChannels[c];
+            }
+        }
+
+        const double tick_rate = ticks_per_second(pAnimation);
+        double seconds = pAnimation->mDuration / tick_rate;
+        unsigned int num_frames = static_cast<unsigned int>(std::floor(seconds * frame_rate + 1e-6)) + 1;
+
+        const std::size_t frame_size = bones.size() * 12;
+        std::vector<float> matrices(num_frames * frame_size);
+
+        parallel_for(num_frames, [&](std::size_t f) {
+            double tick = f / frame_rate * tick_rate;
+
+            std::vector<aiMatrix4x4> globals(nodes.size());
+            for (std::size_t n = 0; n < nodes.size(); ++n)
+            {
+                aiMatrix4x4 local = nodes[n].pNode->mTransformation;
+                if (const aiNodeAnim* pChannel = channel_of[n])
+                {
+                    local = aiMatrix4x4(
+                            sample_vector(pChannel->mScalingKeys, pChannel->mNumScalingKeys, tick, aiVector3D(1.f)),
+                            sample_rotation(pChannel->mRotationKeys, pChannel->mNumRotationKeys, tick),
+                            sample_vector(pChannel->mPositionKeys, pChannel->mNumPositionKeys, tick, aiVector3D(0.f)));
+                }
+
+                globals[n] = nodes[n].parent < 0 ? local : globals[nodes[n].parent] * local;
+            }
+
+            float* pOut = &matrices[f * frame_size];
+            for (const SkinBone& bone : bones)
+            {
+                aiMatrix4x4 skin = inverse_root * globals[bone.node] * bone.offset;
+                const ai_real rows[12] = {
+                    skin.a1, skin.a2, skin.a3, skin.a4,
+                    skin.b1, skin.b2, skin.b3, skin.b4,
+                    skin.c1, skin.c2, skin.c3, skin.c4
+                };
+                pOut = std::copy(rows, rows + 12, pOut);
+            }
+        });
+
+        nlohmann::json baked = {
+            {"name", pAnimation->mName.C_Str()},
+            {"frame_rate", frame_rate},
+            {"num_frames", num_frames}
+        };
+
+        if (half)
+        {
+            std::vector<std::uint16_t> packed(matrices.size());
+            std::transform(matrices.begin(), matrices.end(), packed.begin(), to_half);
+            baked["matrices"] = packed;
+        }
+        else
+        {
+            baked["matrices"] = matrices;
+        }
+
+        animations.push_back(baked);
+    }
+
+    return nlohmann::json {
+        {"bones", bone_names},
+        {"mesh_bones", mesh_bones},
+        {"num_bones", bones.size()},
+        {"precision", half ? "half" : "float"},
+        {"animations", animations}
+    };
+}
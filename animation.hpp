@@ -0,0 +1,112 @@
+#pragma once
+
+#include <assimp/scene.h>
+
+#include <json/json.hpp>
+
+#include <cstddef>
+#include <cstdint>
+
+// Largest error a removed key may introduce when it is rebuilt by interpolating
+// its surviving neighbours. Translation and scale are distances, rotation is an
+// angle in radians.
+struct KeyframeTolerance
+{
+    double translation = 1e-4;
+    double rotation = 1e-4;
+    double scale = 1e-4;
+};
+
+struct KeyframeStats
+{
+    std::size_t position_before = 0;
+    std::size_t position_after = 0;
+    std::size_t rotation_before = 0;
+    std::size_t rotation_after = 0;
+    std::size_t scaling_before = 0;
+    std::size_t scaling_after = 0;
+};
+
+// Drops every position, rotation and scaling key of every aiNodeAnim in the
+// scene that can be reproduced within tolerance from the keys kept around it.
+// Channels are reduced in parallel.
+KeyframeStats reduce_keyframes(aiScene* pScene, const KeyframeTolerance& tolerance);
+
+// Value of a key track at the given time (in ticks), interpolating linearly
+// between the surrounding keys and clamping outside them.
+aiVector3D sample_vector(const aiVectorKey* pKeys, unsigned int count, double time, const aiVector3D& fallback);
+aiQuaternion sample_rotation(const aiQuatKey* pKeys, unsigned int count, double time);
+
+enum class KeyTimes
+{
+    Double,
+    Float,
+    Frames
+};
+
+// How compact track output stores key times and rotations. rotation_bits is
+// 0 for plain xyzw floats, or 32/48 for smallest-three packing. frame_rate
+// is what key tracks count KeyTimes::Frames in; sampled tracks count their
+// samples.
+struct TrackEncoding
+{
+    unsigned int rotation_bits = 0;
+    KeyTimes times = KeyTimes::Double;
+    double frame_rate = 30.0;
+
+    bool compact() const { return rotation_bits != 0 || times != KeyTimes::Double; }
+};
+
+// Smallest-three rotation packing. The largest of |x|, |y|, |z|, |w| is
+// dropped (the quaternion is negated first so it is positive) and the other
+// three, which lie in [-1/sqrt(2), 1/sqrt(2)], are quantized in x, y, z, w
+// order to 10 bits (32-bit form) or 15 bits (48-bit form):
+//
+//     32 bits: [31:30] dropped index, [29:20] a, [19:10] b, [9:0] c
+//     48 bits: three uint16 words; word k holds component k in bits [14:0],
+//              word 0 bit 15 is the high and word 1 bit 15 the low bit of the
+//              dropped index, word 2 bit 15 is zero
+//
+// A decoder maps each component back with c = q / (2^bits - 1) * sqrt(2) - 1/sqrt(2),
+// recovers the dropped one as sqrt(1 - a^2 - b^2 - c^2) and reinserts it at the
+// dropped index (0 = x, 1 = y, 2 = z, 3 = w), exactly as unpack_rotation32/48 do.
+std::uint32_t pack_rotation32(const aiQuaternion& q);
+void pack_rotation48(const aiQuaternion& q, std::uint16_t words[3]);
+aiQuaternion unpack_rotation32(std::uint32_t packed);
+aiQuaternion unpack_rotation48(const std::uint16_t words[3]);
+
+// The animation's ticks per second, or Assimp's default of 25 when the
+// format left it at zero.
+double ticks_per_second(const aiAnimation* pAnimation);
+
+// A key track as {"times": [...], "values": [...]} with flat values, times and
+// rotations stored as requested. Frame times are key times in ticks converted
+// to seconds and rounded to the nearest frame at encoding.frame_rate.
+nlohmann::json encode_track(const aiVectorKey* pKeys, unsigned int count, double ticks_per_second,
+        const TrackEncoding& encoding);
+nlohmann::json encode_track(const aiQuatKey* pKeys, unsigned int count, double ticks_per_second,
+        const TrackEncoding& encoding);
+
+// Resamples every node channel of the animation at frame_rate frames per
+// second and returns it with one shared time track (in seconds, or frame
+// numbers) and flat per-channel translation (xyz), rotation (xyzw, or packed)
+// and scale (xyz) arrays. The last sample is at the end of the animation,
+// between frames when the duration is not a whole number of them; with
+// KeyTimes::Frames it is at the next whole frame instead, holding the end
+// pose. Each rotation is in the same hemisphere as the one before.
+nlohmann::json sample_animation(const aiAnimation* pAnimation, double frame_rate, const TrackEncoding& encoding);
+
+// Float to IEEE 754 binary16 bits, rounding to nearest even: denormals
+// where a half has them, infinity past its range, and NaN kept NaN.
+std::uint16_t to_half(float value);
+
+// Evaluates every animation of the scene at frame_rate frames per second
+// through the node hierarchy and returns per-frame, per-bone skinning
+// matrices (inverse root transform x global bone pose x bone offset) for
+// GPU animation textures. A bone is shared across meshes where its name and
+// offset matrix match; "mesh_bones" lists, per mesh, the palette entry of
+// each of its bones (-1 for a bone with no node) in aiMesh order. Each
+// animation's "matrices" holds frames x bones x 12 values, the top three
+// rows of each matrix row-major, as floats or as IEEE half bit patterns.
+// Frames are evaluated in parallel.
+nlohmann::json bake_skinning(const aiScene* pScene, double frame_rate, bool half);
@@ -0,0 +1,140 @@
+#include "converter.hpp"
+#include "options.hpp"
+#include "output.hpp"
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <iostream>
+#include <ostream>
+#include <string>
+#include <vector>
+
+// Times writing one large JSON document through FdOutputBuffer with a
+// single inline buffer against the default ring drained by a writer thread.
+//
+//   bench_write <output path> [vertices] [runs]
+//
+// Each run serializes and writes the whole document to the path; the
+// median of the runs is reported for each buffer count.
+
+namespace
+{
+
+// A mesh-shaped document: flat position, normal and index arrays, about
+// 180 bytes of JSON per vertex.
+nlohmann::json make_document(long vertices)
+{
+    nlohmann::json positions = nlohmann::json::array();
+    nlohmann::json normals = nlohmann::json::array();
+    nlohmann::json indices = nlohmann::json::array();
+    for (long i = 0; i < vertices; ++i)
+    {
+        const double t = i * 0.001;
+        positions.push_back(t * 1.5);
+        positions.push_back(t * -0.25 + 3.0);
+        positions.push_back(t / 7.0);
+        normals.push_back(0.267261);
+        normals.push_back(0.534522);
+        normals.push_back(0.801784);
+        indices.push_back(i);
+    }
+
+    nlohmann::json mesh = { {"name", "bench"}, {"vertices", positions}, {"normals", normals}, {"faces", indices} };
+    return nlohmann::json { {"meshes", nlohmann::json::array({ mesh })} };
+}
+
+// Milliseconds to serialize and write the document, or a negative value if
+// the write failed.
+double time_write(const nlohmann::json& document, const std::string& path, unsigned int buffer_count)
+{
+    const auto start = std::chrono::steady_clock::now();
+
+    std::string error;
+    int fd = open_output(path, error);
+    if (fd < 0)
+    {
+        std::cerr << "Error: " << error << std::endl;
+        return -1.0;
+    }
+
+    bool ok = true;
+    {
+        FdOutputBuffer buffer(fd, true, FdOutputBuffer::kDefaultCapacity, buffer_count);
+        std::ostream output(&buffer);
+        write_document(output, document, OutputFormat::Json);
+        output.flush();
+        ok = output.good() && buffer.close();
+    }
+
+    const double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+    return ok ? ms : -1.0;
+}
+
+double median(std::vector<double> values)
+{
+    std::sort(values.begin(), values.end());
+    return values[values.size() / 2];
+}
+
+}
+
+int main(int argc, char* argv[])
+{
+    long vertices = 300000;
+    long runs = 5;
+    if (argc < 2 || (argc > 2 && (!parse_integer(argv[2], vertices) || vertices < 1))
+            || (argc > 3 && (!parse_integer(argv[3], runs) || runs < 1)))
+    {
+        std::cerr << "Usage: bench_write <output path> [vertices] [runs]" << std::endl;
+        return 1;
+    }
+    const std::string path = argv[1];
+
+    const nlohmann::json document = make_document(vertices);
+    const unsigned int counts[] = { 1, FdOutputBuffer::kDefaultBufferCount };
+
+    // One untimed write so the page cache and the file's blocks are warm
+    // for the first timed run.
+    if (time_write(document, path, 1) < 0.0)
+    {
+        return 1;
+    }
+
+    std::vector<double> times[2];
+    for (long run = 0; run < runs; ++run)
+    {
+        // Alternated so drift over the runs affects both alike.
+        for (int i = 0; i < 2; ++i)
+        {
+            const double ms = time_write(document, path, counts[i]);
+            if (ms < 0.0)
+            {
+                return 1;
+            }
+            times[i].push_back(ms);
+        }
+    }
+
+    std::FILE* pFile = std::fopen(path.c_str(), "rb");
+    long size = 0;
+    if (pFile)
+    {
+        std::fseek(pFile, 0, SEEK_END);
+        size = std::ftell(pFile);
+        std::fclose(pFile);
+    }
+
+    std::cout << "document: " << size / 1048576.0 << " MiB, " << runs << " runs" << std::endl;
+    for (int i = 0; i < 2; ++i)
+    {
+        const double ms = median(times[i]);
+        std::cout << "write-buffers=" << counts[i] << ": " << ms << " ms median, "
+                  << size / 1048576.0 / (ms / 1000.0) << " MiB/s" << std::endl;
+    }
+    std::cout << "speedup: " << median(times[0]) / median(times[1]) << "x" << std::endl;
+    return 0;
+}
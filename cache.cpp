@@ -0,0 +1,830 @@
+#include "cache.hpp"
+
+#include <json/json.hpp>
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/file.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <unistd.h>
+
+#ifdef __linux__
+#include <linux/fs.h>
+#endif
+
+#include <algorithm>
+#include <cerrno>
+#include <climits>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <fstream>
+
+namespace
+{
+
+const std::uint64_t kPrime1 = 11400714785074694791ULL;
+const std::uint64_t kPrime2 = 14029467366897019727ULL;
+const std::uint64_t kPrime3 = 1609587929392839161ULL;
+const std::uint64_t kPrime4 = 9650029242287828579ULL;
+const std::uint64_t kPrime5 = 2870177450012600261ULL;
+
+std::uint64_t rotate_left(std::uint64_t value, int bits)
+{
+    return (value << bits) | (value >> (64 - bits));
+}
+
+std::uint64_t read64(const unsigned char* p)
+{
+    std::uint64_t value;
+    std::memcpy(&value, p, sizeof(value));
+    return value;
+}
+
+std::uint32_t read32(const unsigned char* p)
+{
+    std::uint32_t value;
+    std::memcpy(&value, p, sizeof(value));
+    return value;
+}
+
+std::uint64_t mix_round(std::uint64_t accumulator, std::uint64_t input)
+{
+    accumulator += input * kPrime2;
+    return rotate_left(accumulator, 31) * kPrime1;
+}
+
+std::uint64_t merge_round(std::uint64_t hash, std::uint64_t accumulator)
+{
+    hash ^= mix_round(0, accumulator);
+    return hash * kPrime1 + kPrime4;
+}
+
+// Staging entries this old were left by a run that crashed or was killed.
+const time_t kStaleTempSeconds = 60 * 60;
+
+std::string join(const std::string& directory, const std::string& name)
+{
+    return directory + "/" + name;
+}
+
+bool make_directories(const std::string& path)
+{
+    for (std::size_t slash = path.find('/', 1); ; slash = path.find('/', slash + 1))
+    {
+        const std::string prefix = path.substr(0, slash);
+        if (::mkdir(prefix.c_str(), 0755) != 0 && errno != EEXIST)
+        {
+            return false;
+        }
+        if (slash == std::string::npos)
+        {
+            return true;
+        }
+    }
+}
+
+std::vector<std::string> list_directory(const std::string& path)
+{
+    std::vector<std::string> names;
+    if (DIR* pDir = ::opendir(path.c_str()))
+    {
+        while (dirent* pEntry = ::readdir(pDir))
+        {
+            const std::string name = pEntry->d_name;
+            if (name != "." && name != "..")
+            {
+                names.push_back(name);
+            }
+        }
+        ::closedir(pDir);
+    }
+    return names;
+}
+
+std::uint64_t directory_bytes(const std::string& path)
+{
+    std::uint64_t bytes = 0;
+    for (const std::string& name : list_directory(path))
+    {
+        struct stat info;
+        if (::stat(join(path, name).c_str(), &info) == 0)
+        {
+            bytes += info.st_size;
+        }
+    }
+    return bytes;
+}
+
+void remove_entry(const std::string& path)
+{
+    for (const std::string& name : list_directory(path))
+    {
+        ::unlink(join(path, name).c_str());
+    }
+    ::rmdir(path.c_str());
+}
+
+bool copy_file(int in, int out)
+{
+    char buffer[1 << 16];
+    for (;;)
+    {
+        ssize_t count = ::read(in, buffer, sizeof(buffer));
+        if (count == 0)
+        {
+            return true;
+        }
+        if (count < 0)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            return false;
+        }
+
+        for (ssize_t done = 0; done < count; )
+        {
+            ssize_t written = ::write(out, buffer + done, count - done);
+            if (written < 0 && errno != EINTR)
+            {
+                return false;
+            }
+            done += std::max<ssize_t>(written, 0);
+        }
+    }
+}
+
+// Puts a copy of the cached file at destination: a reflink where the file
+// system supports it, otherwise a hardlink to the read-only cached file,
+// otherwise a plain copy.
+bool place_file(const std::string& source, const std::string& destination)
+{
+    int in = ::open(source.c_str(), O_RDONLY);
+    if (in < 0)
+    {
+        return false;
+    }
+
+    if (destination == "-")
+    {
+        bool copied = copy_file(in, STDOUT_FILENO);
+        ::close(in);
+        return copied;
+    }
+
+    ::unlink(destination.c_str());
+
+    int out = ::open(destination.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (out < 0)
+    {
+        ::close(in);
+        return false;
+    }
+
+#ifdef FICLONE
+    if (::ioctl(out, FICLONE, in) == 0)
+    {
+        ::close(out);
+        ::close(in);
+        return true;
+    }
+#endif
+
+    ::close(out);
+    ::unlink(destination.c_str());
+
+    if (::link(source.c_str(), destination.c_str()) == 0)
+    {
+        ::close(in);
+        return true;
+    }
+
+    out = ::open(destination.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    bool copied = out >= 0 && copy_file(in, out);
+    if (out >= 0)
+    {
+        copied = ::close(out) == 0 && copied;
+    }
+    ::close(in);
+    return copied;
+}
+
+// An absolute path for a file that may not exist: its directory resolved
+// where that exists, otherwise relative to the working directory.
+std::string absolute_path(const std::string& path)
+{
+    const std::size_t slash = path.rfind('/');
+    const std::string directory = slash == std::string::npos ? "." : path.substr(0, std::max<std::size_t>(slash, 1));
+    const std::string name = slash == std::string::npos ? path : path.substr(slash + 1);
+
+    char resolved[PATH_MAX];
+    if (::realpath(directory.c_str(), resolved))
+    {
+        return join(std::strcmp(resolved, "/") == 0 ? "" : resolved, name);
+    }
+    if (path[0] == '/' || !::getcwd(resolved, sizeof(resolved)))
+    {
+        return path;
+    }
+    return join(resolved, path);
+}
+
+bool read_manifest(const std::string& path, nlohmann::json& manifest)
+{
+    std::ifstream input(path);
+    if (!input)
+    {
+        return false;
+    }
+
+    try
+    {
+        input >> manifest;
+    }
+    catch (const std::exception&)
+    {
+        return false;
+    }
+    return manifest.is_object();
+}
+
+}
+
+std::uint64_t hash_bytes(const void* pData, std::size_t size, std::uint64_t seed)
+{
+    const unsigned char* p = static_cast<const unsigned char*>(pData);
+    const unsigned char* pEnd = p + size;
+    std::uint64_t hash;
+
+    if (size >= 32)
+    {
+        std::uint64_t v1 = seed + kPrime1 + kPrime2;
+        std::uint64_t v2 = seed + kPrime2;
+        std::uint64_t v3 = seed;
+        std::uint64_t v4 = seed - kPrime1;
+
+        for (; p + 32 <= pEnd; p += 32)
+        {
+            v1 = mix_round(v1, read64(p));
+            v2 = mix_round(v2, read64(p + 8));
+            v3 = mix_round(v3, read64(p + 16));
+            v4 = mix_round(v4, read64(p + 24));
+        }
+
+        hash = rotate_left(v1, 1) + rotate_left(v2, 7) + rotate_left(v3, 12) + rotate_left(v4, 18);
+        hash = merge_round(hash, v1);
+        hash = merge_round(hash, v2);
+        hash = merge_round(hash, v3);
+        hash = merge_round(hash, v4);
+    }
+    else
+    {
+        hash = seed + kPrime5;
+    }
+
+    hash += size;
+
+    for (; p + 8 <= pEnd; p += 8)
+    {
+        hash ^= mix_round(0, read64(p));
+        hash = rotate_left(hash, 27) * kPrime1 + kPrime4;
+    }
+
+    if (p + 4 <= pEnd)
+    {
+        hash ^= read32(p) * kPrime1;
+        hash = rotate_left(hash, 23) * kPrime2 + kPrime3;
+        p += 4;
+    }
+
+    for (; p < pEnd; ++p)
+    {
+        hash ^= *p * kPrime5;
+        hash = rotate_left(hash, 11) * kPrime1;
+    }
+
+    hash ^= hash >> 33;
+    hash *= kPrime2;
+    hash ^= hash >> 29;
+    hash *= kPrime3;
+    hash ^= hash >> 32;
+    return hash;
+}
+
+bool hash_file(const std::string& path, std::uint64_t& hash, std::uint64_t& size, std::string& error)
+{
+    int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0)
+    {
+        error = std::strerror(errno);
+        return false;
+    }
+
+    struct stat info;
+    if (::fstat(fd, &info) != 0)
+    {
+        error = std::strerror(errno);
+        ::close(fd);
+        return false;
+    }
+
+    size = info.st_size;
+    if (size == 0)
+    {
+        hash = hash_bytes(nullptr, 0);
+        ::close(fd);
+        return true;
+    }
+
+    void* pData = ::mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    ::close(fd);
+    if (pData == MAP_FAILED)
+    {
+        error = std::strerror(errno);
+        return false;
+    }
+
+    ::madvise(pData, size, MADV_SEQUENTIAL);
+    hash = hash_bytes(pData, size);
+    ::munmap(pData, size);
+    return true;
+}
+
+bool stamp_file(const std::string& path, FileStamp& stamp)
+{
+    struct stat info;
+    if (::stat(path.c_str(), &info) != 0)
+    {
+        return false;
+    }
+
+    stamp.path = path;
+    stamp.device = info.st_dev;
+    stamp.inode = info.st_ino;
+    stamp.size = info.st_size;
+    stamp.mtime_ns = std::int64_t(info.st_mtim.tv_sec) * 1000000000 + info.st_mtim.tv_nsec;
+    return true;
+}
+
+bool stamp_unchanged(const FileStamp& stamp)
+{
+    FileStamp now;
+    if (!stamp_file(stamp.path, now))
+    {
+        return !stamp.exists;
+    }
+    return stamp.exists && now.device == stamp.device && now.inode == stamp.inode && now.size == stamp.size
+            && now.mtime_ns == stamp.mtime_ns;
+}
+
+ConversionCache::ConversionCache(const std::string& directory, std::uint64_t max_bytes)
+    : mDirectory(directory), mMaxBytes(max_bytes), mTempCount(0)
+{
+}
+
+bool ConversionCache::open(std::string& error)
+{
+    if (!make_directories(mDirectory))
+    {
+        error = mDirectory + ": " + std::strerror(errno);
+        return false;
+    }
+
+    remove_stale_temps();
+    return true;
+}
+
+std::string ConversionCache::make_key(std::uint64_t input_hash, std::uint64_t input_size, const std::string& options)
+{
+    const std::string described = options + ";input_size=" + std::to_string(input_size);
+
+    char key[34];
+    std::snprintf(key, sizeof(key), "%016llx%016llx",
+            static_cast<unsigned long long>(input_hash),
+            static_cast<unsigned long long>(hash_bytes(described.data(), described.size())));
+    return key;
+}
+
+bool ConversionCache::fetch(const std::string& key, const CacheArtifacts& destinations)
+{
+    return lookup(key) && place(key, destinations);
+}
+
+bool ConversionCache::lookup(const std::string& key, std::vector<std::string>* pDependencies,
+        std::vector<std::string>* pAbsent)
+{
+    const std::string entry = join(mDirectory, key);
+
+    bool hit = dependencies_unchanged(entry, pDependencies, pAbsent);
+    if (hit)
+    {
+        // The manifest's modification time is the entry's last use.
+        ::utimes(join(entry, "manifest").c_str(), nullptr);
+    }
+
+    count(hit);
+    return hit;
+}
+
+std::string ConversionCache::artifact_path(const std::string& key, const std::string& name) const
+{
+    return join(join(mDirectory, key), name);
+}
+
+bool ConversionCache::place(const std::string& key, const CacheArtifacts& destinations)
+{
+    const std::string entry = join(mDirectory, key);
+    for (const auto& artifact : destinations)
+    {
+        if (!place_file(join(entry, artifact.first), artifact.second))
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+std::string ConversionCache::temp_path()
+{
+    return join(mDirectory, "tmp." + std::to_string(::getpid()) + "." + std::to_string(++mTempCount));
+}
+
+bool ConversionCache::store(const std::string& key, const CacheArtifacts& sources,
+        const std::vector<std::string>& dependencies, const std::vector<std::string>& absent, std::string& error)
+{
+    const std::string staging = temp_path();
+    if (::mkdir(staging.c_str(), 0755) != 0)
+    {
+        error = staging + ": " + std::strerror(errno);
+        return false;
+    }
+
+    nlohmann::json manifest;
+    manifest["dependencies"] = nlohmann::json::array();
+    manifest["absent"] = nlohmann::json::array();
+    manifest["artifacts"] = nlohmann::json::array();
+
+    for (const auto& artifact : sources)
+    {
+        const std::string path = join(staging, artifact.first);
+        if (::rename(artifact.second.c_str(), path.c_str()) != 0)
+        {
+            error = artifact.second + ": " + std::strerror(errno);
+            remove_entry(staging);
+            return false;
+        }
+
+        // Hits may hand out hardlinks; keep them from being edited in place.
+        ::chmod(path.c_str(), 0444);
+        manifest["artifacts"].push_back(artifact.first);
+    }
+
+    for (const std::string& dependency : dependencies)
+    {
+        char resolved[PATH_MAX];
+        std::uint64_t hash = 0;
+        std::uint64_t size = 0;
+        std::string ignored;
+        if (::realpath(dependency.c_str(), resolved) && hash_file(resolved, hash, size, ignored))
+        {
+            manifest["dependencies"].push_back({
+                {"path", resolved},
+                {"size", size},
+                {"hash", hash}
+            });
+        }
+    }
+
+    for (const std::string& path : absent)
+    {
+        manifest["absent"].push_back(absolute_path(path));
+    }
+
+    {
+        std::ofstream output(join(staging, "manifest"));
+        output << manifest.dump() << std::endl;
+        if (!output)
+        {
+            error = "Failed to write cache manifest";
+            remove_entry(staging);
+            return false;
+        }
+    }
+
+    const std::string entry = join(mDirectory, key);
+    if (::rename(staging.c_str(), entry.c_str()) != 0)
+    {
+        // An older or concurrently stored entry for the same key.
+        remove_entry(entry);
+        if (::rename(staging.c_str(), entry.c_str()) != 0)
+        {
+            error = entry + ": " + std::strerror(errno);
+            remove_entry(staging);
+            return false;
+        }
+    }
+
+    evict(key);
+    return true;
+}
+
+CacheStats ConversionCache::stats() const
+{
+    CacheStats stats;
+
+    std::ifstream counters(join(mDirectory, "stats"));
+    counters >> stats.hits >> stats.misses;
+
+    for (const std::string& name : list_directory(mDirectory))
+    {
+        const std::string entry = join(mDirectory, name);
+        struct stat info;
+        if (name.compare(0, 4, "tmp.") == 0 || ::stat(entry.c_str(), &info) != 0 || !S_ISDIR(info.st_mode))
+        {
+            continue;
+        }
+
+        ++stats.entries;
+        stats.bytes += directory_bytes(entry);
+    }
+
+    return stats;
+}
+
+bool ConversionCache::dependencies_unchanged(const std::string& entry, std::vector<std::string>* pDependencies,
+        std::vector<std::string>* pAbsent) const
+{
+    nlohmann::json manifest;
+    if (!read_manifest(join(entry, "manifest"), manifest))
+    {
+        return false;
+    }
+
+    for (const auto& dependency : manifest["dependencies"])
+    {
+        std::uint64_t hash = 0;
+        std::uint64_t size = 0;
+        std::string ignored;
+        if (!hash_file(dependency["path"].get<std::string>(), hash, size, ignored)
+                || size != dependency["size"].get<std::uint64_t>()
+                || hash != dependency["hash"].get<std::uint64_t>())
+        {
+            remove_entry(entry);
+            return false;
+        }
+
+        if (pDependencies)
+        {
+            pDependencies->push_back(dependency["path"].get<std::string>());
+        }
+    }
+
+    // A file the importer looked for and did not find, created since.
+    for (const auto& path : manifest["absent"])
+    {
+        if (::access(path.get<std::string>().c_str(), F_OK) == 0)
+        {
+            remove_entry(entry);
+            return false;
+        }
+
+        if (pAbsent)
+        {
+            pAbsent->push_back(path.get<std::string>());
+        }
+    }
+
+    return true;
+}
+
+void ConversionCache::count(bool hit)
+{
+    // Several atj processes may share the cache; the lock keeps the
+    // read-increment-write of the counters whole.
+    int fd = ::open(join(mDirectory, "stats").c_str(), O_RDWR | O_CREAT, 0644);
+    if (fd < 0)
+    {
+        return;
+    }
+
+    ::flock(fd, LOCK_EX);
+
+    char text[64] = {};
+    unsigned long long hits = 0;
+    unsigned long long misses = 0;
+    if (::pread(fd, text, sizeof(text) - 1, 0) > 0)
+    {
+        std::sscanf(text, "%llu %llu", &hits, &misses);
+    }
+
+    (hit ? hits : misses) += 1;
+
+    int length = std::snprintf(text, sizeof(text), "%llu %llu\n", hits, misses);
+    if (::pwrite(fd, text, length, 0) == length)
+    {
+        ::ftruncate(fd, length);
+    }
+
+    ::flock(fd, LOCK_UN);
+    ::close(fd);
+}
+
+void ConversionCache::remove_stale_temps()
+{
+    const time_t now = ::time(nullptr);
+    for (const std::string& name : list_directory(mDirectory))
+    {
+        const std::string path = join(mDirectory, name);
+        struct stat info;
+        if (name.compare(0, 4, "tmp.") != 0 || ::lstat(path.c_str(), &info) != 0
+                || now - info.st_mtime < kStaleTempSeconds)
+        {
+            continue;
+        }
+
+        if (S_ISDIR(info.st_mode))
+        {
+            remove_entry(path);
+        }
+        else
+        {
+            ::unlink(path.c_str());
+        }
+    }
+}
+
+void ConversionCache::evict(const std::string& keep)
+{
+    remove_stale_temps();
+
+    struct Entry
+    {
+        std::string path;
+        std::uint64_t bytes;
+        time_t last_used;
+    };
+
+    std::vector<Entry> entries;
+    std::uint64_t total = 0;
+
+    for (const std::string& name : list_directory(mDirectory))
+    {
+        const std::string path = join(mDirectory, name);
+        struct stat info;
+        if (::stat(path.c_str(), &info) != 0 || !S_ISDIR(info.st_mode))
+        {
+            continue;
+        }
+
+        const std::uint64_t bytes = directory_bytes(path);
+        total += bytes;
+        if (name == keep || name.compare(0, 4, "tmp.") == 0)
+        {
+            continue;
+        }
+
+        Entry entry { path, bytes, 0 };
+        if (::stat(join(path, "manifest").c_str(), &info) == 0)
+        {
+            entry.last_used = info.st_mtime;
+        }
+        entries.push_back(entry);
+    }
+
+    std::sort(entries.begin(), entries.end(), [](const Entry& a, const Entry& b) {
+        return a.last_used < b.last_used;
+    });
+
+    for (const Entry& entry : entries)
+    {
+        if (total <= mMaxBytes)
+        {
+            break;
+        }
+        remove_entry(entry.path);
+        total -= entry.bytes;
+    }
+}
+
+ResultCache::ResultCache(std::uint64_t max_bytes)
+    : mMaxBytes(max_bytes), mBytes(0)
+{
+}
+
+std::shared_ptr<const ResultCache::Result> ResultCache::get(const std::string& key,
+        const std::function<Result()>& produce, bool& produced)
+{
+    produced = false;
+
+    std::unique_lock<std::mutex> lock(mMutex);
+    auto entry = mEntries.find(key);
+    if (entry != mEntries.end())
+    {
+        std::shared_ptr<const Result> result = entry->second.result;
+
+        // Stat the inputs without holding up other lookups.
+        lock.unlock();
+        bool unchanged = true;
+        for (const FileStamp& input : result->inputs)
+        {
+            unchanged = unchanged && stamp_unchanged(input);
+        }
+        lock.lock();
+
+        entry = mEntries.find(key);
+        if (entry != mEntries.end() && entry->second.result == result)
+        {
+            if (unchanged)
+            {
+                mRecent.splice(mRecent.begin(), mRecent, entry->second.position);
+                ++mStats.hits;
+                return result;
+            }
+            erase(entry);
+        }
+    }
+
+    auto running = mInFlight.find(key);
+    if (running != mInFlight.end())
+    {
+        std::shared_ptr<InFlight> pInFlight = running->second;
+        ++mStats.coalesced;
+        mProduced.wait(lock, [&] { return pInFlight->done; });
+        return pInFlight->result;
+    }
+
+    std::shared_ptr<InFlight> pInFlight = std::make_shared<InFlight>();
+    mInFlight[key] = pInFlight;
+    ++mStats.misses;
+    lock.unlock();
+
+    std::shared_ptr<const Result> result;
+    try
+    {
+        result = std::make_shared<const Result>(produce());
+    }
+    catch (const std::exception& e)
+    {
+        Result failed;
+        failed.error = e.what();
+        result = std::make_shared<const Result>(failed);
+    }
+    produced = true;
+
+    lock.lock();
+    if (result->bytes)
+    {
+        store(key, result);
+    }
+    pInFlight->result = result;
+    pInFlight->done = true;
+    mInFlight.erase(key);
+    mProduced.notify_all();
+    return result;
+}
+
+CacheStats ResultCache::stats() const
+{
+    std::lock_guard<std::mutex> lock(mMutex);
+    CacheStats stats = mStats;
+    stats.entries = mEntries.size();
+    stats.bytes = mBytes;
+    return stats;
+}
+
+void ResultCache::store(const std::string& key, const std::shared_ptr<const Result>& result)
+{
+    const std::uint64_t bytes = result->bytes->size() + key.size();
+    if (bytes > mMaxBytes)
+    {
+        return;
+    }
+
+    auto entry = mEntries.find(key);
+    if (entry != mEntries.end())
+    {
+        erase(entry);
+    }
+
+    mRecent.push_front(key);
+    mEntries[key] = Entry { result, bytes, mRecent.begin() };
+    mBytes += bytes;
+
+    while (mBytes > mMaxBytes)
+    {
+        erase(mEntries.find(mRecent.back()));
+    }
+}
+
+void ResultCache::erase(std::unordered_map<std::string, Entry>::iterator entry)
+{
+    mBytes -= entry->second.bytes;
+    mRecent.erase(entry->second.position);
+    mEntries.erase(entry);
+}
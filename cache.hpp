@@ -0,0 +1,184 @@
+#pragma once
+
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <list>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+// 64-bit xxHash (XXH64) of a block of memory.
+std::uint64_t hash_bytes(const void* pData, std::size_t size, std::uint64_t seed = 0);
+
+// XXH64 of a file's contents, read through a memory mapping.
+bool hash_file(const std::string& path, std::uint64_t& hash, std::uint64_t& size, std::string& error);
+
+// A file as the file system identifies it. A file with the same device,
+// inode, size and modification time is taken to hold the same bytes. An
+// absent stamp records a file that was looked for and not found.
+struct FileStamp
+{
+    std::string path;
+    bool exists = true;
+    std::uint64_t device = 0;
+    std::uint64_t inode = 0;
+    std::uint64_t size = 0;
+    std::int64_t mtime_ns = 0;
+};
+
+// Stamps path. False if it cannot be stat'ed.
+bool stamp_file(const std::string& path, FileStamp& stamp);
+
+// Whether the file stamp was taken of still matches it; for an absent
+// stamp, whether the file is still missing.
+bool stamp_unchanged(const FileStamp& stamp);
+
+struct CacheStats
+{
+    std::uint64_t hits = 0;
+    std::uint64_t misses = 0;
+    std::uint64_t entries = 0;
+    std::uint64_t bytes = 0;
+
+    // Lookups that waited for a conversion already under way (ResultCache).
+    std::uint64_t coalesced = 0;
+};
+
+// Named files of one conversion, such as {"output", path} and {"index", path}.
+typedef std::vector<std::pair<std::string, std::string>> CacheArtifacts;
+
+// On-disk cache of finished conversions, content addressed: an entry's key
+// is the hash of the input bytes together with a description of everything
+// else that shapes the output. Each entry also lists the other files the
+// importer read (MTL libraries, external buffers) with their hashes, and the
+// ones it looked for and did not find, and is only used while they are
+// unchanged and still missing. Entries are evicted least recently
+// used first once the cache grows past max_bytes.
+//
+//     <directory>/<key>/manifest    dependencies and artifact names (JSON)
+//     <directory>/<key>/<artifact>  read-only cached files
+//     <directory>/stats             hit and miss counters
+//     <directory>/tmp.*             writes in progress, removed after an hour
+//                                   if their process never finished them
+class ConversionCache
+{
+public:
+    ConversionCache(const std::string& directory, std::uint64_t max_bytes);
+
+    // Creates the cache directory if needed and clears out abandoned
+    // temporary files.
+    bool open(std::string& error);
+
+    static std::string make_key(std::uint64_t input_hash, std::uint64_t input_size, const std::string& options);
+
+    // Places the cached artifacts at their destinations ("-" is standard
+    // output) by reflink, hardlink or copy, and counts a hit. Counts a miss
+    // and returns false when there is no valid entry.
+    bool fetch(const std::string& key, const CacheArtifacts& destinations);
+
+    // Whether key has an entry whose dependencies are unchanged, counting a
+    // hit or a miss. pDependencies and pAbsent receive the entry's dependency
+    // paths and the paths it found missing.
+    bool lookup(const std::string& key, std::vector<std::string>* pDependencies = nullptr,
+            std::vector<std::string>* pAbsent = nullptr);
+
+    // Where an entry keeps the named artifact.
+    std::string artifact_path(const std::string& key, const std::string& name) const;
+
+    // Places the artifacts of an entry without checking or counting it, as
+    // after storing it.
+    bool place(const std::string& key, const CacheArtifacts& destinations);
+
+    // A fresh path inside the cache to write a new artifact to.
+    std::string temp_path();
+
+    // Moves the artifacts into a new entry for key, recording the given
+    // dependencies and the files found absent, then evicts old entries down
+    // to the size budget.
+    bool store(const std::string& key, const CacheArtifacts& sources, const std::vector<std::string>& dependencies,
+            const std::vector<std::string>& absent, std::string& error);
+
+    CacheStats stats() const;
+
+private:
+    bool dependencies_unchanged(const std::string& entry, std::vector<std::string>* pDependencies,
+            std::vector<std::string>* pAbsent) const;
+    void count(bool hit);
+    void evict(const std::string& keep);
+
+    // Removes tmp.* files and staging directories old enough to have been
+    // abandoned by another process; fresh ones may still be in use.
+    void remove_stale_temps();
+
+    std::string mDirectory;
+    std::uint64_t mMaxBytes;
+    unsigned int mTempCount;
+};
+
+// Finished conversions kept in memory by a long-running process, dropped
+// least recently used first past max_bytes. Each entry remembers the files
+// it was made from and is dropped once any of them changes. Concurrent
+// lookups of a key that is being converted wait for that conversion rather
+// than starting their own. Thread safe.
+class ResultCache
+{
+public:
+    struct Result
+    {
+        // The converted bytes, or null when the conversion failed (error set)
+        // or its result was too big to keep (error empty).
+        std::shared_ptr<const std::string> bytes;
+        std::string error;
+
+        std::vector<FileStamp> inputs;
+    };
+
+    explicit ResultCache(std::uint64_t max_bytes);
+
+    // The stored result for key; or, if another caller is producing it, that
+    // result; or else the one produce returns, stored if it succeeded.
+    // produced is set when produce ran in this call. Failures are shared with
+    // the callers waiting for them but not stored.
+    std::shared_ptr<const Result> get(const std::string& key, const std::function<Result()>& produce, bool& produced);
+
+    CacheStats stats() const;
+
+    // The most a stored result can take.
+    std::uint64_t max_bytes() const
+    {
+        return mMaxBytes;
+    }
+
+private:
+    struct Entry
+    {
+        std::shared_ptr<const Result> result;
+        std::uint64_t bytes;
+        std::list<std::string>::iterator position;
+    };
+
+    struct InFlight
+    {
+        std::shared_ptr<const Result> result;
+        bool done = false;
+    };
+
+    void store(const std::string& key, const std::shared_ptr<const Result>& result);
+    void erase(std::unordered_map<std::string, Entry>::iterator entry);
+
+    std::uint64_t mMaxBytes;
+
+    mutable std::mutex mMutex;
+    std::condition_variable mProduced;
+    std::unordered_map<std::string, Entry> mEntries;
+    std::list<std::string> mRecent;
+    std::map<std::string, std::shared_ptr<InFlight>> mInFlight;
+    std::uint64_t mBytes;
+    CacheStats mStats;
+};
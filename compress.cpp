@@ -0,0 +1,351 @@
+#include "compress.hpp"
+
+#include "trace.hpp"
+
+#ifdef ATJ_WITH_ZLIB
+#include <zlib.h>
+#endif
+
+#ifdef ATJ_WITH_ZSTD
+#include <zstd.h>
+#endif
+
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+#include <thread>
+
+namespace
+{
+
+#ifdef ATJ_WITH_ZLIB
+bool gzip(const std::vector<char>& input, int level, std::vector<char>& output)
+{
+    z_stream stream;
+    std::memset(&stream, 0, sizeof(stream));
+
+    // 15 window bits plus 16 asks zlib for a gzip header and trailer.
+    if (deflateInit2(&stream, level < 0 ? Z_DEFAULT_COMPRESSION : level, Z_DEFLATED,
+                15 + 16, 8, Z_DEFAULT_STRATEGY) != Z_OK)
+    {
+        return false;
+    }
+
+    output.resize(deflateBound(&stream, static_cast<uLong>(input.size())));
+    stream.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(input.data()));
+    stream.avail_in = static_cast<uInt>(input.size());
+    stream.next_out = reinterpret_cast<Bytef*>(output.data());
+    stream.avail_out = static_cast<uInt>(output.size());
+
+    int status = deflate(&stream, Z_FINISH);
+    output.resize(stream.total_out);
+    deflateEnd(&stream);
+
+    return status == Z_STREAM_END;
+}
+#endif
+
+#ifdef ATJ_WITH_ZSTD
+bool zstd(const std::vector<char>& input, int level, std::vector<char>& output)
+{
+    output.resize(ZSTD_compressBound(input.size()));
+    std::size_t size = ZSTD_compress(output.data(), output.size(), input.data(), input.size(),
+            level < 0 ? 3 : level);
+    if (ZSTD_isError(size))
+    {
+        return false;
+    }
+
+    output.resize(size);
+    return true;
+}
+#endif
+
+bool compress(const Compression& compression, const std::vector<char>& input, std::vector<char>& output)
+{
+    switch (compression.codec)
+    {
+#ifdef ATJ_WITH_ZLIB
+        case Codec::Gzip:
+            return gzip(input, compression.level, output);
+#endif
+#ifdef ATJ_WITH_ZSTD
+        case Codec::Zstd:
+            return zstd(input, compression.level, output);
+#endif
+        default:
+            return false;
+    };
+}
+
+// Threads shared by every CompressingOutputBuffer in the process, so buffers
+// open at once, one per serve worker say, do not each start a thread per
+// core. Started on first use and stopped at exit.
+class CompressionPool
+{
+public:
+    static CompressionPool& instance()
+    {
+        static CompressionPool pool;
+        return pool;
+    }
+
+    unsigned int size() const
+    {
+        return static_cast<unsigned int>(mThreads.size());
+    }
+
+    void run(std::function<void()> task)
+    {
+        {
+            std::lock_guard<std::mutex> lock(mMutex);
+            mTasks.push_back(std::move(task));
+        }
+        mReady.notify_one();
+    }
+
+private:
+    CompressionPool()
+        : mStopping(false)
+    {
+        const unsigned int thread_count = std::max(1u, std::thread::hardware_concurrency());
+        for (unsigned int i = 0; i < thread_count; ++i)
+        {
+            mThreads.emplace_back(&CompressionPool::work, this);
+        }
+    }
+
+    ~CompressionPool()
+    {
+        {
+            std::lock_guard<std::mutex> lock(mMutex);
+            mStopping = true;
+        }
+        mReady.notify_all();
+        for (std::thread& thread : mThreads)
+        {
+            thread.join();
+        }
+    }
+
+    void work()
+    {
+        bool named = false;
+        for (;;)
+        {
+            std::function<void()> task;
+            {
+                std::unique_lock<std::mutex> lock(mMutex);
+                mReady.wait(lock, [this]() { return mStopping || !mTasks.empty(); });
+                if (mTasks.empty())
+                {
+                    return;
+                }
+                task = std::move(mTasks.front());
+                mTasks.pop_front();
+            }
+
+            if (!named && trace_enabled())
+            {
+                trace_thread_name("compress");
+                named = true;
+            }
+            task();
+        }
+    }
+
+    std::mutex mMutex;
+    std::condition_variable mReady;
+    std::deque<std::function<void()>> mTasks;
+    bool mStopping;
+    std::vector<std::thread> mThreads;
+};
+
+}
+
+bool parse_compression(const std::string& value, Compression& compression, std::string& error)
+{
+    const std::string::size_type colon = value.find(':');
+    const std::string name = value.substr(0, colon);
+
+    if (name == "gzip")
+    {
+#ifdef ATJ_WITH_ZLIB
+        compression.codec = Codec::Gzip;
+#else
+        error = "atj was built without zlib";
+        return false;
+#endif
+    }
+    else if (name == "zstd")
+    {
+#ifdef ATJ_WITH_ZSTD
+        compression.codec = Codec::Zstd;
+#else
+        error = "atj was built without zstd";
+        return false;
+#endif
+    }
+    else
+    {
+        error = "Unknown compression: " + name;
+        return false;
+    }
+
+    compression.level = -1;
+    if (colon != std::string::npos)
+    {
+        const std::string level = value.substr(colon + 1);
+        const int lowest = compression.codec == Codec::Gzip ? 0 : 1;
+        const int highest = compression.codec == Codec::Gzip ? 9 : 22;
+
+        char* end = nullptr;
+        const long parsed = std::strtol(level.c_str(), &end, 10);
+        if (level.empty() || *end != '\0' || parsed < lowest || parsed > highest)
+        {
+            error = "Bad " + name + " level: " + level + " (" + std::to_string(lowest) + " to "
+                    + std::to_string(highest) + ")";
+            return false;
+        }
+        compression.level = static_cast<int>(parsed);
+    }
+
+    return true;
+}
+
+CompressingOutputBuffer::CompressingOutputBuffer(std::streambuf* pSink, const Compression& compression,
+        std::size_t chunk_size)
+    : mSink(pSink),
+      mCompression(compression),
+      mChunkSize(chunk_size),
+      mMaxInFlight(0),
+      mFailed(false),
+      mFinished(false),
+      mState(std::make_shared<State>())
+{
+    mMaxInFlight = CompressionPool::instance().size() * 2;
+
+    mCurrent.resize(mChunkSize);
+    setp(mCurrent.data(), mCurrent.data() + mCurrent.size());
+}
+
+CompressingOutputBuffer::~CompressingOutputBuffer()
+{
+    finish();
+}
+
+bool CompressingOutputBuffer::finish()
+{
+    if (mFinished)
+    {
+        return !mFailed;
+    }
+    mFinished = true;
+
+    submit();
+    setp(nullptr, nullptr);
+
+    while (!mPending.empty())
+    {
+        write_oldest();
+    }
+
+    return !mFailed;
+}
+
+CompressingOutputBuffer::int_type CompressingOutputBuffer::overflow(int_type ch)
+{
+    if (mFinished || mFailed)
+    {
+        return traits_type::eof();
+    }
+
+    submit();
+
+    if (!traits_type::eq_int_type(ch, traits_type::eof()))
+    {
+        *pptr() = traits_type::to_char_type(ch);
+        pbump(1);
+    }
+
+    return traits_type::not_eof(ch);
+}
+
+void CompressingOutputBuffer::submit()
+{
+    std::size_t size = static_cast<std::size_t>(pptr() - pbase());
+    if (size == 0)
+    {
+        return;
+    }
+
+    while (mPending.size() >= mMaxInFlight)
+    {
+        write_oldest();
+    }
+
+    auto chunk = std::make_shared<Chunk>();
+    mCurrent.resize(size);
+    chunk->input.swap(mCurrent);
+    mCurrent.resize(mChunkSize);
+    setp(mCurrent.data(), mCurrent.data() + mCurrent.size());
+
+    mPending.push_back(chunk);
+    CompressionPool::instance().run(std::bind(&CompressingOutputBuffer::compress_chunk, mState, mCompression, chunk));
+
+    // Write whatever has already finished, without waiting.
+    for (;;)
+    {
+        {
+            std::lock_guard<std::mutex> lock(mState->mutex);
+            if (mPending.empty() || !mPending.front()->done)
+            {
+                break;
+            }
+        }
+        write_oldest();
+    }
+}
+
+void CompressingOutputBuffer::write_oldest()
+{
+    std::shared_ptr<Chunk> chunk = mPending.front();
+    mPending.pop_front();
+    {
+        std::unique_lock<std::mutex> lock(mState->mutex);
+        mState->chunk_done.wait(lock, [&chunk]() { return chunk->done; });
+    }
+
+    if (chunk->failed)
+    {
+        mFailed = true;
+        return;
+    }
+
+    std::streamsize size = static_cast<std::streamsize>(chunk->output.size());
+    if (!mFailed && mSink->sputn(chunk->output.data(), size) != size)
+    {
+        mFailed = true;
+    }
+}
+
+void CompressingOutputBuffer::compress_chunk(const std::shared_ptr<State>& state, const Compression& compression,
+        const std::shared_ptr<Chunk>& chunk)
+{
+    std::vector<char> output;
+    bool ok = false;
+    {
+        TraceSpan span("CompressChunk");
+        ok = compress(compression, chunk->input, output);
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(state->mutex);
+        chunk->output.swap(output);
+        chunk->failed = !ok;
+        chunk->done = true;
+        std::vector<char>().swap(chunk->input);
+    }
+    state->chunk_done.notify_all();
+}
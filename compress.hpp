@@ -0,0 +1,90 @@
+#pragma once
+
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <streambuf>
+#include <string>
+#include <vector>
+
+enum class Codec
+{
+    None,
+    Gzip,
+    Zstd
+};
+
+struct Compression
+{
+    Codec codec = Codec::None;
+    int level = -1;
+};
+
+// Parses "gzip", "zstd", "gzip:9" or "zstd:19". Fails with error set for
+// unknown codecs, codecs this build was made without and levels out of range
+// (0 to 9 for gzip, 1 to 22 for zstd).
+bool parse_compression(const std::string& value, Compression& compression, std::string& error);
+
+// Stream buffer that cuts the stream into fixed-size chunks and compresses
+// each one as an independent gzip member or zstd frame on a pool of worker
+// threads, shared by every buffer in the process, while the caller keeps
+// writing. Finished frames go to the sink in order, so the output is one
+// standard gzip or zstd file. At most two chunks per pool thread are in
+// flight at once for each buffer.
+class CompressingOutputBuffer : public std::streambuf
+{
+public:
+    static const std::size_t kDefaultChunkSize = 4 << 20;
+
+    CompressingOutputBuffer(std::streambuf* pSink, const Compression& compression,
+            std::size_t chunk_size = kDefaultChunkSize);
+    ~CompressingOutputBuffer() override;
+
+    CompressingOutputBuffer(const CompressingOutputBuffer&) = delete;
+    CompressingOutputBuffer& operator=(const CompressingOutputBuffer&) = delete;
+
+    // Compresses what is left and writes every frame. False if compressing
+    // or writing to the sink failed.
+    bool finish();
+
+protected:
+    int_type overflow(int_type ch) override;
+
+private:
+    struct Chunk
+    {
+        std::vector<char> input;
+        std::vector<char> output;
+        bool done = false;
+        bool failed = false;
+    };
+
+    // Where pool threads mark chunks done. Shared with the tasks, so a task
+    // finishing as the buffer is destroyed still has it.
+    struct State
+    {
+        std::mutex mutex;
+        std::condition_variable chunk_done;
+    };
+
+    void submit();
+    void write_oldest();
+    static void compress_chunk(const std::shared_ptr<State>& state, const Compression& compression,
+            const std::shared_ptr<Chunk>& chunk);
+
+    std::streambuf* mSink;
+    Compression mCompression;
+    std::size_t mChunkSize;
+    std::size_t mMaxInFlight;
+    bool mFailed;
+    bool mFinished;
+
+    // The chunk being filled; it is the put area.
+    std::vector<char> mCurrent;
+
+    // Chunks in stream order, not yet written to the sink.
+    std::deque<std::shared_ptr<Chunk>> mPending;
+    std::shared_ptr<State> mState;
+};
@@ -0,0 +1,747 @@
+#include "converter.hpp"
+
+#include <assimp/DefaultIOSystem.h>
+#include <assimp/Exporter.hpp>
+#include <assimp/Importer.hpp>
+#include <assimp/config.h>
+#include <assimp/postprocess.h>
+#include <assimp/version.h>
+
+#include "cache.hpp"
+#include "mmap_io.hpp"
+#include "trace.hpp"
+
+#include <libgen.h>
+#include <stdlib.h>
+
+#include <algorithm>
+#include <chrono>
+#include <climits>
+#include <cstdio>
+#include <cstdint>
+#include <iomanip>
+#include <memory>
+#include <sstream>
+
+namespace
+{
+
+// Passes everything through to another IO system, noting the path of every
+// file successfully opened for reading and its stamp from just before, and
+// of every file looked for or opened that did not exist.
+class RecordingIOSystem : public Assimp::IOSystem
+{
+public:
+    RecordingIOSystem(Assimp::IOSystem* pInner, std::vector<std::string>& files, std::vector<std::string>& absent,
+            std::vector<FileStamp>& stamps)
+        : mInner(pInner), mFiles(files), mAbsent(absent), mStamps(stamps)
+    {
+    }
+
+    bool Exists(const char* pFile) const override
+    {
+        const bool exists = mInner->Exists(pFile);
+        if (!exists)
+        {
+            record_absent(pFile);
+        }
+        return exists;
+    }
+
+    char getOsSeparator() const override
+    {
+        return mInner->getOsSeparator();
+    }
+
+    Assimp::IOStream* Open(const char* pFile, const char* pMode = "rb") override
+    {
+        // Taken first, so a change made while the file is read shows.
+        FileStamp stamp;
+        const bool stamped = stamp_file(pFile, stamp);
+
+        Assimp::IOStream* pStream = mInner->Open(pFile, pMode);
+        if (pStream && pMode[0] == 'r' && std::find(mFiles.begin(), mFiles.end(), pFile) == mFiles.end())
+        {
+            mFiles.push_back(pFile);
+            if (stamped)
+            {
+                mStamps.push_back(stamp);
+            }
+        }
+        else if (!pStream && pMode[0] == 'r')
+        {
+            record_absent(pFile);
+        }
+        return pStream;
+    }
+
+    void Close(Assimp::IOStream* pFile) override
+    {
+        mInner->Close(pFile);
+    }
+
+    bool ComparePaths(const char* one, const char* second) const override
+    {
+        return mInner->ComparePaths(one, second);
+    }
+
+private:
+    void record_absent(const char* pFile) const
+    {
+        FileStamp stamp;
+        if (std::find(mAbsent.begin(), mAbsent.end(), pFile) == mAbsent.end() && !stamp_file(pFile, stamp))
+        {
+            mAbsent.push_back(pFile);
+            stamp.path = pFile;
+            stamp.exists = false;
+            mStamps.push_back(stamp);
+        }
+    }
+
+    std::unique_ptr<Assimp::IOSystem> mInner;
+    std::vector<std::string>& mFiles;
+    std::vector<std::string>& mAbsent;
+    std::vector<FileStamp>& mStamps;
+};
+
+// Gives the importer the IO system the options ask for, noting the files
+// read in result when record is set.
+void set_io_system(Assimp::Importer& importer, const ConvertOptions& options, ConvertResult& result, bool record)
+{
+    Assimp::IOSystem* pIOSystem = nullptr;
+    if (options.mmap_input)
+    {
+        pIOSystem = new MappedIOSystem();
+    }
+
+    if (record && (options.record_inputs || !options.scene_cache.empty()))
+    {
+        pIOSystem = new RecordingIOSystem(pIOSystem ? pIOSystem : new Assimp::DefaultIOSystem(), result.input_files,
+                result.absent_files, result.input_stamps);
+    }
+
+    // The importer takes ownership of its IO handler and deletes the one it
+    // had; null restores the default.
+    importer.SetIOHandler(pIOSystem);
+}
+
+bool configure(Assimp::Importer& importer, const ConvertOptions& options,
+        unsigned int& flags, ConvertResult& result)
+{
+    for (const std::string& property : options.properties)
+    {
+        if (!set_importer_property(importer, property))
+        {
+            result.error = "Bad property: " + property;
+            return false;
+        }
+    }
+
+    flags = options.flags;
+    if (options.split_vertex_limit > 0)
+    {
+        // Assimp's splitter hands out faces in their original order, so each
+        // piece stays a contiguous run of the source mesh, and it rewrites
+        // the node mesh references to point at every piece.
+        importer.SetPropertyInteger(AI_CONFIG_PP_SLM_VERTEX_LIMIT, options.split_vertex_limit);
+        flags |= aiProcess_SplitLargeMeshes;
+    }
+
+    return true;
+}
+
+double seconds_since(std::chrono::steady_clock::time_point start)
+{
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+// Canonical text of the options that shape the imported scene.
+std::string describe_import(const ConvertOptions& options)
+{
+    std::ostringstream text;
+    text << "atj=" << ATJ_VERSION
+         << ";assimp=" << aiGetVersionMajor() << "." << aiGetVersionMinor() << "." << aiGetVersionRevision()
+         << ";flags=" << std::hex << options.flags << std::dec
+         << ";properties=";
+    for (const std::string& property : options.properties)
+    {
+        text << property << "|";
+    }
+    text << ";split=" << options.split_vertex_limit;
+    return text.str();
+}
+
+// The model being converted: a file at path, or size bytes at pData named
+// by hint.
+struct SceneSource
+{
+    std::string path;
+    const void* pData;
+    std::size_t size;
+    std::string hint;
+};
+
+// Key of the source's post-processed scene in the scene cache, or empty if
+// the input cannot be hashed.
+std::string scene_key(const ConvertOptions& options, const SceneSource& source)
+{
+    std::uint64_t hash = 0;
+    std::uint64_t size = source.size;
+    std::string error;
+    if (source.path.empty())
+    {
+        hash = hash_bytes(source.pData, source.size);
+    }
+    else if (!hash_file(source.path, hash, size, error))
+    {
+        return std::string();
+    }
+
+    // Referenced files resolve against the model's directory.
+    char base[PATH_MAX];
+    if (!::realpath(source.path.empty() ? "." : source.path.c_str(), base))
+    {
+        return std::string();
+    }
+
+    return ConversionCache::make_key(hash, size, describe_import(options)
+            + ";hint=" + source.hint + ";base=" + (source.path.empty() ? base : ::dirname(base)));
+}
+
+// Loads the scene stored under key, adding the files it was imported from to
+// result.input_files and the ones found missing to result.absent_files. The cache's own file is not one of them, so it is read
+// without recording.
+const aiScene* read_cached_scene(Assimp::Importer& importer, ConversionCache& cache,
+        const std::string& key, const ConvertOptions& options, ConvertResult& result)
+{
+    TraceSpan span("ReadSceneCache");
+    auto start = std::chrono::steady_clock::now();
+
+    std::vector<std::string> dependencies;
+    std::vector<std::string> absent;
+    if (!cache.lookup(key, &dependencies, &absent))
+    {
+        return nullptr;
+    }
+
+    // Post-processing already ran before the scene was stored.
+    set_io_system(importer, options, result, false);
+    const aiScene* pScene = importer.ReadFile(cache.artifact_path(key, "scene.assbin"), 0);
+    if (pScene)
+    {
+        result.phases.import += seconds_since(start);
+        result.input_files.insert(result.input_files.end(), dependencies.begin(), dependencies.end());
+        for (const std::string& dependency : dependencies)
+        {
+            FileStamp stamp;
+            if (stamp_file(dependency, stamp))
+            {
+                result.input_stamps.push_back(stamp);
+            }
+        }
+        for (const std::string& path : absent)
+        {
+            FileStamp stamp;
+            stamp.path = path;
+            stamp.exists = false;
+            result.absent_files.push_back(path);
+            result.input_stamps.push_back(stamp);
+        }
+        if (options.timings)
+        {
+            result.timings.push_back(StepTiming { "ReadSceneCache", seconds_since(start) });
+        }
+    }
+    return pScene;
+}
+
+void write_cached_scene(const aiScene* pScene, ConversionCache& cache, const std::string& key,
+        const SceneSource& source, const ConvertOptions& options, ConvertResult& result)
+{
+    TraceSpan span("WriteSceneCache");
+    auto start = std::chrono::steady_clock::now();
+
+    const std::string path = cache.temp_path();
+    Assimp::Exporter exporter;
+    if (exporter.Export(pScene, "assbin", path) != aiReturn_SUCCESS)
+    {
+        std::remove(path.c_str());
+        return;
+    }
+
+    std::vector<std::string> dependencies;
+    for (const std::string& input : result.input_files)
+    {
+        if (input != source.path)
+        {
+            dependencies.push_back(input);
+        }
+    }
+
+    std::string error;
+    if (!cache.store(key, CacheArtifacts { { "scene.assbin", path } }, dependencies, result.absent_files, error))
+    {
+        std::remove(path.c_str());
+        return;
+    }
+
+    if (options.timings)
+    {
+        result.timings.push_back(StepTiming { "WriteSceneCache", seconds_since(start) });
+    }
+}
+
+// Imports with read(importer, flags), or from the scene cache, runs the
+// scene passes and hands the scene to handle(pScene).
+template <typename Read, typename Handle>
+bool convert(Assimp::Importer& importer, const ConvertOptions& options, ConvertResult& result,
+        const SceneSource& source, Read read, Handle handle)
+{
+    unsigned int flags = 0;
+    if (!configure(importer, options, flags, result))
+    {
+        return false;
+    }
+
+    std::unique_ptr<ConversionCache> pCache;
+    std::string key;
+    if (!options.scene_cache.empty())
+    {
+        std::string error;
+        pCache.reset(new ConversionCache(options.scene_cache, options.scene_cache_bytes));
+        key = scene_key(options, source);
+        if (!pCache->open(error) || key.empty())
+        {
+            pCache.reset();
+        }
+    }
+
+    const aiScene* pScene = pCache ? read_cached_scene(importer, *pCache, key, options, result) : nullptr;
+    if (!pScene)
+    {
+        set_io_system(importer, options, result, true);
+        pScene = read(importer, flags);
+        if (!pScene)
+        {
+            result.error = importer.GetErrorString();
+            return false;
+        }
+
+        if (pCache)
+        {
+            write_cached_scene(pScene, *pCache, key, source, options, result);
+        }
+    }
+
+    if (options.reduce_keys)
+    {
+        // The importer still owns the scene; like Assimp's own post-process
+        // steps, this pass edits it in place.
+        TraceSpan span("ReduceKeys");
+        result.key_stats = reduce_keyframes(const_cast<aiScene*>(pScene), options.key_tolerance);
+        result.reduced_keys = true;
+    }
+
+    handle(pScene);
+
+    // A reused importer should not hold on to the last scene.
+    importer.FreeScene();
+    return true;
+}
+
+void build_document(const aiScene* pScene, const ConvertOptions& options, ConvertResult& result)
+{
+    TraceSpan span("Serialize");
+    auto start = std::chrono::steady_clock::now();
+    to_json(result.document, pScene, options.export_options);
+    result.phases.serialize += seconds_since(start);
+    if (options.timings)
+    {
+        result.timings.push_back(StepTiming { "Serialize", seconds_since(start) });
+    }
+}
+
+void write_scene(const aiScene* pScene, const ConvertOptions& options,
+        OutputFormat format, std::ostream& output, ConvertResult& result)
+{
+    if (format == OutputFormat::Ndjson)
+    {
+        TraceSpan span("Serialize");
+        auto start = std::chrono::steady_clock::now();
+        std::vector<RecordOffset>* pRecords = options.index_records ? &result.records : nullptr;
+        if (options.delta)
+        {
+            RecordDelta delta(options.previous_hashes);
+            write_records(output, pScene, options.export_options, pRecords,
+                [&](const std::string& type, unsigned int index, const std::string& line) {
+                    return delta.check(type, index, line);
+                });
+            for (const std::string& line : delta.removed())
+            {
+                output << line << '\n';
+            }
+            result.record_hashes = delta.hashes();
+        }
+        else
+        {
+            write_records(output, pScene, options.export_options, pRecords);
+        }
+        result.phases.serialize += seconds_since(start);
+        if (options.timings)
+        {
+            result.timings.push_back(StepTiming { "Serialize", seconds_since(start) });
+        }
+        return;
+    }
+
+    build_document(pScene, options, result);
+
+    TraceSpan span("Dump");
+    auto start = std::chrono::steady_clock::now();
+    if (options.delta)
+    {
+        result.record_hashes = hash_document(result.document);
+        result.record_hashes.format = "document";
+        write_document(output, make_patch(result.document, result.record_hashes, options.previous_hashes), format);
+    }
+    else if (options.index_records && format == OutputFormat::Json)
+    {
+        write_indexed_document(output, result.document, result.records);
+    }
+    else
+    {
+        write_document(output, result.document, format);
+    }
+    result.phases.write += seconds_since(start);
+    if (options.timings)
+    {
+        result.timings.push_back(StepTiming { "Dump", seconds_since(start) });
+    }
+}
+
+// Pretty prints like nlohmann::json's dump(4), counting every byte written.
+class IndexedWriter
+{
+public:
+    IndexedWriter(std::ostream& output, std::vector<RecordOffset>& records)
+        : mOutput(output), mRecords(records), mOffset(0), mNextNode(0)
+    {
+    }
+
+    void write_document(const nlohmann::json& document)
+    {
+        static const std::pair<const char*, const char*> kRecordArrays[] = {
+            { "animations", "animation" },
+            { "cameras", "camera" },
+            { "lights", "light" },
+            { "materials", "material" },
+            { "meshes", "mesh" },
+            { "textures", "texture" }
+        };
+
+        write_object(document, 0, [&](const std::string& key, const nlohmann::json& value, unsigned int indent) {
+            if (key == "root" && value.is_object())
+            {
+                write_node(value, indent);
+                return;
+            }
+
+            if (key == "skinning")
+            {
+                write_record("skinning", 0, value, indent);
+                return;
+            }
+
+            for (const auto& array : kRecordArrays)
+            {
+                if (key == array.first && value.is_array())
+                {
+                    write_array(value, indent, [&](std::size_t i, const nlohmann::json& element, unsigned int inner) {
+                        write_record(array.second, static_cast<unsigned int>(i), element, inner);
+                    });
+                    return;
+                }
+            }
+
+            write_value(value, indent);
+        });
+        put("\n");
+    }
+
+private:
+    void put(const std::string& text)
+    {
+        mOutput.write(text.data(), text.size());
+        mOffset += text.size();
+    }
+
+    // A value nested indent spaces deep. JSON strings cannot hold raw
+    // newlines, so indenting after every newline of dump(4) is exact.
+    void write_value(const nlohmann::json& value, unsigned int indent)
+    {
+        const std::string text = value.dump(4);
+        if (indent == 0)
+        {
+            put(text);
+            return;
+        }
+
+        const std::string newline = "\n" + std::string(indent, ' ');
+        std::string indented;
+        indented.reserve(text.size() + text.size() / 8);
+        std::size_t from = 0;
+        for (std::size_t at = text.find('\n'); at != std::string::npos; at = text.find('\n', from))
+        {
+            indented.append(text, from, at - from);
+            indented += newline;
+            from = at + 1;
+        }
+        indented.append(text, from, std::string::npos);
+        put(indented);
+    }
+
+    void write_record(const char* type, unsigned int index, const nlohmann::json& value, unsigned int indent)
+    {
+        const std::uint64_t start = mOffset;
+        write_value(value, indent);
+        mRecords.push_back(RecordOffset { type, index, start, mOffset - start });
+    }
+
+    void write_node(const nlohmann::json& node, unsigned int indent)
+    {
+        const unsigned int index = mNextNode++;
+        const std::size_t slot = mRecords.size();
+        mRecords.push_back(RecordOffset { "node", index, mOffset, 0 });
+
+        write_object(node, indent, [&](const std::string& key, const nlohmann::json& value, unsigned int inner) {
+            if (key == "children" && value.is_array())
+            {
+                write_array(value, inner, [&](std::size_t, const nlohmann::json& child, unsigned int innermost) {
+                    write_node(child, innermost);
+                });
+                return;
+            }
+            write_value(value, inner);
+        });
+
+        mRecords[slot].length = mOffset - mRecords[slot].offset;
+    }
+
+    template <typename Member>
+    void write_object(const nlohmann::json& object, unsigned int indent, Member member)
+    {
+        if (!object.is_object() || object.empty())
+        {
+            write_value(object, indent);
+            return;
+        }
+
+        const std::string inner(indent + 4, ' ');
+        put("{\n");
+        for (auto it = object.begin(); it != object.end(); ++it)
+        {
+            if (it != object.begin())
+            {
+                put(",\n");
+            }
+            put(inner + nlohmann::json(it.key()).dump() + ": ");
+            member(it.key(), it.value(), indent + 4);
+        }
+        put("\n" + std::string(indent, ' ') + "}");
+    }
+
+    template <typename Element>
+    void write_array(const nlohmann::json& array, unsigned int indent, Element element)
+    {
+        if (array.empty())
+        {
+            put("[]");
+            return;
+        }
+
+        const std::string inner(indent + 4, ' ');
+        put("[\n");
+        for (std::size_t i = 0; i < array.size(); ++i)
+        {
+            if (i > 0)
+            {
+                put(",\n");
+            }
+            put(inner);
+            element(i, array[i], indent + 4);
+        }
+        put("\n" + std::string(indent, ' ') + "]");
+    }
+
+    std::ostream& mOutput;
+    std::vector<RecordOffset>& mRecords;
+    std::uint64_t mOffset;
+    unsigned int mNextNode;
+};
+
+}
+
+std::string describe_options(const ConvertOptions& options)
+{
+    const ExportOptions& export_options = options.export_options;
+
+    // Hex floats keep every bit of the tolerances and rates.
+    auto exact = [](double value) {
+        char text[32];
+        std::snprintf(text, sizeof(text), "%a", value);
+        return std::string(text);
+    };
+
+    std::ostringstream text;
+    text << describe_import(options);
+    if (options.reduce_keys)
+    {
+        text << ";reduce=" << exact(options.key_tolerance.translation)
+             << "," << exact(options.key_tolerance.rotation)
+             << "," << exact(options.key_tolerance.scale);
+    }
+    text << ";sample_rate=" << exact(export_options.sample_rate)
+         << ";rotation_bits=" << export_options.encoding.rotation_bits
+         << ";times=" << static_cast<int>(export_options.encoding.times)
+         << "," << exact(export_options.encoding.frame_rate)
+         << ";skinning=" << exact(export_options.skinning_rate) << (export_options.skinning_half ? ",half" : "")
+         << ";morph_epsilon=" << exact(export_options.morph_epsilon)
+         << ";index=" << options.index_records;
+
+    return text.str();
+}
+
+bool convert_file(const std::string& filename, const ConvertOptions& options, ConvertResult& result)
+{
+    Assimp::Importer importer;
+    return convert(importer, options, result, SceneSource { filename, nullptr, 0, std::string() },
+        [&](Assimp::Importer& importer, unsigned int flags) {
+            return import_scene(importer, filename, flags, options.timings ? &result.timings : nullptr,
+                    result.phases);
+        },
+        [&](const aiScene* pScene) {
+            build_document(pScene, options, result);
+        });
+}
+
+bool convert_memory(const void* pData, std::size_t size, const std::string& hint,
+        const ConvertOptions& options, ConvertResult& result)
+{
+    Assimp::Importer importer;
+    return convert(importer, options, result, SceneSource { std::string(), pData, size, hint },
+        [&](Assimp::Importer& importer, unsigned int flags) {
+            return import_scene_from_memory(importer, pData, size, hint, flags,
+                    options.timings ? &result.timings : nullptr, result.phases);
+        },
+        [&](const aiScene* pScene) {
+            build_document(pScene, options, result);
+        });
+}
+
+bool convert_file(const std::string& filename, const ConvertOptions& options,
+        OutputFormat format, std::ostream& output, ConvertResult& result)
+{
+    return Converter().convert_file(filename, options, format, output, result);
+}
+
+bool convert_memory(const void* pData, std::size_t size, const std::string& hint,
+        const ConvertOptions& options, OutputFormat format, std::ostream& output, ConvertResult& result)
+{
+    return Converter().convert_memory(pData, size, hint, options, format, output, result);
+}
+
+Converter::Converter()
+    : mImporter(new Assimp::Importer()), mSplitVertexLimit(0)
+{
+}
+
+Converter::~Converter()
+{
+}
+
+bool Converter::convert_file(const std::string& filename, const ConvertOptions& options,
+        OutputFormat format, std::ostream& output, ConvertResult& result)
+{
+    return convert(importer_for(options), options, result, SceneSource { filename, nullptr, 0, std::string() },
+        [&](Assimp::Importer& importer, unsigned int flags) {
+            return import_scene(importer, filename, flags, options.timings ? &result.timings : nullptr,
+                    result.phases);
+        },
+        [&](const aiScene* pScene) {
+            write_scene(pScene, options, format, output, result);
+        });
+}
+
+bool Converter::convert_memory(const void* pData, std::size_t size, const std::string& hint,
+        const ConvertOptions& options, OutputFormat format, std::ostream& output, ConvertResult& result)
+{
+    return convert(importer_for(options), options, result, SceneSource { std::string(), pData, size, hint },
+        [&](Assimp::Importer& importer, unsigned int flags) {
+            return import_scene_from_memory(importer, pData, size, hint, flags,
+                    options.timings ? &result.timings : nullptr, result.phases);
+        },
+        [&](const aiScene* pScene) {
+            write_scene(pScene, options, format, output, result);
+        });
+}
+
+Assimp::Importer& Converter::importer_for(const ConvertOptions& options)
+{
+    if (options.properties != mProperties || options.split_vertex_limit != mSplitVertexLimit)
+    {
+        mImporter.reset(new Assimp::Importer());
+        mProperties = options.properties;
+        mSplitVertexLimit = options.split_vertex_limit;
+    }
+    return *mImporter;
+}
+
+bool Converter::supports(const std::string& extension) const
+{
+    return mImporter->IsExtensionSupported(extension.c_str());
+}
+
+void write_document(std::ostream& output, const nlohmann::json& document, OutputFormat format)
+{
+    if (format == OutputFormat::Json)
+    {
+        output << std::setw(4) << document << std::endl;
+        return;
+    }
+
+    if (format == OutputFormat::Ndjson)
+    {
+        output << document.dump() << '\n';
+        return;
+    }
+
+    std::vector<std::uint8_t> bytes = format == OutputFormat::Cbor
+        ? nlohmann::json::to_cbor(document)
+        : nlohmann::json::to_msgpack(document);
+    output.write(reinterpret_cast<const char*>(bytes.data()), bytes.size());
+}
+
+void write_indexed_document(std::ostream& output, const nlohmann::json& document,
+        std::vector<RecordOffset>& records)
+{
+    IndexedWriter(output, records).write_document(document);
+}
+
+nlohmann::json record_index(const std::vector<RecordOffset>& records, OutputFormat format)
+{
+    nlohmann::json entries = nlohmann::json::array();
+    for (const RecordOffset& record : records)
+    {
+        entries.push_back({
+            {"type", record.type},
+            {"index", record.index},
+            {"offset", record.offset},
+            {"length", record.length}
+        });
+    }
+
+    return nlohmann::json {
+        {"format", format == OutputFormat::Ndjson ? "ndjson" : "json"},
+        {"records", entries}
+    };
+}
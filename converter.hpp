@@ -0,0 +1,161 @@
+#pragma once
+
+#include <json/json.hpp>
+
+#include "animation.hpp"
+#include "cache.hpp"
+#include "delta.hpp"
+#include "pipeline.hpp"
+#include "serialize.hpp"
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <ostream>
+#include <string>
+#include <vector>
+
+namespace Assimp
+{
+class Importer;
+}
+
+enum class OutputFormat
+{
+    Json,
+    Cbor,
+    MessagePack,
+    Ndjson
+};
+
+// Everything that decides how a model is imported and serialized.
+struct ConvertOptions
+{
+    unsigned int flags = default_post_process_flags();
+
+    // AI_CONFIG_* importer properties as "NAME=value".
+    std::vector<std::string> properties;
+
+    // Largest vertex count per output mesh; zero leaves meshes whole.
+    int split_vertex_limit = 0;
+
+    bool mmap_input = true;
+
+    // Apply post-processing step by step and time each one.
+    bool timings = false;
+
+    bool reduce_keys = false;
+    KeyframeTolerance key_tolerance;
+
+    ExportOptions export_options;
+
+    // Record the byte range of every mesh, material, texture, light, camera,
+    // animation and node in streamed JSON or NDJSON output.
+    bool index_records = false;
+
+    // Write only what changed since the output previous_hashes describe: an
+    // RFC 6902 patch for documents, changed and removed records for NDJSON.
+    bool delta = false;
+    RecordHashes previous_hashes;
+
+    // List every file the importer reads in result.input_files.
+    bool record_inputs = false;
+
+    // Directory keeping post-processed scenes in Assimp's binary (assbin)
+    // format, keyed by input hash and import options, and the size it is
+    // trimmed to. Empty to always import from the source.
+    std::string scene_cache;
+    std::uint64_t scene_cache_bytes = std::uint64_t(4096) << 20;
+};
+
+struct ConvertResult
+{
+    nlohmann::json document;
+    std::vector<StepTiming> timings;
+    PhaseTimes phases;
+
+    bool reduced_keys = false;
+    KeyframeStats key_stats;
+
+    // Filled by the streaming overloads when options.index_records is set.
+    std::vector<RecordOffset> records;
+
+    // Hashes of the records just written, filled when options.delta is set.
+    RecordHashes record_hashes;
+
+    // Filled when options.record_inputs is set, in the order first opened,
+    // with the stamp of each file taken before it was read. absent_files
+    // lists the files the importer looked for and did not find, which also
+    // have absent stamps in input_stamps.
+    std::vector<std::string> input_files;
+    std::vector<std::string> absent_files;
+    std::vector<FileStamp> input_stamps;
+
+    std::string error;
+};
+
+// Canonical text of every option that changes the output, together with the
+// atj and Assimp versions, for keying cached conversions.
+std::string describe_options(const ConvertOptions& options);
+
+// Imports the model at filename and serializes it into result.document.
+// Returns false with result.error set when the import fails.
+bool convert_file(const std::string& filename, const ConvertOptions& options, ConvertResult& result);
+
+// As convert_file, for a model already in memory. hint is the file extension
+// (such as "obj" or "glb") Assimp uses to pick the importer.
+bool convert_memory(const void* pData, std::size_t size, const std::string& hint,
+        const ConvertOptions& options, ConvertResult& result);
+
+// As convert_file and convert_memory, but write the result to output in the
+// given format instead of keeping it in result.document. NDJSON records go
+// out one by one as they are serialized, without building the document.
+bool convert_file(const std::string& filename, const ConvertOptions& options,
+        OutputFormat format, std::ostream& output, ConvertResult& result);
+bool convert_memory(const void* pData, std::size_t size, const std::string& hint,
+        const ConvertOptions& options, OutputFormat format, std::ostream& output, ConvertResult& result);
+
+// Keeps one Assimp importer alive across conversions, so a long-running
+// process does not set up the importers and post-processing steps again for
+// every model. Assimp cannot unset a property, so the importer is rebuilt
+// whenever a conversion asks for different properties than the last one.
+// Not thread safe; use one per thread.
+class Converter
+{
+public:
+    Converter();
+    ~Converter();
+
+    Converter(const Converter&) = delete;
+    Converter& operator=(const Converter&) = delete;
+
+    bool convert_file(const std::string& filename, const ConvertOptions& options,
+            OutputFormat format, std::ostream& output, ConvertResult& result);
+    bool convert_memory(const void* pData, std::size_t size, const std::string& hint,
+            const ConvertOptions& options, OutputFormat format, std::ostream& output, ConvertResult& result);
+
+    // Whether some importer reads files with this extension, such as ".obj".
+    bool supports(const std::string& extension) const;
+
+private:
+    // The importer, fresh if options set other properties than it has.
+    Assimp::Importer& importer_for(const ConvertOptions& options);
+
+    std::unique_ptr<Assimp::Importer> mImporter;
+    std::vector<std::string> mProperties;
+    int mSplitVertexLimit;
+};
+
+// Writes a document built by convert_file or convert_memory. NDJSON is only
+// produced by the streaming overloads; here it falls back to compact JSON.
+void write_document(std::ostream& output, const nlohmann::json& document, OutputFormat format);
+
+// Writes a document exactly as write_document does for JSON, appending the
+// byte range of every record in it to records. Nodes are numbered parents
+// first, as in NDJSON output.
+void write_indexed_document(std::ostream& output, const nlohmann::json& document,
+        std::vector<RecordOffset>& records);
+
+// The sidecar index for seeking into a document:
+// {"format": ..., "records": [{"type", "index", "offset", "length"}, ...]}.
+nlohmann::json record_index(const std::vector<RecordOffset>& records, OutputFormat format);
@@ -0,0 +1,216 @@
+#include "delta.hpp"
+
+#include "cache.hpp"
+
+#include <algorithm>
+#include <fstream>
+
+namespace
+{
+
+const char* const kRecordArrays[] = { "animations", "cameras", "lights", "materials", "meshes", "textures" };
+
+bool is_record_array(const std::string& key)
+{
+    return std::find(std::begin(kRecordArrays), std::end(kRecordArrays), key) != std::end(kRecordArrays);
+}
+
+std::uint64_t hash_value(const nlohmann::json& value)
+{
+    const std::string text = value.dump();
+    return hash_bytes(text.data(), text.size());
+}
+
+// JSON Pointer reference token for a key (RFC 6901).
+std::string escape_token(const std::string& key)
+{
+    std::string token;
+    for (char c : key)
+    {
+        if (c == '~')
+        {
+            token += "~0";
+        }
+        else if (c == '/')
+        {
+            token += "~1";
+        }
+        else
+        {
+            token += c;
+        }
+    }
+    return token;
+}
+
+}
+
+bool load_hashes(const std::string& path, RecordHashes& hashes, std::string& error)
+{
+    std::ifstream input(path);
+    if (!input)
+    {
+        return true;
+    }
+
+    try
+    {
+        nlohmann::json state;
+        input >> state;
+        hashes.format = state.at("format").get<std::string>();
+        for (auto it = state.at("records").begin(); it != state.at("records").end(); ++it)
+        {
+            hashes.records[it.key()] = it.value().get<std::vector<std::uint64_t>>();
+        }
+    }
+    catch (const std::exception& e)
+    {
+        error = path + ": " + e.what();
+        return false;
+    }
+    return true;
+}
+
+bool save_hashes(const std::string& path, const RecordHashes& hashes)
+{
+    nlohmann::json records = nlohmann::json::object();
+    for (const auto& entry : hashes.records)
+    {
+        records[entry.first] = entry.second;
+    }
+
+    std::ofstream output(path);
+    output << nlohmann::json { {"format", hashes.format}, {"records", records} }.dump() << std::endl;
+    return static_cast<bool>(output);
+}
+
+RecordHashes hash_document(const nlohmann::json& document)
+{
+    RecordHashes hashes;
+    for (auto it = document.begin(); it != document.end(); ++it)
+    {
+        std::vector<std::uint64_t>& values = hashes.records[it.key()];
+        if (is_record_array(it.key()) && it.value().is_array())
+        {
+            for (const nlohmann::json& record : it.value())
+            {
+                values.push_back(hash_value(record));
+            }
+        }
+        else
+        {
+            values.push_back(hash_value(it.value()));
+        }
+    }
+    return hashes;
+}
+
+nlohmann::json make_patch(const nlohmann::json& document, const RecordHashes& current, const RecordHashes& previous)
+{
+    nlohmann::json patch = nlohmann::json::array();
+
+    if (previous.records.empty())
+    {
+        patch.push_back({ {"op", "replace"}, {"path", ""}, {"value", document} });
+        return patch;
+    }
+
+    for (const auto& entry : previous.records)
+    {
+        if (current.records.count(entry.first) == 0)
+        {
+            patch.push_back({ {"op", "remove"}, {"path", "/" + escape_token(entry.first)} });
+        }
+    }
+
+    for (const auto& entry : current.records)
+    {
+        const std::string path = "/" + escape_token(entry.first);
+        const nlohmann::json& value = document[entry.first];
+
+        auto before = previous.records.find(entry.first);
+        if (before == previous.records.end())
+        {
+            patch.push_back({ {"op", "add"}, {"path", path}, {"value", value} });
+            continue;
+        }
+
+        const std::vector<std::uint64_t>& old_hashes = before->second;
+        const std::vector<std::uint64_t>& new_hashes = entry.second;
+
+        if (!is_record_array(entry.first) || !value.is_array())
+        {
+            if (old_hashes != new_hashes)
+            {
+                patch.push_back({ {"op", "replace"}, {"path", path}, {"value", value} });
+            }
+            continue;
+        }
+
+        const std::size_t common = std::min(old_hashes.size(), new_hashes.size());
+        for (std::size_t i = 0; i < common; ++i)
+        {
+            if (old_hashes[i] != new_hashes[i])
+            {
+                patch.push_back({ {"op", "replace"}, {"path", path + "/" + std::to_string(i)}, {"value", value[i]} });
+            }
+        }
+
+        for (std::size_t i = common; i < new_hashes.size(); ++i)
+        {
+            patch.push_back({ {"op", "add"}, {"path", path + "/-"}, {"value", value[i]} });
+        }
+
+        // From the back, so earlier indices stay valid.
+        for (std::size_t i = old_hashes.size(); i > common; --i)
+        {
+            patch.push_back({ {"op", "remove"}, {"path", path + "/" + std::to_string(i - 1)} });
+        }
+    }
+
+    return patch;
+}
+
+RecordDelta::RecordDelta(const RecordHashes& previous)
+    : mPrevious(previous)
+{
+    mCurrent.format = "ndjson";
+}
+
+bool RecordDelta::check(const std::string& type, unsigned int index, const std::string& line)
+{
+    std::vector<std::uint64_t>& hashes = mCurrent.records[type];
+    if (hashes.size() <= index)
+    {
+        hashes.resize(index + 1);
+    }
+    hashes[index] = hash_bytes(line.data(), line.size());
+
+    if (type == "header")
+    {
+        return true;
+    }
+
+    auto before = mPrevious.records.find(type);
+    return before == mPrevious.records.end() || before->second.size() <= index || before->second[index] != hashes[index];
+}
+
+std::vector<std::string> RecordDelta::removed() const
+{
+    std::vector<std::string> lines;
+    for (const auto& entry : mPrevious.records)
+    {
+        auto now = mCurrent.records.find(entry.first);
+        const std::size_t kept = now == mCurrent.records.end() ? 0 : now->second.size();
+        for (std::size_t i = kept; i < entry.second.size(); ++i)
+        {
+            nlohmann::json line = {
+                {"type", "removed"},
+                {"index", i},
+                {"data", { {"type", entry.first} }}
+            };
+            lines.push_back(line.dump());
+        }
+    }
+    return lines;
+}
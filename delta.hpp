@@ -0,0 +1,50 @@
+#pragma once
+
+#include <json/json.hpp>
+
+#include <cstdint>
+#include <map>
+#include <string>
+#include <vector>
+
+// Content hashes of the records of one written scene, kept between runs to
+// write only what changed. Keys are top-level document keys ("meshes",
+// "flags", "root", ...) for documents and record types ("mesh", "node",
+// ...) for NDJSON; each holds one hash per record, or one for a plain value.
+struct RecordHashes
+{
+    std::string format;
+    std::map<std::string, std::vector<std::uint64_t>> records;
+};
+
+// Reads hashes saved by save_hashes. A missing file reads as no hashes.
+bool load_hashes(const std::string& path, RecordHashes& hashes, std::string& error);
+bool save_hashes(const std::string& path, const RecordHashes& hashes);
+
+// Hashes every mesh, material, texture, light, camera and animation of the
+// document one by one, and every other top-level value whole.
+RecordHashes hash_document(const nlohmann::json& document);
+
+// RFC 6902 JSON Patch turning the document previous was hashed from into
+// document: whole records and top-level values are replaced, added or
+// removed. Without previous hashes, one replace of the whole document.
+nlohmann::json make_patch(const nlohmann::json& document, const RecordHashes& current, const RecordHashes& previous);
+
+// Counterpart for NDJSON: check(type, index, line) records the line's hash
+// and is true if the record is new or changed. The header always passes.
+// removed() lists the {"type": "removed", ...} lines for records previous
+// had past the end of the current ones.
+class RecordDelta
+{
+public:
+    explicit RecordDelta(const RecordHashes& previous);
+
+    bool check(const std::string& type, unsigned int index, const std::string& line);
+    std::vector<std::string> removed() const;
+
+    const RecordHashes& hashes() const { return mCurrent; }
+
+private:
+    const RecordHashes& mPrevious;
+    RecordHashes mCurrent;
+};
@@ -0,0 +1,364 @@
+#include "fragment.hpp"
+
+#include "cache.hpp"
+
+#include <dirent.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <functional>
+#include <sstream>
+#include <thread>
+#include <vector>
+
+namespace
+{
+
+// Chains each block into the running hash through the seed.
+class Hasher
+{
+public:
+    explicit Hasher(std::uint64_t seed)
+        : mHash(seed)
+    {
+    }
+
+    void add(const void* pData, std::size_t size)
+    {
+        mHash = hash_bytes(pData, size, mHash);
+    }
+
+    template <typename T>
+    void add_value(const T& value)
+    {
+        add(&value, sizeof(value));
+    }
+
+    template <typename T>
+    void add_array(const T* pValues, std::size_t count)
+    {
+        add_value(pValues != nullptr);
+        if (pValues)
+        {
+            add(pValues, sizeof(T) * count);
+        }
+    }
+
+    void add_string(const aiString& s)
+    {
+        add(s.C_Str(), s.length);
+        add_value(s.length);
+    }
+
+    std::uint64_t value() const
+    {
+        return mHash;
+    }
+
+private:
+    std::uint64_t mHash;
+};
+
+// Bumped whenever to_json(aiMesh*) or to_json(aiMaterial*) writes something
+// different for the same input, so stale fragments on disk are never hit.
+const char* const kFragmentLayout = "atj=" ATJ_VERSION ";fragments=2";
+
+// Distinct seeds keep a mesh and a material from sharing a key.
+std::uint64_t seed(std::uint64_t kind)
+{
+    return hash_bytes(kFragmentLayout, std::strlen(kFragmentLayout), kind);
+}
+
+const std::uint64_t kMeshSeed = seed(0x6d657368);
+const std::uint64_t kMaterialSeed = seed(0x6d617465);
+
+struct DiskFile
+{
+    std::string path;
+    std::uint64_t bytes;
+    time_t last_used;
+};
+
+// Every fragment file in the directory, with its size and last use.
+std::vector<DiskFile> list_fragments(const std::string& directory)
+{
+    std::vector<DiskFile> files;
+    if (DIR* pDir = ::opendir(directory.c_str()))
+    {
+        while (dirent* pEntry = ::readdir(pDir))
+        {
+            const std::string name = pEntry->d_name;
+            struct stat info;
+            const std::string path = directory + "/" + name;
+            if (name.size() == 21 && name.compare(16, 5, ".json") == 0
+                    && ::stat(path.c_str(), &info) == 0 && S_ISREG(info.st_mode))
+            {
+                files.push_back(DiskFile { path, static_cast<std::uint64_t>(info.st_size), info.st_mtime });
+            }
+        }
+        ::closedir(pDir);
+    }
+    return files;
+}
+
+}
+
+std::uint64_t hash_mesh(const aiMesh* pMesh, float morph_epsilon)
+{
+    Hasher hasher(kMeshSeed);
+    const unsigned int count = pMesh->mNumVertices;
+
+    hasher.add_value(morph_epsilon);
+    hasher.add_string(pMesh->mName);
+    hasher.add_value(pMesh->mPrimitiveTypes);
+    hasher.add_value(pMesh->mMaterialIndex);
+    hasher.add_value(count);
+
+    hasher.add_array(pMesh->mVertices, count);
+    hasher.add_array(pMesh->mNormals, count);
+    hasher.add_array(pMesh->mTangents, count);
+    hasher.add_array(pMesh->mBitangents, count);
+
+    for (unsigned int i = 0; i < AI_MAX_NUMBER_OF_COLOR_SETS; ++i)
+    {
+        hasher.add_array(pMesh->mColors[i], count);
+    }
+
+    for (unsigned int i = 0; i < AI_MAX_NUMBER_OF_TEXTURECOORDS; ++i)
+    {
+        hasher.add_array(pMesh->mTextureCoords[i], count);
+        hasher.add_value(pMesh->mNumUVComponents[i]);
+    }
+
+    hasher.add_value(pMesh->mNumFaces);
+    for (unsigned int i = 0; pMesh->mFaces && i < pMesh->mNumFaces; ++i)
+    {
+        hasher.add_array(pMesh->mFaces[i].mIndices, pMesh->mFaces[i].mNumIndices);
+    }
+
+    hasher.add_value(pMesh->mNumBones);
+    for (unsigned int i = 0; pMesh->mBones && i < pMesh->mNumBones; ++i)
+    {
+        const aiBone* pBone = pMesh->mBones[i];
+        hasher.add_string(pBone->mName);
+        hasher.add_value(pBone->mOffsetMatrix);
+        hasher.add_array(pBone->mWeights, pBone->mNumWeights);
+    }
+
+    hasher.add_value(pMesh->mMethod);
+    hasher.add_value(pMesh->mNumAnimMeshes);
+    for (unsigned int i = 0; i < pMesh->mNumAnimMeshes; ++i)
+    {
+        const aiAnimMesh* pTarget = pMesh->mAnimMeshes[i];
+        hasher.add_string(pTarget->mName);
+        hasher.add_value(pTarget->mWeight);
+        hasher.add_array(pTarget->mVertices, pTarget->mNumVertices);
+        hasher.add_array(pTarget->mNormals, pTarget->mNumVertices);
+        hasher.add_array(pTarget->mTangents, pTarget->mNumVertices);
+    }
+
+    return hasher.value();
+}
+
+std::uint64_t hash_material(const aiMaterial* pMaterial)
+{
+    Hasher hasher(kMaterialSeed);
+
+    hasher.add_value(pMaterial->mNumProperties);
+    for (unsigned int i = 0; i < pMaterial->mNumProperties; ++i)
+    {
+        const aiMaterialProperty* pProperty = pMaterial->mProperties[i];
+        hasher.add_string(pProperty->mKey);
+        hasher.add_value(pProperty->mSemantic);
+        hasher.add_value(pProperty->mIndex);
+        hasher.add_value(pProperty->mType);
+        hasher.add_array(pProperty->mData, pProperty->mDataLength);
+    }
+
+    return hasher.value();
+}
+
+FragmentCache::FragmentCache(std::size_t max_bytes, const std::string& directory, std::uint64_t max_disk_bytes)
+    : mMaxBytes(max_bytes),
+      mDirectory(directory),
+      mMaxDiskBytes(max_disk_bytes),
+      mDiskBytes(0),
+      mBytes(0),
+      mHits(0),
+      mMisses(0)
+{
+    for (const DiskFile& file : list_fragments(mDirectory))
+    {
+        mDiskBytes += file.bytes;
+    }
+}
+
+std::shared_ptr<const std::string> FragmentCache::find(std::uint64_t key)
+{
+    {
+        std::lock_guard<std::mutex> lock(mMutex);
+        auto entry = mEntries.find(key);
+        if (entry != mEntries.end())
+        {
+            mRecent.splice(mRecent.begin(), mRecent, entry->second.position);
+            ++mHits;
+            return entry->second.text;
+        }
+    }
+
+    std::shared_ptr<const std::string> pText = read_file(key);
+
+    std::lock_guard<std::mutex> lock(mMutex);
+    if (pText)
+    {
+        ++mHits;
+        store(key, pText);
+    }
+    else
+    {
+        ++mMisses;
+    }
+    return pText;
+}
+
+void FragmentCache::insert(std::uint64_t key, std::shared_ptr<const std::string> text)
+{
+    write_file(key, *text);
+
+    std::lock_guard<std::mutex> lock(mMutex);
+    store(key, text);
+}
+
+std::uint64_t FragmentCache::hits() const
+{
+    std::lock_guard<std::mutex> lock(mMutex);
+    return mHits;
+}
+
+std::uint64_t FragmentCache::misses() const
+{
+    std::lock_guard<std::mutex> lock(mMutex);
+    return mMisses;
+}
+
+void FragmentCache::store(std::uint64_t key, std::shared_ptr<const std::string> text)
+{
+    if (mEntries.count(key) != 0 || text->size() > mMaxBytes)
+    {
+        return;
+    }
+
+    mRecent.push_front(key);
+    mEntries[key] = Entry { text, mRecent.begin() };
+    mBytes += text->size();
+
+    while (mBytes > mMaxBytes)
+    {
+        auto oldest = mEntries.find(mRecent.back());
+        mBytes -= oldest->second.text->size();
+        mEntries.erase(oldest);
+        mRecent.pop_back();
+    }
+}
+
+std::string FragmentCache::file_path(std::uint64_t key) const
+{
+    char name[24];
+    std::snprintf(name, sizeof(name), "%016llx.json", static_cast<unsigned long long>(key));
+    return mDirectory + "/" + name;
+}
+
+std::shared_ptr<const std::string> FragmentCache::read_file(std::uint64_t key) const
+{
+    if (mDirectory.empty())
+    {
+        return nullptr;
+    }
+
+    const std::string path = file_path(key);
+    std::ifstream input(path, std::ios::binary);
+    if (!input)
+    {
+        return nullptr;
+    }
+
+    std::ostringstream text;
+    text << input.rdbuf();
+    if (!input || text.str().empty())
+    {
+        return nullptr;
+    }
+
+    // The modification time is the last use trim_directory goes by.
+    ::utimes(path.c_str(), nullptr);
+    return std::make_shared<const std::string>(text.str());
+}
+
+void FragmentCache::write_file(std::uint64_t key, const std::string& text)
+{
+    if (mDirectory.empty() || text.size() > mMaxDiskBytes)
+    {
+        return;
+    }
+
+    const std::string path = file_path(key);
+    const std::string temp = path + ".tmp" + std::to_string(::getpid()) + "."
+            + std::to_string(std::hash<std::thread::id>()(std::this_thread::get_id()));
+
+    // Written aside and renamed, so a concurrent reader never sees half a file.
+    {
+        std::ofstream output(temp, std::ios::binary);
+        output << text;
+        if (!output)
+        {
+            std::remove(temp.c_str());
+            return;
+        }
+    }
+    if (std::rename(temp.c_str(), path.c_str()) != 0)
+    {
+        std::remove(temp.c_str());
+        return;
+    }
+
+    std::lock_guard<std::mutex> lock(mDiskMutex);
+    mDiskBytes += text.size();
+    if (mDiskBytes > mMaxDiskBytes)
+    {
+        trim_directory();
+    }
+}
+
+void FragmentCache::trim_directory()
+{
+    std::vector<DiskFile> files = list_fragments(mDirectory);
+    std::sort(files.begin(), files.end(), [](const DiskFile& a, const DiskFile& b) {
+        return a.last_used < b.last_used;
+    });
+
+    mDiskBytes = 0;
+    for (const DiskFile& file : files)
+    {
+        mDiskBytes += file.bytes;
+    }
+
+    // Down to three quarters, so the next few writes do not list the
+    // directory again.
+    const std::uint64_t target = mMaxDiskBytes / 4 * 3;
+    for (const DiskFile& file : files)
+    {
+        if (mDiskBytes <= target)
+        {
+            break;
+        }
+        if (std::remove(file.path.c_str()) == 0)
+        {
+            mDiskBytes -= file.bytes;
+        }
+    }
+}
@@ -0,0 +1,78 @@
+#pragma once
+
+#include <assimp/material.h>
+#include <assimp/mesh.h>
+
+#include <cstddef>
+#include <cstdint>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+
+// Content hash of everything to_json(aiMesh*) reads, and of the morph
+// epsilon it is serialized with. Both hashes also cover the atj version and
+// the fragment layout, so fragments kept on disk by another build are not
+// reused.
+std::uint64_t hash_mesh(const aiMesh* pMesh, float morph_epsilon);
+
+// Content hash of every property of the material.
+std::uint64_t hash_material(const aiMaterial* pMaterial);
+
+// Compact JSON text of serialized mesh and material fragments keyed by
+// content hash, so props and materials shared by many files (or repeated
+// within one) are serialized once and their text is written out as is.
+// Least recently used fragments are dropped past max_bytes. With a
+// directory, fragments are also kept there as <hash>.json for later
+// processes, trimmed least recently used first past max_disk_bytes.
+// Thread safe.
+class FragmentCache
+{
+public:
+    static const std::size_t kDefaultMaxBytes = std::size_t(256) << 20;
+    static const std::uint64_t kDefaultMaxDiskBytes = std::uint64_t(1024) << 20;
+
+    explicit FragmentCache(std::size_t max_bytes = kDefaultMaxBytes, const std::string& directory = std::string(),
+            std::uint64_t max_disk_bytes = kDefaultMaxDiskBytes);
+
+    // The text stored under key, or null.
+    std::shared_ptr<const std::string> find(std::uint64_t key);
+
+    void insert(std::uint64_t key, std::shared_ptr<const std::string> text);
+
+    std::uint64_t hits() const;
+    std::uint64_t misses() const;
+
+private:
+    struct Entry
+    {
+        std::shared_ptr<const std::string> text;
+        std::list<std::uint64_t>::iterator position;
+    };
+
+    std::string file_path(std::uint64_t key) const;
+    std::shared_ptr<const std::string> read_file(std::uint64_t key) const;
+    void write_file(std::uint64_t key, const std::string& text);
+    void store(std::uint64_t key, std::shared_ptr<const std::string> text);
+
+    // Removes the least recently used files until the directory is well
+    // under max_disk_bytes.
+    void trim_directory();
+
+    std::size_t mMaxBytes;
+    std::string mDirectory;
+    std::uint64_t mMaxDiskBytes;
+
+    // Bytes in the directory, counted at construction and kept up to date
+    // with what this process writes and removes.
+    std::mutex mDiskMutex;
+    std::uint64_t mDiskBytes;
+
+    mutable std::mutex mMutex;
+    std::unordered_map<std::uint64_t, Entry> mEntries;
+    std::list<std::uint64_t> mRecent;
+    std::size_t mBytes;
+    std::uint64_t mHits;
+    std::uint64_t mMisses;
+};
@@ -1,697 +1,742 @@
-#include <assimp/Importer.hpp>
-#include <assimp/scene.h>
-#include <assimp/postprocess.h>
-
-#include <json/json.hpp>
-
-#include <iostream>
+#include "cache.hpp"
+#include "compress.hpp"
+#include "converter.hpp"
+#include "fragment.hpp"
+#include "options.hpp"
+#include "output.hpp"
+#include "schedule.hpp"
+#include "trace.hpp"
+
+#ifdef ATJ_SERVE
+#include "server.hpp"
+#endif
+#ifdef ATJ_WATCH
+#include "watch.hpp"
+#endif
+
+#include <libgen.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <chrono>
+#include <climits>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
 #include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <iterator>
+#include <memory>
+#include <sstream>
 #include <string>
+#include <vector>
 
-using json = nlohmann::json;
-
-void to_json(json& j, const aiString& s)
+void print_usage()
 {
-    j = s.C_Str();
+    std::cerr << "Usage: atj [options] <model>" << std::endl;
+    std::cerr << "       atj [options] --hint=<ext> -" << std::endl;
+#ifdef ATJ_WATCH
+    std::cerr << "       atj [options] --watch=<dir>" << std::endl;
+#endif
+#ifdef ATJ_SERVE
+    std::cerr << "       atj serve [options] <socket>" << std::endl;
+#endif
+    std::cerr << "  -                      read the model from stdin; --hint names its format" << std::endl;
+    std::cerr << "  --hint=<ext>           file extension of a model read from stdin" << std::endl;
+#ifdef ATJ_WATCH
+    std::cerr << "  --watch=<dir>          convert every model under dir next to its source" << std::endl;
+    std::cerr << "                         (model.obj to model.obj.json), then again whenever" << std::endl;
+    std::cerr << "                         it or a file it references changes, until" << std::endl;
+    std::cerr << "                         interrupted" << std::endl;
+#endif
+#ifdef ATJ_SERVE
+    std::cerr << "  serve <socket>         convert models sent over a Unix domain socket with" << std::endl;
+    std::cerr << "                         warm importers, until interrupted; each request" << std::endl;
+    std::cerr << "                         may add conversion options to the ones given here" << std::endl;
+    std::cerr << "  --workers=<n>          conversion threads for serve (one per hardware" << std::endl;
+    std::cerr << "                         thread by default)" << std::endl;
+    std::cerr << "  --max-connections=<n>  clients served at once (64 by default)" << std::endl;
+    std::cerr << "  --max-input-size=<MiB> largest model accepted as bytes over the socket" << std::endl;
+    std::cerr << "                         (256 by default)" << std::endl;
+    std::cerr << "  --memory-cache=<MiB>   keep results served recently in memory, up to" << std::endl;
+    std::cerr << "                         this size (512 by default, 0 turns it off)" << std::endl;
+    std::cerr << "  --metrics=<address>    answer GET /metrics with Prometheus text on a" << std::endl;
+    std::cerr << "                         loopback port, <ipv4>:<port> or a socket path" << std::endl;
+#endif
+    std::cerr << "  --schedule=<policy>    order queued conversions start in for serve and" << std::endl;
+    std::cerr << "                         --watch: shortest (estimated from size, format and" << std::endl;
+    std::cerr << "                         past timings; the default), fifo, fair (per" << std::endl;
+    std::cerr << "                         client) or deadline" << std::endl;
+    std::cerr << "  -o <path>, --output=<path>" << std::endl;
+    std::cerr << "                         where to write the result, \"-\" for stdout" << std::endl;
+    std::cerr << "                         (test.json by default)" << std::endl;
+    std::cerr << "  --write-buffers=<n>    ring of n 4 MiB buffers drained by a background" << std::endl;
+    std::cerr << "                         writer thread (4 by default, 1 writes inline)" << std::endl;
+    std::cerr << "  --compress=gzip|zstd[:level]" << std::endl;
+    std::cerr << "                         compress the output on worker threads as it is" << std::endl;
+    std::cerr << "                         written" << std::endl;
+    std::cerr << "  --index=<path>         write a sidecar index of the byte offset and length" << std::endl;
+    std::cerr << "                         of every record in json or ndjson output" << std::endl;
+    std::cerr << "  --delta=<state>        write only what changed since the run that saved" << std::endl;
+    std::cerr << "                         the record hashes in state: a JSON Patch, or" << std::endl;
+    std::cerr << "                         changed and removed records for ndjson" << std::endl;
+    std::cerr << "  --cache=<dir>          reuse earlier results for the same input bytes," << std::endl;
+    std::cerr << "                         referenced files and options" << std::endl;
+    std::cerr << "  --cache-size=<MiB>     evict least recently used results past this size" << std::endl;
+    std::cerr << "                         (1024 by default)" << std::endl;
+    std::cerr << "  --cache-stats          report cache hits, misses and size" << std::endl;
+    std::cerr << "  --scene-cache=<dir>    keep imported, post-processed scenes as assbin" << std::endl;
+    std::cerr << "                         and load them instead of parsing unchanged input" << std::endl;
+    std::cerr << "  --scene-cache-size=<MiB>" << std::endl;
+    std::cerr << "                         evict least recently used scenes past this size" << std::endl;
+    std::cerr << "                         (4096 by default)" << std::endl;
+    std::cerr << "  --fragment-cache[=<dir>]" << std::endl;
+    std::cerr << "                         serialize identical meshes and materials once in" << std::endl;
+    std::cerr << "                         ndjson output, keeping them in dir for later runs" << std::endl;
+    std::cerr << "                         if given" << std::endl;
+    std::cerr << "  --fragment-cache-size=<MiB>" << std::endl;
+    std::cerr << "                         trim the fragment directory past this size" << std::endl;
+    std::cerr << "                         (1024 by default)" << std::endl;
+    std::cerr << "  --preset=<name>        post-processing preset: default, fast, quality" << std::endl;
+    std::cerr << "                         or realtime-max" << std::endl;
+    std::cerr << "  --process=<steps>      comma separated aiProcess_ step names to run" << std::endl;
+    std::cerr << "                         instead of a preset, e.g. Triangulate,SortByPType" << std::endl;
+    std::cerr << "  --property=NAME=value  set an AI_CONFIG_* importer property" << std::endl;
+    std::cerr << "  --no-mmap              read input through buffered file IO instead of" << std::endl;
+    std::cerr << "                         memory mapping it" << std::endl;
+    std::cerr << "  --timings              run post-processing steps one at a time and" << std::endl;
+    std::cerr << "                         report how long each took; slower than running" << std::endl;
+    std::cerr << "                         them together, which shares work between steps" << std::endl;
+    std::cerr << "  --trace=<file>         write Chrome trace events (chrome://tracing," << std::endl;
+    std::cerr << "                         Perfetto) with per-thread spans for every phase," << std::endl;
+    std::cerr << "                         mesh and animation; with --timings as well, for" << std::endl;
+    std::cerr << "                         every post-process step, which runs them one at a" << std::endl;
+    std::cerr << "                         time and so more slowly" << std::endl;
+    std::cerr << "  --reduce-keys[=t,r,s]  drop animation keys rebuildable within the given" << std::endl;
+    std::cerr << "                         translation, rotation (radians) and scale tolerance" << std::endl;
+    std::cerr << "  --split-meshes[=<n>]   split meshes to at most n vertices (65535 by" << std::endl;
+    std::cerr << "                         default) so every index buffer fits in uint16" << std::endl;
+    std::cerr << "  --sample-rate=<fps>    resample animations at a fixed rate into flat" << std::endl;
+    std::cerr << "                         translation/rotation/scale arrays" << std::endl;
+    std::cerr << "  --bake-skinning=<fps>[,half]" << std::endl;
+    std::cerr << "                         bake per-frame, per-bone 3x4 skinning matrices" << std::endl;
+    std::cerr << "  --morph-epsilon=<e>    smallest delta kept in sparse morph targets" << std::endl;
+    std::cerr << "  --rotation-bits=32|48  store animation rotations smallest-three packed" << std::endl;
+    std::cerr << "  --key-times=float|frames[,<fps>]" << std::endl;
+    std::cerr << "                         store animation times as floats or frame numbers" << std::endl;
+    std::cerr << "                         at fps (30 by default, or the --sample-rate)" << std::endl;
+    std::cerr << "  --format=json|ndjson|cbor|msgpack" << std::endl;
+    std::cerr << "                         output encoding, json by default; ndjson writes" << std::endl;
+    std::cerr << "                         one record per line as each is serialized" << std::endl;
 }
 
-void to_json(json& j, const aiMatrix4x4& matrix)
+// Writes the trace however the conversion ends, so a failed one still
+// leaves a trace to look at.
+class TraceFile
 {
-    j = json::array({
-            matrix.a1, matrix.a2, matrix.a3, matrix.a4,
-            matrix.b1, matrix.b2, matrix.b3, matrix.b4,
-            matrix.c1, matrix.c2, matrix.c3, matrix.c4,
-            matrix.d1, matrix.d2, matrix.d3, matrix.d4,
-        });
-}
-
-void to_json(json& j, aiVertexWeight weight)
-{
-    j = json {
-        {"id", weight.mVertexId},
-        {"weight", weight.mWeight}
-    };
-}
-
-void to_json(json& j, const aiBone* pBone)
-{
-    j = json {
-        {"name", pBone->mName},
-        {"num_weights", pBone->mNumWeights},
-        {"offset_matrix", pBone->mOffsetMatrix},
-        {"weights", json::array()}
-    };
-
-    for (int i = 0; i < pBone->mNumWeights; ++i)
+public:
+    explicit TraceFile(const std::string& path)
+        : mPath(path)
     {
-        j["weights"].push_back(pBone->mWeights[i]);
+        start_trace();
     }
-}
 
-void to_json(json& j, const aiVector2D& vertex)
-{
-    j = json {vertex.x, vertex.y};
-}
+    ~TraceFile()
+    {
+        std::string error;
+        if (!write_trace(mPath, error))
+        {
+            std::cerr << "Error: " << error << std::endl;
+        }
+    }
 
-void to_json(json& j, const aiVector3D& vertex)
-{
-    j = json {vertex.x, vertex.y, vertex.z};
-}
+private:
+    std::string mPath;
+};
 
-void to_json(json& j, const aiColor4D& color)
+void print_cache_stats(const CacheStats& stats, bool hit)
 {
-    j = json {color.r, color.g, color.b, color.a};
+    std::cerr << "Cache: " << (hit ? "hit" : "miss") << ", " << stats.hits << " hits, " << stats.misses << " misses, "
+              << stats.entries << " entries, " << stats.bytes / 1048576.0 << " MiB" << std::endl;
 }
 
-void to_json(json& j, const aiColor3D& color)
-{
-    j = json {color.r, color.g, color.b};
-}
+// Sizes are given in MiB and shifted to bytes; a 1 TiB cap keeps the shift
+// from overflowing.
+const long kMaxMegabytes = 1L << 20;
 
-void to_json(json& j, const aiFace& face)
+bool parse_megabytes(const std::string& value, long minimum, long maximum, std::uint64_t& megabytes)
 {
-    unsigned int numIndices = face.mNumIndices;
-    std::vector<unsigned int> indices(numIndices);
-
-    for (unsigned int j = 0; j < numIndices; ++j)
+    long number = 0;
+    if (!parse_integer(value, number) || number < minimum || number > maximum)
     {
-        indices[j] = face.mIndices[j];
+        return false;
     }
-
-    j = json { {"num_indices", numIndices}, {"indices", indices} };
+    megabytes = static_cast<std::uint64_t>(number);
+    return true;
 }
 
-void to_json(json& j, const aiMesh* pMesh)
+int main(int argc, char* argv[])
 {
-    j["name"] = pMesh->mName;
-    j["primitive_types"] = pMesh->mPrimitiveTypes;
-    j["material_index"] = pMesh->mMaterialIndex;
-
-    if (pMesh->HasPositions())
-    {
-        for (unsigned int i = 0; i < pMesh->mNumVertices; ++i)
+    std::string filename;
+
+    std::string output_name = "test.json";
+    bool output_given = false;
+    std::string index_name;
+    std::string cache_dir;
+    std::string delta_name;
+    std::string watch_dir;
+    std::string trace_name;
+    std::uint64_t cache_megabytes = 1024;
+    bool cache_stats = false;
+    bool fragment_cache = false;
+    std::string fragment_dir;
+    std::uint64_t fragment_disk_bytes = FragmentCache::kDefaultMaxDiskBytes;
+
+    ConvertSettings settings;
+    ConvertOptions& convert = settings.convert;
+    ExportOptions& options = convert.export_options;
+    const OutputFormat& format = settings.format;
+    const Compression& compression = settings.compression;
+    const std::string& hint = settings.hint;
+    int write_buffers = FdOutputBuffer::kDefaultBufferCount;
+    SchedulePolicy schedule = SchedulePolicy::ShortestFirst;
+
+#ifdef ATJ_SERVE
+    // atj serve [options] <socket>
+    const bool serve = argc > 1 && std::strcmp(argv[1], "serve") == 0;
+    int serve_workers = 0;
+    int max_connections = 64;
+    std::uint64_t max_input_megabytes = 256;
+    std::uint64_t memory_cache_megabytes = 512;
+    std::string metrics_address;
+#else
+    const bool serve = false;
+#endif
+
+    for (int i = serve ? 2 : 1; i < argc; ++i)
+    {
+        const std::string arg = argv[i];
+        const std::string::size_type equals = arg.find('=');
+        const std::string name = arg.substr(0, equals);
+        const std::string value = equals == std::string::npos ? "" : arg.substr(equals + 1);
+
+        if (arg == "-o" && i + 1 < argc)
         {
-            j["vertices"].push_back(pMesh->mVertices[i]);
+            output_name = argv[++i];
+            output_given = true;
         }
-    }
-
-    if (pMesh->HasNormals())
-    {
-        for (unsigned int i = 0; i < pMesh->mNumVertices; ++i)
+        else if (name == "--output")
         {
-            j["normals"].push_back(pMesh->mNormals[i]);
+            output_name = value;
+            output_given = true;
         }
-    }
-
-    if (pMesh->HasTangentsAndBitangents())
-    {
-        for (unsigned int i = 0; i < pMesh->mNumVertices; ++i)
+        else if (name == "--write-buffers")
         {
-            j["tangents"].push_back(pMesh->mTangents[i]);
-            j["bitangents"].push_back(pMesh->mBitangents[i]);
+            long count = 0;
+            if (!parse_integer(value, count) || count < 1 || count > 1024)
+            {
+                std::cerr << "Error: Bad buffer count: " << value << std::endl;
+                return 1;
+            }
+            write_buffers = static_cast<int>(count);
         }
-    }
-
-    if (pMesh->HasFaces())
-    {
-        for (unsigned int i = 0; i < pMesh->mNumVertices; ++i)
+        else if (name == "--index")
         {
-            j["faces"].push_back(pMesh->mFaces[i]);
+            index_name = value;
+            convert.index_records = true;
         }
-    }
-
-    if (pMesh->HasBones())
-    {
-        for (unsigned int i = 0; i < pMesh->mNumBones; ++i)
+        else if (name == "--delta")
         {
-            aiBone* pBone = pMesh->mBones[i];
-            j["bones"].push_back(pBone);
+            delta_name = value;
         }
-    }
-
-    for (unsigned int i = 0; i < pMesh->GetNumColorChannels(); ++i)
-    {
-        if (pMesh->HasVertexColors(i))
+        else if (name == "--cache")
+        {
+            cache_dir = value;
+        }
+        else if (name == "--cache-size")
         {
-            std::string key = std::to_string(i);
-            std::vector<aiColor4D> colors(pMesh->mNumVertices);
-            for (unsigned int j = 0; j < pMesh->mNumVertices; ++j)
+            if (!parse_megabytes(value, 1, kMaxMegabytes, cache_megabytes))
             {
-                colors[j] = (pMesh->mColors[i][j]);
+                std::cerr << "Error: Bad cache size: " << value << std::endl;
+                return 1;
             }
-
-            j["colors"][key] = colors;
         }
-    }
-
-    for (unsigned int i = 0; i < pMesh->GetNumUVChannels(); ++i)
-    {
-        if (pMesh->HasTextureCoords(i))
+        else if (name == "--scene-cache")
         {
-            std::string key = std::to_string(i);
-            unsigned int size = pMesh->mNumUVComponents[i];
-
-            std::vector<aiVector3D> uvs(pMesh->mNumVertices);
-            for (unsigned int j = 0; j < pMesh->mNumVertices; ++j)
+            convert.scene_cache = value;
+        }
+        else if (name == "--scene-cache-size")
+        {
+            std::uint64_t megabytes = 0;
+            if (!parse_megabytes(value, 1, kMaxMegabytes, megabytes))
             {
-                uvs[j] = (pMesh->mTextureCoords[i][j]);
+                std::cerr << "Error: Bad cache size: " << value << std::endl;
+                return 1;
             }
-
-            j["texturecoords"][key] = {
-                {"numcomponents", size},
-                {"uvs", uvs}
-            };
+            convert.scene_cache_bytes = megabytes << 20;
         }
-    }
-}
-
-std::string texture_string(const aiTextureType& type)
-{
-    std::string name;
-
-    switch (type)
-    {
-        case aiTextureType_DIFFUSE:
-            name = "diffuse";
-            break;
-        case aiTextureType_SPECULAR:
-            name = "specular";
-            break;
-        case aiTextureType_AMBIENT:
-            name = "ambient";
-            break;
-        case aiTextureType_EMISSIVE:
-            name = "emissive";
-            break;
-        case aiTextureType_HEIGHT:
-            name = "height";
-            break;
-        case aiTextureType_NORMALS:
-            name = "normals";
-            break;
-        case aiTextureType_SHININESS:
-            name = "shininess";
-            break;
-        case aiTextureType_OPACITY:
-            name = "opacity";
-            break;
-        case aiTextureType_DISPLACEMENT:
-            name = "displacement";
-            break;
-        case aiTextureType_LIGHTMAP:
-            name = "lightmap";
-            break;
-        case aiTextureType_REFLECTION:
-            name = "reflection";
-            break;
-        case aiTextureType_UNKNOWN:
-            name = "unknown";
-            break;
-        default:
-            name = "none";
+        else if (name == "--fragment-cache")
+        {
+            fragment_cache = true;
+            fragment_dir = value;
+        }
+        else if (name == "--fragment-cache-size")
+        {
+            std::uint64_t megabytes = 0;
+            if (!parse_megabytes(value, 1, kMaxMegabytes, megabytes))
+            {
+                std::cerr << "Error: Bad cache size: " << value << std::endl;
+                return 1;
+            }
+            fragment_disk_bytes = megabytes << 20;
+        }
+        else if (name == "--schedule")
+        {
+            if (!parse_schedule_policy(value, schedule))
+            {
+                std::cerr << "Error: Unknown schedule: " << value << std::endl;
+                return 1;
+            }
+        }
+        else if (name == "--cache-stats")
+        {
+            cache_stats = true;
+        }
+        else if (name == "--trace")
+        {
+            trace_name = value;
+            if (trace_name.empty())
+            {
+                std::cerr << "Error: --trace needs a file name" << std::endl;
+                return 1;
+            }
+        }
+#ifdef ATJ_WATCH
+        else if (name == "--watch")
+        {
+            watch_dir = value;
+        }
+#endif
+#ifdef ATJ_SERVE
+        else if (serve && name == "--workers")
+        {
+            long count = 0;
+            if (!parse_integer(value, count) || count < 1 || count > 1024)
+            {
+                std::cerr << "Error: Bad worker count: " << value << std::endl;
+                return 1;
+            }
+            serve_workers = static_cast<int>(count);
+        }
+        else if (serve && name == "--max-connections")
+        {
+            long count = 0;
+            if (!parse_integer(value, count) || count < 1 || count > 65536)
+            {
+                std::cerr << "Error: Bad connection limit: " << value << std::endl;
+                return 1;
+            }
+            max_connections = static_cast<int>(count);
+        }
+        else if (serve && name == "--max-input-size")
+        {
+            if (!parse_megabytes(value, 1, 4095, max_input_megabytes))
+            {
+                std::cerr << "Error: Bad input size: " << value << std::endl;
+                return 1;
+            }
+        }
+        else if (serve && name == "--metrics")
+        {
+            metrics_address = value;
+        }
+        else if (serve && name == "--memory-cache")
+        {
+            if (!parse_megabytes(value, 0, kMaxMegabytes, memory_cache_megabytes))
+            {
+                std::cerr << "Error: Bad cache size: " << value << std::endl;
+                return 1;
+            }
+        }
+#endif
+        else if (name.compare(0, 2, "--") == 0)
+        {
+            std::string error;
+            OptionResult applied = apply_option(name, value, settings, error);
+            if (applied == OptionResult::Invalid)
+            {
+                std::cerr << "Error: " << error << std::endl;
+                return 1;
+            }
+            if (applied == OptionResult::Unknown)
+            {
+                std::cerr << "Error: Unknown option: " << arg << std::endl;
+                print_usage();
+                return 1;
+            }
+        }
+        else if (filename.empty())
+        {
+            filename = arg;
+        }
+        else
+        {
+            filename.clear();
             break;
-    };
-
-    return name;
-}
-
-void to_json(json& j, const aiMaterial* pMaterial)
-{
-    aiString name;
-    if (pMaterial->Get(AI_MATKEY_NAME, name) == AI_SUCCESS)
-    {
-        j["name"] = name;
-    }
-
-    aiColor3D diffuse(0.f, 0.f, 0.f);
-    if (pMaterial->Get(AI_MATKEY_COLOR_DIFFUSE, diffuse) == AI_SUCCESS)
-    {
-        j["diffuse"] = diffuse;
-    }
-
-    aiColor3D specular(0.f, 0.f, 0.f);
-    if (pMaterial->Get(AI_MATKEY_COLOR_SPECULAR, specular) == AI_SUCCESS)
-    {
-        j["specular"] = specular;
-    }
-
-    aiColor3D ambient(0.f, 0.f, 0.f);
-    if (pMaterial->Get(AI_MATKEY_COLOR_AMBIENT, ambient) == AI_SUCCESS)
-    {
-        j["ambient"] = ambient;
+        }
     }
 
-    aiColor3D emissive(0.f, 0.f, 0.f);
-    if (pMaterial->Get(AI_MATKEY_COLOR_EMISSIVE, emissive) == AI_SUCCESS)
+    if (!trace_name.empty() && (serve || !watch_dir.empty()))
     {
-        j["emissive"] = emissive;
+        std::cerr << "Error: --trace profiles a single conversion, not --watch or serve" << std::endl;
+        return 1;
     }
 
-    aiColor3D trans(0.f, 0.f, 0.f);
-    if (pMaterial->Get(AI_MATKEY_COLOR_TRANSPARENT, trans)== AI_SUCCESS)
+    // Watch mode names its outputs after the models and serve takes them
+    // from each request, so these have nothing to apply to.
+    if (serve || !watch_dir.empty())
     {
-        j["transparent"] = trans;
+        const char* pIgnored = output_given ? "-o" : !index_name.empty() ? "--index"
+                : !delta_name.empty() ? "--delta" : !cache_dir.empty() ? "--cache" : nullptr;
+        if (pIgnored)
+        {
+            std::cerr << "Error: " << pIgnored << " applies to a single conversion, not --watch or serve"
+                      << std::endl;
+            return 1;
+        }
     }
 
-    int wireframe = 0;
-    if (pMaterial->Get(AI_MATKEY_ENABLE_WIREFRAME, wireframe) == AI_SUCCESS)
+    // Shared by every conversion below, watch workers included.
+    std::unique_ptr<FragmentCache> fragments;
+    if (fragment_cache)
     {
-        j["wireframe"] = wireframe == 0 ? false : true;
+        if (!serve && format != OutputFormat::Ndjson)
+        {
+            std::cerr << "Error: --fragment-cache needs --format=ndjson" << std::endl;
+            return 1;
+        }
+        if (!fragment_dir.empty() && ::mkdir(fragment_dir.c_str(), 0755) != 0 && errno != EEXIST)
+        {
+            std::cerr << "Error: Cannot create " << fragment_dir << ": " << std::strerror(errno) << std::endl;
+            return 1;
+        }
+        fragments.reset(new FragmentCache(FragmentCache::kDefaultMaxBytes, fragment_dir, fragment_disk_bytes));
+        options.pFragments = fragments.get();
     }
 
-    int twosided = 0;
-    if (pMaterial->Get(AI_MATKEY_TWOSIDED, twosided) == AI_SUCCESS)
+#ifdef ATJ_SERVE
+    if (serve)
     {
-        j["twosided"] = twosided == 0 ? false : true;
-    }
+        if (filename.empty())
+        {
+            std::cerr << "Error: atj serve needs a socket path" << std::endl;
+            print_usage();
+            return 1;
+        }
 
-    int shading_model = 0;
-    if (pMaterial->Get(AI_MATKEY_SHADING_MODEL, shading_model) == AI_SUCCESS)
-    {
-        j["shading_model"] = shading_model;
+        ServeOptions server;
+        server.socket_path = filename;
+        server.defaults = settings;
+        server.workers = serve_workers;
+        server.max_connections = max_connections;
+        server.max_input_bytes = max_input_megabytes << 20;
+        server.write_buffers = write_buffers;
+        server.cache_bytes = memory_cache_megabytes << 20;
+        server.schedule = schedule;
+        server.metrics_address = metrics_address;
+        return run_server(server);
     }
+#endif
 
-    int blend_func = 0;
-    if (pMaterial->Get(AI_MATKEY_BLEND_FUNC, blend_func) == AI_SUCCESS)
+#ifdef ATJ_WATCH
+    if (!watch_dir.empty())
     {
-        j["blend_func"] = blend_func;
+        WatchOptions watch;
+        watch.directory = watch_dir;
+        watch.convert = convert;
+        watch.format = format;
+        watch.compression = compression;
+        watch.write_buffers = write_buffers;
+        watch.schedule = schedule;
+        return run_watch(watch);
     }
+#endif
 
-    float opacity = 1.f;
-    if (pMaterial->Get(AI_MATKEY_OPACITY, opacity) == AI_SUCCESS)
+    if (!filename.empty() && !index_name.empty()
+            && ((format != OutputFormat::Json && format != OutputFormat::Ndjson) || compression.codec != Codec::None))
     {
-        j["opacity"] = opacity;
+        std::cerr << "Error: --index needs uncompressed json or ndjson output" << std::endl;
+        return 1;
     }
 
-    float shininess = 0.f;
-    if (pMaterial->Get(AI_MATKEY_SHININESS, shininess) == AI_SUCCESS)
+    if (!delta_name.empty())
     {
-        j["shininess"] = shininess;
+        std::string error;
+        if (!load_hashes(delta_name, convert.previous_hashes, error))
+        {
+            std::cerr << "Error: " << error << std::endl;
+            return 1;
+        }
+        if (convert.previous_hashes.format != (format == OutputFormat::Ndjson ? "ndjson" : "document"))
+        {
+            convert.previous_hashes = RecordHashes();
+        }
+        if (!cache_dir.empty() || (!index_name.empty() && format != OutputFormat::Ndjson))
+        {
+            std::cerr << "Error: --delta works with --index for ndjson only, and not with --cache" << std::endl;
+            return 1;
+        }
+        convert.delta = true;
     }
 
-    float shininess_strength = 1.f;
-    if (pMaterial->Get(AI_MATKEY_SHININESS_STRENGTH, shininess_strength) == AI_SUCCESS)
+    if (!filename.empty())
     {
-        j["shininess_strength"] = shininess_strength;
-    }
+        // Started before the output buffers, so their threads are named.
+        std::unique_ptr<TraceFile> trace;
+        if (!trace_name.empty())
+        {
+            trace.reset(new TraceFile(trace_name));
+        }
 
-    float refraction = 1.f;
-    if (pMaterial->Get(AI_MATKEY_REFRACTI, refraction) == AI_SUCCESS)
-    {
-        j["refraction"] = refraction;
-    }
+        std::vector<char> bytes;
+        if (filename == "-")
+        {
+            std::cin >> std::noskipws;
+            bytes.assign(std::istreambuf_iterator<char>(std::cin), std::istreambuf_iterator<char>());
+        }
 
-    std::vector<json> textures;
-    unsigned int texture_type_count = static_cast<int>(aiTextureType_UNKNOWN) + 1;
-    for (unsigned int i = 1; i < texture_type_count; ++i)
-    {
-        aiTextureType type = static_cast<aiTextureType>(i);
+        std::string error;
 
-        unsigned int count = pMaterial->GetTextureCount(type);
-        for (unsigned int index = 0; index < count; ++index)
+        ConversionCache cache(cache_dir, cache_megabytes << 20);
+        std::string cache_key;
+        CacheArtifacts destinations { { "output", output_name } };
+        if (!index_name.empty())
         {
-            aiString path;
-            aiTextureMapping mapping = aiTextureMapping_UV;
-            unsigned int uvindex = 0;
-            ai_real blend = 1.f;
-            aiTextureOp op = aiTextureOp_Multiply;
-            std::vector<aiTextureMapMode> mapmode(3);
+            destinations.push_back({ "index", index_name });
+        }
 
-            if (pMaterial->GetTexture(type, index, &path, &mapping, &uvindex, &blend, &op, mapmode.data()) == AI_SUCCESS)
+        if (!cache_dir.empty())
+        {
+            std::uint64_t input_hash = 0;
+            std::uint64_t input_size = bytes.size();
+            if (filename == "-")
             {
-                textures.push_back(json {
-                    {"type", texture_string(type)},
-                    {"path", path},
-                    {"mapping", static_cast<unsigned int>(mapping)},
-                    {"uvindex", uvindex},
-                    {"blend", blend},
-                    {"op", static_cast<unsigned int>(op)},
-                    {"mapmode", mapmode}
-                });
+                input_hash = hash_bytes(bytes.data(), bytes.size());
+            }
+            if (!cache.open(error) || (filename != "-" && !hash_file(filename, input_hash, input_size, error)))
+            {
+                std::cerr << "Error: " << error << std::endl;
+                return 1;
             }
-        }
-    }
-
-    if (textures.empty() == false)
-    {
-        j["textures"] = textures;
-    }
-}
-
-void to_json(json& j, const aiTexel& texel)
-{
-    j = json {texel.a, texel.b, texel.g, texel.r};
-}
-
-void to_json(json& j, const aiTexture* pTexture)
-{
-    std::vector<aiTexel> data(pTexture->mWidth * pTexture->mHeight);
-    std::memcpy(data.data(), pTexture->pcData, data.size() * sizeof(aiTexel));
-
-    j = json {
-        {"format", pTexture->achFormatHint},
-        {"height", pTexture->mHeight},
-        {"width", pTexture->mWidth},
-        {"data", data}
-    };
-}
-
-void to_json(json& j, const aiLight* pLight)
-{
-    j = json {
-        {"name", pLight->mName},
-        {"type", static_cast<unsigned int>(pLight->mType)},
-        {"position", pLight->mPosition},
-        {"direction", pLight->mDirection},
-        {"up", pLight->mUp},
-        {"inner_cone_angle", pLight->mAngleInnerCone},
-        {"outer_cone_angle", pLight->mAngleOuterCone},
-        {"attenuation_constant", pLight->mAttenuationConstant},
-        {"attenuation_linear", pLight->mAttenuationLinear},
-        {"attenuation_quadratic", pLight->mAttenuationQuadratic},
-        {"color_ambient", pLight->mColorAmbient},
-        {"color_diffuse", pLight->mColorDiffuse},
-        {"color_specular", pLight->mColorSpecular},
-        {"size", pLight->mSize}
-    };
-}
-
-void to_json(json& j, const aiCamera* pCamera)
-{
-    j = json {
-        {"name", pCamera->mName},
-        {"position", pCamera->mPosition},
-        {"lookAt", pCamera->mLookAt},
-        {"up", pCamera->mUp}, 
-        {"aspect", pCamera->mAspect},
-        {"far", pCamera->mClipPlaneFar},
-        {"near", pCamera->mClipPlaneNear},
-        {"horizontalFOV", pCamera->mHorizontalFOV}
-    };
-}
-
-void to_json(json& j, const aiVectorKey& key)
-{
-    j = json {
-        {"time", key.mTime},
-        {"value", key.mValue}
-    };
-}
-
-void to_json(json& j, const aiQuaternion& q)
-{
-    j = json { q.x, q.y, q.z, q.w };
-}
-
-void to_json(json& j, const aiQuatKey& key)
-{
-    j = json {
-        {"time", key.mTime},
-        {"value", key.mValue}
-    };
-}
-
-void to_json(json& j, const aiNodeAnim* nodeAnim)
-{
-    unsigned int position_count = nodeAnim->mNumPositionKeys;
-    unsigned int rotation_count = nodeAnim->mNumRotationKeys;
-    unsigned int scaling_count = nodeAnim->mNumScalingKeys;
-
-    std::vector<aiVectorKey> position_keys(position_count);
-    std::vector<aiQuatKey> rotation_keys(rotation_count);
-    std::vector<aiVectorKey> scaling_keys(scaling_count);
-
-    std::memcpy(position_keys.data(), nodeAnim->mPositionKeys, sizeof(aiVectorKey) * position_count);
-    std::memcpy(rotation_keys.data(), nodeAnim->mRotationKeys, sizeof(aiQuatKey) * rotation_count);
-    std::memcpy(scaling_keys.data(), nodeAnim->mScalingKeys, sizeof(aiVectorKey) * scaling_count);
-
-    j = json {
-        {"node_name", nodeAnim->mNodeName},
-        {"num_position_keys", position_count},
-        {"num_rotation_keys", rotation_count},
-        {"num_scaling_keys", scaling_count},
-        {"position_keys", position_keys},
-        {"post_state", static_cast<unsigned int>(nodeAnim->mPostState)},
-        {"pre_state", static_cast<unsigned int>(nodeAnim->mPreState)},
-        {"rotation_keys", rotation_keys},
-        {"scaling_keys", scaling_keys}
-    };
-}
-
-void to_json(json& j, const aiMeshKey& key)
-{
-    j = json {
-        {"time", key.mTime},
-        {"value", key.mValue}
-    };
-}
-
-void to_json(json& j, const aiMeshAnim* pMeshAnim)
-{
-    unsigned int count = pMeshAnim->mNumKeys;
-    std::vector<aiMeshKey> keys(count);
-    std::memcpy(keys.data(), pMeshAnim->mKeys, sizeof(aiMeshKey) * count);
-
-    j = json {
-        {"keys", keys},
-        {"name", pMeshAnim->mName},
-        {"num_keys", count}
-    };
-}
-
-void to_json(json& j, const aiMeshMorphKey& key)
-{
-    unsigned int count = key.mNumValuesAndWeights;
-    std::vector<unsigned int> values(count);
-    std::vector<double> weights(count);
-
-    std::memcpy(values.data(), key.mValues, sizeof(unsigned int) * count);
-    std::memcpy(weights.data(), key.mWeights, sizeof(double) * count);
-
-    j = json {
-        {"num_values_and_weights", count},
-        {"time", key.mTime},
-        {"values", values},
-        {"weights", weights}
-    };
-}
-
-void to_json(json& j, const aiMeshMorphAnim* pMeshMorphAnim)
-{
-    unsigned int count = pMeshMorphAnim->mNumKeys;
-    std::vector<aiMeshMorphKey> keys(count);
-    std::memcpy(keys.data(), pMeshMorphAnim->mKeys, sizeof(aiMeshMorphKey) * count);
-
-    j = json {
-        {"keys", keys},
-        {"name", pMeshMorphAnim->mName},
-        {"num_keys", count}
-    };
-}
 
-void to_json(json& j, const aiAnimation* pAnimation)
-{
-    unsigned int c_count = pAnimation->mNumChannels;
-    unsigned int mc_count = pAnimation->mNumMeshChannels;
-    unsigned int mmc_count = pAnimation->mNumMorphMeshChannels;
-
-    std::vector<aiNodeAnim*> nodeAnims(c_count);
-    std::vector<aiMeshAnim*> meshAnims(mc_count);
-    std::vector<aiMeshMorphAnim*> meshMorphAnims(mmc_count);
-
-    std::memcpy(nodeAnims.data(), pAnimation->mChannels, sizeof(aiNodeAnim*) * c_count);
-    std::memcpy(meshAnims.data(), pAnimation->mMeshChannels, sizeof(aiMeshAnim*) * mc_count);
-    std::memcpy(meshMorphAnims.data(), pAnimation->mMorphMeshChannels, sizeof(aiMeshMorphAnim*) * mmc_count);
-
-    j = json {
-        {"channels", nodeAnims},
-        {"duration", pAnimation->mDuration},
-        {"mesh_channels", meshAnims},
-        {"morph_mesh_channels", meshMorphAnims},
-        {"name", pAnimation->mName},
-        {"num_channels", c_count},
-        {"num_mesh_channels", mc_count},
-        {"num_morph_mesh_channels", mmc_count},
-        {"ticks_per_second", pAnimation->mTicksPerSecond}
-    };
-}
+            // Files the model references resolve against its directory, so
+            // identical bytes elsewhere are a different conversion.
+            char base[PATH_MAX];
+            if (!::realpath(filename == "-" ? "." : filename.c_str(), base))
+            {
+                std::cerr << "Error: " << filename << ": " << std::strerror(errno) << std::endl;
+                return 1;
+            }
 
-void to_json(json& j, const aiMetadataEntry& entry)
-{
+            std::ostringstream described;
+            described << describe_options(convert) << ";format=" << static_cast<int>(format)
+                      << ";compress=" << static_cast<int>(compression.codec) << "," << compression.level
+                      << ";hint=" << hint << ";base=" << (filename == "-" ? base : dirname(base));
+            cache_key = ConversionCache::make_key(input_hash, input_size, described.str());
 
-    switch (entry.mType)
-    {
-        case AI_BOOL:
-            j = json {
-                {"type", "bool"},
-                {"data", *reinterpret_cast<bool*>(entry.mData)}
-            };
-            break;
-        case AI_INT32:
-            j = json {
-                {"type", "int_32"},
-                {"data", *reinterpret_cast<int32_t*>(entry.mData)}
-            };
-            break;
-        case AI_UINT64:
-            j = json {
-                {"type", "uint_64"},
-                {"data", *reinterpret_cast<uint64_t*>(entry.mData)}
-            };
-            break;
-        case AI_FLOAT:
-            j = json {
-                {"type", "float"},
-                {"data", *reinterpret_cast<float*>(entry.mData)}
-            };
-            break;
-        case AI_DOUBLE:
-            j = json {
-                {"type", "double"},
-                {"data", *reinterpret_cast<double*>(entry.mData)}
-            };
-            break;
-        case AI_AISTRING:
-            j = json {
-                {"type", "string"},
-                {"data", *reinterpret_cast<aiString*>(entry.mData)}
-            };
-            break;
-        case AI_AIVECTOR3D:
-            j = json {
-                {"type", "vec3"},
-                {"data", *reinterpret_cast<aiVector3D*>(entry.mData)}
-            };
-            break;
-        default:
-            break;
-    };
-}
+            if (cache.fetch(cache_key, destinations))
+            {
+                if (cache_stats)
+                {
+                    print_cache_stats(cache.stats(), true);
+                }
+                return 0;
+            }
 
-void to_json(json& j, const aiMetadata* pMetaData)
-{
-    unsigned int num_properties = pMetaData->mNumProperties;
-
-    std::vector<aiString> keys(num_properties);
-    std::vector<aiMetadataEntry> values(num_properties);
-
-    std::memcpy(keys.data(), pMetaData->mKeys, sizeof(aiString) * num_properties);
-    std::memcpy(values.data(), pMetaData->mValues, sizeof(aiMetadataEntry) * num_properties);
-    
-    j = json {
-        {"num_properties", num_properties},
-        {"keys", keys},
-        {"values", values}
-    };
-}
+            // Convert into the cache, then hand the entry out like a hit.
+            output_name = cache.temp_path();
+            if (!index_name.empty())
+            {
+                index_name = cache.temp_path();
+            }
+            convert.record_inputs = true;
+        }
 
-void to_json(json& j, const aiNode* pNode)
-{
-    unsigned int num_children = pNode->mNumChildren;
-    unsigned int num_meshes = pNode->mNumMeshes;
+        // A regular file is written aside and renamed into place once the
+        // conversion succeeds, so a failed reconvert keeps the last good one.
+        std::string write_name = output_name;
+        struct stat existing;
+        int fd = -1;
+        if (cache_dir.empty() && output_name != "-"
+                && (::stat(output_name.c_str(), &existing) != 0 || S_ISREG(existing.st_mode)))
+        {
+            fd = open_replacement(output_name, write_name, error);
+        }
+        else
+        {
+            fd = open_output(write_name, error);
+        }
+        if (fd < 0)
+        {
+            std::cerr << "Failed to open file: " << write_name << ": " << error << std::endl;
+            return 2;
+        }
 
-    std::vector<aiNode*> children(num_children);
-    std::vector<unsigned int> meshes(num_meshes);
+        // The scene is written into the output as it is serialized, so open
+        // the whole stream chain before converting.
+        FdOutputBuffer buffer(fd, fd != STDOUT_FILENO, FdOutputBuffer::kDefaultCapacity, write_buffers);
+        std::unique_ptr<CompressingOutputBuffer> compressor;
+        if (compression.codec != Codec::None)
+        {
+            compressor.reset(new CompressingOutputBuffer(&buffer, compression));
+        }
+        std::ostream output(compressor ? static_cast<std::streambuf*>(compressor.get()) : &buffer);
 
-    std::memcpy(children.data(), pNode->mChildren, sizeof(aiNode*) * num_children);
-    std::memcpy(meshes.data(), pNode->mMeshes, sizeof(unsigned int) * num_meshes);
+        ConvertResult result;
+        bool converted = false;
+        {
+            TraceSpan span("Convert");
+            converted = filename == "-"
+                ? convert_memory(bytes.data(), bytes.size(), hint, convert, format, output, result)
+                : convert_file(filename, convert, format, output, result);
+        }
 
-    j = json {
-        {"children", children},
-        {"meshes", meshes},
-        {"name", pNode->mName},
-        {"num_children", num_children},
-        {"num_meshes", num_meshes},
-        {"transformation", pNode->mTransformation}
-    };
+        auto write_start = std::chrono::steady_clock::now();
 
-    if (pNode->mParent)
-    {
-        j["parent"] = pNode->mParent->mName;
-    }
+        bool written = false;
+        {
+            TraceSpan span("Write");
+            written = !compressor || compressor->finish();
+            written = buffer.close() && written;
+        }
 
-    if (pNode->mMetaData)
-    {
-        j["meta_data"] = pNode->mMetaData;
-    }
-}
+        if (!converted)
+        {
+            if (fd != STDOUT_FILENO)
+            {
+                std::remove(write_name.c_str());
+            }
+            std::cerr << "Error: Something went wrong importing scene" << std::endl;
+            std::cerr << result.error << std::endl;
+            return 1;
+        }
 
-void to_json(json& j, const aiScene* pScene)
-{
-    j["flags"] = pScene->mFlags;
+        for (const StepTiming& timing : result.timings)
+        {
+            std::cerr << timing.name << ": " << timing.seconds * 1000.0 << " ms" << std::endl;
+        }
 
-    j["num_meshes"] = pScene->mNumMeshes;
-    for (unsigned int i = 0; i < pScene->mNumMeshes; ++i)
-    {
-        j["meshes"].push_back(pScene->mMeshes[i]);
-    }
+        if (convert.timings && fragments)
+        {
+            std::cerr << "Fragments: " << fragments->hits() << " hits, " << fragments->misses() << " misses" << std::endl;
+        }
 
-    j["num_materials"] = pScene->mNumMaterials;
-    for (unsigned int i = 0; i < pScene->mNumMaterials; ++i)
-    {
-        j["materials"].push_back(pScene->mMaterials[i]);
-    }
+        if (result.reduced_keys)
+        {
+            const KeyframeStats& stats = result.key_stats;
+            std::cerr << "Position keys: " << stats.position_before << " -> " << stats.position_after << std::endl;
+            std::cerr << "Rotation keys: " << stats.rotation_before << " -> " << stats.rotation_after << std::endl;
+            std::cerr << "Scaling keys: " << stats.scaling_before << " -> " << stats.scaling_after << std::endl;
+        }
 
-    j["num_textures"] = pScene->mNumTextures;
-    for (unsigned int i = 0; i < pScene->mNumTextures; ++i)
-    {
-        j["textures"].push_back(pScene->mTextures[i]);
-    }
+        // The index is written aside as well and renamed into place just
+        // before the output, so a failure writing either keeps the old pair.
+        if (written && !index_name.empty())
+        {
+            std::string index_write_name = index_name;
+            int index_fd = cache_dir.empty()
+                ? open_replacement(index_name, index_write_name, error)
+                : open_output(index_name, error);
+            bool index_written = index_fd >= 0;
+            if (index_written)
+            {
+                {
+                    FdOutputBuffer index_buffer(index_fd, true, FdOutputBuffer::kDefaultCapacity, 1);
+                    std::ostream index(&index_buffer);
+                    index << std::setw(4) << record_index(result.records, format) << std::endl;
+                    index_written = static_cast<bool>(index);
+                    index_written = index_buffer.close() && index_written;
+                }
+                if (!index_written || (index_write_name != index_name
+                        && !replace_output(index_write_name, index_name, error)))
+                {
+                    std::remove(index_write_name.c_str());
+                    index_written = false;
+                }
+            }
 
-    j["num_lights"] = pScene->mNumLights;
-    for (unsigned int i = 0; i < pScene->mNumLights; ++i)
-    {
-        j["lights"].push_back(pScene->mLights[i]);
-    }
+            if (!index_written)
+            {
+                if (fd != STDOUT_FILENO && write_name != output_name)
+                {
+                    std::remove(write_name.c_str());
+                }
+                std::cerr << "Failed to write file: " << index_name << std::endl;
+                return 2;
+            }
+        }
 
-    j["num_cameras"] = pScene->mNumCameras;
-    for (unsigned int i = 0; i < pScene->mNumCameras; ++i)
-    {
-        j["cameras"].push_back(pScene->mCameras[i]);
-    }
+        if (!written || (write_name != output_name && !replace_output(write_name, output_name, error)))
+        {
+            if (fd != STDOUT_FILENO)
+            {
+                std::remove(write_name.c_str());
+            }
+            std::cerr << "Failed to write file: " << output_name << std::endl;
+            return 2;
+        }
 
-    j["num_animations"] = pScene->mNumAnimations;
-    for (unsigned int i = 0; i < pScene->mNumAnimations; ++i)
-    {
-        j["animations"].push_back(pScene->mAnimations[i]);
-    }
+        if (!delta_name.empty() && !save_hashes(delta_name, result.record_hashes))
+        {
+            std::cerr << "Failed to write file: " << delta_name << std::endl;
+            return 2;
+        }
 
-    j["root"] = pScene->mRootNode;
-}
+        if (!cache_dir.empty())
+        {
+            CacheArtifacts sources { { "output", output_name } };
+            if (!index_name.empty())
+            {
+                sources.push_back({ "index", index_name });
+            }
 
-int main(int argc, char* argv[])
-{
-    if (argc == 2) 
-    {
-        const std::string filename = argv[1];
+            std::vector<std::string> dependencies;
+            for (const std::string& input : result.input_files)
+            {
+                if (input != filename)
+                {
+                    dependencies.push_back(input);
+                }
+            }
 
-        Assimp::Importer importer;
-        const aiScene* pScene = importer.ReadFile(filename,
-                aiProcess_Triangulate |
-                aiProcess_JoinIdenticalVertices | 
-                aiProcess_SortByPType);
+            if (!cache.store(cache_key, sources, dependencies, result.absent_files, error)
+                    || !cache.place(cache_key, destinations))
+            {
+                std::cerr << "Failed to store the result in the cache: " << error << std::endl;
+                return 2;
+            }
 
-        if (!pScene)
-        {
-            std::cout << "Error: Something went wrong importing scene" << std::endl;
-            std::cout << importer.GetErrorString() << std::endl;
-            return 1;
+            if (cache_stats)
+            {
+                print_cache_stats(cache.stats(), false);
+            }
         }
 
-        json j = pScene;
-
-        std::string output_name = "test.json";
-        std::ofstream output(output_name, std::ios::out | std::ios::trunc);
-        if (output.bad())
+        if (convert.timings)
         {
-            std::cout << "Failed to open file: " << filename << std::endl;
-            return 2;
+            // Whatever the writer and compressor had not drained by the time
+            // serialization finished.
+            double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - write_start).count();
+            std::cerr << "Write: " << seconds * 1000.0 << " ms" << std::endl;
         }
-        output << std::setw(4) << j << std::endl;
 
         return 0;
     }
 
-    std::cout << "Error: Just give me one model filepath" << std::endl;
+    std::cerr << "Error: Just give me one model filepath" << std::endl;
+    print_usage();
     return 1;
 }
@@ -0,0 +1,159 @@
+#include "mesh.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+namespace
+{
+
+bool moved(const aiVector3D* pBase, const aiVector3D* pTarget, unsigned int i, float epsilon)
+{
+    if (!pBase || !pTarget)
+    {
+        return false;
+    }
+
+    aiVector3D delta = pTarget[i] - pBase[i];
+    return std::abs(delta.x) > epsilon || std::abs(delta.y) > epsilon || std::abs(delta.z) > epsilon;
+}
+
+void append_delta(std::vector<float>& deltas, const aiVector3D* pBase, const aiVector3D* pTarget, unsigned int i)
+{
+    aiVector3D delta = pTarget[i] - pBase[i];
+    deltas.insert(deltas.end(), { delta.x, delta.y, delta.z });
+}
+
+}
+
+const char* index_type(unsigned int max_index)
+{
+    if (max_index <= 0xff)
+    {
+        return "uint8";
+    }
+    if (max_index <= 0xffff)
+    {
+        return "uint16";
+    }
+    return "uint32";
+}
+
+nlohmann::json flat_indices(const aiMesh* pMesh)
+{
+    static const char* const names[] = { "points", "lines", "triangles", "polygons" };
+
+    std::vector<unsigned int> indices[4];
+    std::vector<unsigned int> polygon_sizes;
+    unsigned int max_index[4] = { 0, 0, 0, 0 };
+
+    for (unsigned int i = 0; i < pMesh->mNumFaces; ++i)
+    {
+        const aiFace& face = pMesh->mFaces[i];
+        if (face.mNumIndices == 0)
+        {
+            continue;
+        }
+
+        unsigned int type = std::min(face.mNumIndices, 4u) - 1;
+        if (type == 3)
+        {
+            polygon_sizes.push_back(face.mNumIndices);
+        }
+
+        indices[type].insert(indices[type].end(), face.mIndices, face.mIndices + face.mNumIndices);
+        max_index[type] = std::max(max_index[type], *std::max_element(face.mIndices, face.mIndices + face.mNumIndices));
+    }
+
+    nlohmann::json j = nlohmann::json::object();
+    for (unsigned int type = 0; type < 4; ++type)
+    {
+        if (indices[type].empty())
+        {
+            continue;
+        }
+
+        j[names[type]] = {
+            {"index_type", index_type(max_index[type])},
+            {"num_indices", indices[type].size()},
+            {"indices", indices[type]}
+        };
+    }
+
+    if (!polygon_sizes.empty())
+    {
+        j["polygons"]["sizes"] = polygon_sizes;
+    }
+
+    return j;
+}
+
+nlohmann::json morph_targets(const aiMesh* pMesh, float epsilon)
+{
+    nlohmann::json targets = nlohmann::json::array();
+
+    for (unsigned int t = 0; t < pMesh->mNumAnimMeshes; ++t)
+    {
+        const aiAnimMesh* pTarget = pMesh->mAnimMeshes[t];
+
+        // Assimp stores morph targets as replacement streams, so a stream only
+        // has deltas when both the base and the target carry it.
+        const aiVector3D* pPositions = pTarget->HasPositions() && pMesh->HasPositions() ? pTarget->mVertices : nullptr;
+        const aiVector3D* pNormals = pTarget->HasNormals() && pMesh->HasNormals() ? pTarget->mNormals : nullptr;
+        const aiVector3D* pTangents = pTarget->HasTangentsAndBitangents() && pMesh->HasTangentsAndBitangents() ? pTarget->mTangents : nullptr;
+
+        std::vector<unsigned int> indices;
+        std::vector<float> positions;
+        std::vector<float> normals;
+        std::vector<float> tangents;
+
+        unsigned int count = std::min(pTarget->mNumVertices, pMesh->mNumVertices);
+        for (unsigned int i = 0; i < count; ++i)
+        {
+            if (!moved(pMesh->mVertices, pPositions, i, epsilon) &&
+                !moved(pMesh->mNormals, pNormals, i, epsilon) &&
+                !moved(pMesh->mTangents, pTangents, i, epsilon))
+            {
+                continue;
+            }
+
+            indices.push_back(i);
+            if (pPositions)
+            {
+                append_delta(positions, pMesh->mVertices, pPositions, i);
+            }
+            if (pNormals)
+            {
+                append_delta(normals, pMesh->mNormals, pNormals, i);
+            }
+            if (pTangents)
+            {
+                append_delta(tangents, pMesh->mTangents, pTangents, i);
+            }
+        }
+
+        nlohmann::json target = {
+            {"name", pTarget->mName.C_Str()},
+            {"weight", pTarget->mWeight},
+            {"num_indices", indices.size()},
+            {"indices", indices}
+        };
+
+        if (pPositions)
+        {
+            target["positions"] = positions;
+        }
+        if (pNormals)
+        {
+            target["normals"] = normals;
+        }
+        if (pTangents)
+        {
+            target["tangents"] = tangents;
+        }
+
+        targets.push_back(target);
+    }
+
+    return targets;
+}
@@ -0,0 +1,20 @@
+#pragma once
+
+#include <assimp/scene.h>
+
+#include <json/json.hpp>
+
+// Name of the narrowest unsigned integer type ("uint8", "uint16" or "uint32")
+// that can hold every index up to max_index.
+const char* index_type(unsigned int max_index);
+
+// The mesh's faces as one flat index array per primitive type ("points",
+// "lines", "triangles" and "polygons"), each with its narrowest index type.
+// Polygons also list the number of indices of every face in "sizes".
+nlohmann::json flat_indices(const aiMesh* pMesh);
+
+// The mesh's aiAnimMesh morph targets as sparse deltas against the base mesh.
+// Each target lists the vertices whose position, normal or tangent moved by
+// more than epsilon in any component, followed by flat xyz delta streams for
+// just those vertices.
+nlohmann::json morph_targets(const aiMesh* pMesh, float epsilon);
@@ -0,0 +1,235 @@
+#include "metrics.hpp"
+
+#include <sys/resource.h>
+
+#include <cmath>
+
+namespace
+{
+
+const char* const kFormatNames[] = { "json", "cbor", "msgpack", "ndjson" };
+const char* const kPhaseNames[] = { "import", "post_process", "serialize", "write" };
+
+// Bucket bounds written out: 2^7 us (0.128 ms) to 2^35 us (about 9.5 hours).
+// Prometheus wants the same bounds on every scrape, so they are fixed.
+const int kFirstBound = 7;
+const int kLastBound = 35;
+
+// Recording keeps eight buckets per octave, but writing them all would
+// make every histogram a few hundred series. Only 2^k and 1.5 * 2^k are
+// written. Both are limits of recorded buckets, so their counts are still
+// exact.
+bool exported_bound(std::uint64_t bound)
+{
+    const std::uint64_t base = bound % 3 == 0 ? bound / 3 : bound;
+    return (base & (base - 1)) == 0;
+}
+
+std::string label(const char* name, const std::string& value)
+{
+    return std::string(name) + "=\"" + value + "\"";
+}
+
+std::string join_labels(const std::string& a, const std::string& b)
+{
+    return a.empty() ? b : b.empty() ? a : a + "," + b;
+}
+
+void write_help(std::ostream& output, const char* name, const char* type, const char* help)
+{
+    output << "# HELP " << name << " " << help << "\n";
+    output << "# TYPE " << name << " " << type << "\n";
+}
+
+}
+
+Histogram::Histogram()
+    : mMicroseconds(0)
+{
+    for (std::atomic<std::uint64_t>& count : mCounts)
+    {
+        count.store(0, std::memory_order_relaxed);
+    }
+}
+
+int Histogram::bucket(std::uint64_t microseconds)
+{
+    // Below kSubBuckets a bucket per value; above, the octave from the
+    // leading bit and the linear step within it from the kSubBits after it.
+    // One less than the value, so a bucket ends on its limit, not before.
+    const std::uint64_t value = microseconds == 0 ? 0 : microseconds - 1;
+    if (value < kSubBuckets)
+    {
+        return static_cast<int>(value);
+    }
+    const int octave = 63 - __builtin_clzll(value);
+    const int step = static_cast<int>(value >> (octave - kSubBits)) - kSubBuckets;
+    return kSubBuckets + (octave - kSubBits) * kSubBuckets + step;
+}
+
+std::uint64_t Histogram::limit(int bucket)
+{
+    if (bucket < kSubBuckets)
+    {
+        return bucket + 1;
+    }
+    const int octave = kSubBits + (bucket - kSubBuckets) / kSubBuckets;
+    const int step = (bucket - kSubBuckets) % kSubBuckets;
+    return std::uint64_t(kSubBuckets + step + 1) << (octave - kSubBits);
+}
+
+void Histogram::record(double seconds)
+{
+    const std::uint64_t microseconds = seconds > 0.0 ? static_cast<std::uint64_t>(std::llround(seconds * 1e6)) : 0;
+    mCounts[bucket(microseconds)].fetch_add(1, std::memory_order_relaxed);
+    mMicroseconds.fetch_add(microseconds, std::memory_order_relaxed);
+}
+
+void Histogram::write(std::ostream& output, const std::string& name, const std::string& labels) const
+{
+    const std::uint64_t first = std::uint64_t(1) << kFirstBound;
+    const std::uint64_t last = std::uint64_t(1) << kLastBound;
+
+    std::uint64_t cumulative = 0;
+    for (int bucket = 0; bucket < kBuckets; ++bucket)
+    {
+        cumulative += mCounts[bucket].load(std::memory_order_relaxed);
+
+        const std::uint64_t bound = limit(bucket);
+        if (bound >= first && bound <= last && exported_bound(bound))
+        {
+            output << name << "_bucket{" << join_labels(labels, label("le", std::to_string(bound * 1e-6)))
+                   << "} " << cumulative << "\n";
+        }
+    }
+
+    const std::string braced = labels.empty() ? std::string() : "{" + labels + "}";
+    output << name << "_bucket{" << join_labels(labels, label("le", "+Inf")) << "} " << cumulative << "\n";
+    output << name << "_sum" << braced << " " << mMicroseconds.load(std::memory_order_relaxed) / 1e6 << "\n";
+    output << name << "_count" << braced << " " << cumulative << "\n";
+}
+
+ServerMetrics::ServerMetrics()
+{
+    for (int f = 0; f < kFormats; ++f)
+    {
+        mRequests[f][0].store(0, std::memory_order_relaxed);
+        mRequests[f][1].store(0, std::memory_order_relaxed);
+        mBytesIn[f].store(0, std::memory_order_relaxed);
+        mBytesOut[f].store(0, std::memory_order_relaxed);
+    }
+}
+
+void ServerMetrics::record(OutputFormat format, bool ok, bool cached, std::uint64_t bytes_in, std::uint64_t bytes_out,
+        double queue_seconds, double service_seconds, const PhaseTimes& phases)
+{
+    const int f = static_cast<int>(format);
+    mRequests[f][ok ? 1 : 0].fetch_add(1, std::memory_order_relaxed);
+    mBytesIn[f].fetch_add(bytes_in, std::memory_order_relaxed);
+    mBytesOut[f].fetch_add(bytes_out, std::memory_order_relaxed);
+
+    mQueueWait[f].record(queue_seconds);
+    mService[f].record(service_seconds);
+
+    if (!cached && ok)
+    {
+        mPhases[f][0].record(phases.import);
+        mPhases[f][1].record(phases.post_process);
+        mPhases[f][2].record(phases.serialize);
+        mPhases[f][3].record(phases.write);
+    }
+}
+
+void ServerMetrics::write(std::ostream& output, const ServerGauges& gauges) const
+{
+    write_help(output, "atj_requests_total", "counter", "Conversion requests answered.");
+    for (int f = 0; f < kFormats; ++f)
+    {
+        for (int ok = 0; ok < 2; ++ok)
+        {
+            output << "atj_requests_total{" << label("format", kFormatNames[f]) << ","
+                   << label("status", ok ? "ok" : "error") << "} "
+                   << mRequests[f][ok].load(std::memory_order_relaxed) << "\n";
+        }
+    }
+
+    write_help(output, "atj_input_bytes_total", "counter", "Model bytes converted.");
+    for (int f = 0; f < kFormats; ++f)
+    {
+        output << "atj_input_bytes_total{" << label("format", kFormatNames[f]) << "} "
+               << mBytesIn[f].load(std::memory_order_relaxed) << "\n";
+    }
+
+    write_help(output, "atj_output_bytes_total", "counter", "Converted bytes returned or written.");
+    for (int f = 0; f < kFormats; ++f)
+    {
+        output << "atj_output_bytes_total{" << label("format", kFormatNames[f]) << "} "
+               << mBytesOut[f].load(std::memory_order_relaxed) << "\n";
+    }
+
+    write_help(output, "atj_queue_wait_seconds", "histogram", "Time requests waited for a worker.");
+    for (int f = 0; f < kFormats; ++f)
+    {
+        mQueueWait[f].write(output, "atj_queue_wait_seconds", label("format", kFormatNames[f]));
+    }
+
+    write_help(output, "atj_service_seconds", "histogram", "Time converting a request or answering it from the cache.");
+    for (int f = 0; f < kFormats; ++f)
+    {
+        mService[f].write(output, "atj_service_seconds", label("format", kFormatNames[f]));
+    }
+
+    write_help(output, "atj_phase_seconds", "histogram", "Time spent in each phase of a conversion.");
+    for (int f = 0; f < kFormats; ++f)
+    {
+        for (int p = 0; p < 4; ++p)
+        {
+            mPhases[f][p].write(output, "atj_phase_seconds",
+                    label("format", kFormatNames[f]) + "," + label("phase", kPhaseNames[p]));
+        }
+    }
+
+    write_help(output, "atj_queue_depth", "gauge", "Requests waiting for a worker.");
+    output << "atj_queue_depth " << gauges.queue_depth << "\n";
+    write_help(output, "atj_workers", "gauge", "Conversion threads.");
+    output << "atj_workers " << gauges.workers << "\n";
+    write_help(output, "atj_busy_workers", "gauge", "Conversion threads converting.");
+    output << "atj_busy_workers " << gauges.busy_workers << "\n";
+    write_help(output, "atj_connections", "gauge", "Open client connections.");
+    output << "atj_connections " << gauges.connections << "\n";
+
+    if (gauges.caching)
+    {
+        const CacheStats& cache = gauges.cache;
+        write_help(output, "atj_cache_lookups_total", "counter", "Memory cache lookups by result.");
+        output << "atj_cache_lookups_total{result=\"hit\"} " << cache.hits << "\n";
+        output << "atj_cache_lookups_total{result=\"coalesced\"} " << cache.coalesced << "\n";
+        output << "atj_cache_lookups_total{result=\"miss\"} " << cache.misses << "\n";
+
+        // Coalesced lookups count as hits: they did not convert.
+        const std::uint64_t lookups = cache.hits + cache.coalesced + cache.misses;
+        write_help(output, "atj_cache_hit_ratio", "gauge", "Share of memory cache lookups that did not convert.");
+        output << "atj_cache_hit_ratio " << (lookups == 0 ? 0.0 : double(cache.hits + cache.coalesced) / lookups)
+               << "\n";
+        write_help(output, "atj_cache_entries", "gauge", "Results in the memory cache.");
+        output << "atj_cache_entries " << cache.entries << "\n";
+        write_help(output, "atj_cache_bytes", "gauge", "Bytes held by the memory cache.");
+        output << "atj_cache_bytes " << cache.bytes << "\n";
+    }
+
+    write_help(output, "atj_peak_memory_bytes", "gauge", "Peak resident set size of the server.");
+    output << "atj_peak_memory_bytes " << peak_memory_bytes() << "\n";
+}
+
+std::uint64_t peak_memory_bytes()
+{
+    rusage usage = {};
+    ::getrusage(RUSAGE_SELF, &usage);
+
+    // Kilobytes on Linux, bytes on macOS.
+#ifdef __APPLE__
+    return usage.ru_maxrss;
+#else
+    return std::uint64_t(usage.ru_maxrss) * 1024;
+#endif
+}
@@ -0,0 +1,86 @@
+#pragma once
+
+#include "cache.hpp"
+#include "converter.hpp"
+
+#include <atomic>
+#include <cstdint>
+#include <ostream>
+#include <string>
+
+// Latency histogram in the spirit of HDR histograms: fixed memory, each
+// power of two microseconds split into kSubBuckets linear buckets (so a
+// bucket is at most an eighth of its value wide), and recording is a count
+// of leading zeros, a shift and relaxed atomic adds, cheap enough for every
+// request on every thread. Only two bounds per octave are exported.
+class Histogram
+{
+public:
+    Histogram();
+
+    void record(double seconds);
+
+    // Writes name_bucket, name_sum and name_count in the Prometheus text
+    // format. labels is empty or a comma separated list such as
+    // phase="import".
+    void write(std::ostream& output, const std::string& name, const std::string& labels) const;
+
+private:
+    static const int kSubBits = 3;
+    static const int kSubBuckets = 1 << kSubBits;
+    static const int kBuckets = kSubBuckets + (64 - kSubBits) * kSubBuckets;
+
+    // The bucket a value of microseconds falls in, and the largest value the
+    // bucket holds: bucket i holds (limit(i - 1), limit(i)], as Prometheus's
+    // le bounds do.
+    static int bucket(std::uint64_t microseconds);
+    static std::uint64_t limit(int bucket);
+
+    std::atomic<std::uint64_t> mCounts[kBuckets];
+    std::atomic<std::uint64_t> mMicroseconds;
+};
+
+// Values read when the metrics are scraped rather than counted as they
+// happen.
+struct ServerGauges
+{
+    std::uint64_t queue_depth = 0;
+    unsigned int workers = 0;
+    unsigned int busy_workers = 0;
+    unsigned int connections = 0;
+
+    bool caching = false;
+    CacheStats cache;
+};
+
+// What atj serve counts: requests, bytes, queue wait, service time and
+// conversion phases, by output format. Thread safe and lock free.
+class ServerMetrics
+{
+public:
+    ServerMetrics();
+
+    // A finished request. cached is set for answers from the memory cache,
+    // which have no phases.
+    void record(OutputFormat format, bool ok, bool cached, std::uint64_t bytes_in, std::uint64_t bytes_out,
+            double queue_seconds, double service_seconds, const PhaseTimes& phases);
+
+    // Everything, with the gauges, in the Prometheus text format.
+    void write(std::ostream& output, const ServerGauges& gauges) const;
+
+private:
+    static const int kFormats = 4;
+
+    std::atomic<std::uint64_t> mRequests[kFormats][2];
+    std::atomic<std::uint64_t> mBytesIn[kFormats];
+    std::atomic<std::uint64_t> mBytesOut[kFormats];
+
+    Histogram mQueueWait[kFormats];
+    Histogram mService[kFormats];
+
+    // Import, post-process, serialize and write.
+    Histogram mPhases[kFormats][4];
+};
+
+// Resident set size high-water mark of the process.
+std::uint64_t peak_memory_bytes();
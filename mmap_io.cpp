@@ -0,0 +1,231 @@
+#include "mmap_io.hpp"
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <csetjmp>
+#include <csignal>
+#include <cstring>
+#include <mutex>
+
+namespace
+{
+
+// Where the copy running on this thread resumes when the mapping it reads
+// from loses its pages; null outside copy_mapped.
+thread_local sigjmp_buf* tpRecover = nullptr;
+
+struct sigaction gPreviousBus;
+std::once_flag gBusHandlerInstalled;
+
+void on_sigbus(int signal, siginfo_t* pInfo, void* pContext)
+{
+    if (tpRecover)
+    {
+        siglongjmp(*tpRecover, 1);
+    }
+
+    // Not a mapped read: behave as if this handler were never installed.
+    if (gPreviousBus.sa_flags & SA_SIGINFO)
+    {
+        gPreviousBus.sa_sigaction(signal, pInfo, pContext);
+    }
+    else if (gPreviousBus.sa_handler == SIG_DFL)
+    {
+        // The faulting access runs again on return and takes the default.
+        ::signal(SIGBUS, SIG_DFL);
+    }
+    else if (gPreviousBus.sa_handler != SIG_IGN)
+    {
+        gPreviousBus.sa_handler(signal);
+    }
+}
+
+void install_bus_handler()
+{
+    struct sigaction action = {};
+    action.sa_sigaction = on_sigbus;
+    action.sa_flags = SA_SIGINFO;
+    sigemptyset(&action.sa_mask);
+    ::sigaction(SIGBUS, &action, &gPreviousBus);
+}
+
+// Copies from a mapping, false if part of it is beyond the end of a file
+// truncated since it was mapped.
+bool copy_mapped(void* pTo, const void* pFrom, std::size_t size)
+{
+    sigjmp_buf recover;
+    if (sigsetjmp(recover, 1) != 0)
+    {
+        tpRecover = nullptr;
+        return false;
+    }
+
+    tpRecover = &recover;
+    std::memcpy(pTo, pFrom, size);
+    tpRecover = nullptr;
+    return true;
+}
+
+}
+
+MappedIOStream::MappedIOStream(void* pData, std::size_t size)
+    : mData(pData), mSize(size), mPosition(0)
+{
+}
+
+MappedIOStream::~MappedIOStream()
+{
+    if (mData)
+    {
+        munmap(mData, mSize);
+    }
+}
+
+std::size_t MappedIOStream::Read(void* pvBuffer, std::size_t pSize, std::size_t pCount)
+{
+    if (pSize == 0)
+    {
+        return 0;
+    }
+
+    std::size_t count = std::min(pCount, (mSize - mPosition) / pSize);
+    if (!copy_mapped(pvBuffer, static_cast<const char*>(mData) + mPosition, count * pSize))
+    {
+        // The file shrank under the mapping; what is left reads as its end.
+        mPosition = mSize;
+        return 0;
+    }
+    mPosition += count * pSize;
+
+    return count;
+}
+
+std::size_t MappedIOStream::Write(const void*, std::size_t, std::size_t)
+{
+    return 0;
+}
+
+aiReturn MappedIOStream::Seek(std::size_t pOffset, aiOrigin pOrigin)
+{
+    std::size_t base = 0;
+    switch (pOrigin)
+    {
+        case aiOrigin_SET:
+            base = 0;
+            break;
+        case aiOrigin_CUR:
+            base = mPosition;
+            break;
+        case aiOrigin_END:
+            base = mSize;
+            break;
+        default:
+            return AI_FAILURE;
+    };
+
+    // Assimp seeks backwards from the end by passing a wrapped-around offset.
+    std::size_t position = base + pOffset;
+    if (position > mSize)
+    {
+        return AI_FAILURE;
+    }
+
+    mPosition = position;
+    return AI_SUCCESS;
+}
+
+std::size_t MappedIOStream::Tell() const
+{
+    return mPosition;
+}
+
+std::size_t MappedIOStream::FileSize() const
+{
+    return mSize;
+}
+
+void MappedIOStream::Flush()
+{
+}
+
+MappedIOSystem::MappedIOSystem()
+{
+    std::call_once(gBusHandlerInstalled, install_bus_handler);
+}
+
+bool MappedIOSystem::Exists(const char* pFile) const
+{
+    struct stat info;
+    return stat(pFile, &info) == 0;
+}
+
+char MappedIOSystem::getOsSeparator() const
+{
+    return '/';
+}
+
+Assimp::IOStream* MappedIOSystem::Open(const char* pFile, const char* pMode)
+{
+    if (std::strchr(pMode, 'w') || std::strchr(pMode, 'a') || std::strchr(pMode, '+'))
+    {
+        return mFallback.Open(pFile, pMode);
+    }
+
+    // Only regular files can be mapped. Anything else, such as a FIFO or
+    // /dev/stdin, is read by the default IOSystem; checked before opening
+    // so a FIFO is not opened twice.
+    struct stat info;
+    if (stat(pFile, &info) != 0)
+    {
+        return nullptr;
+    }
+    if (!S_ISREG(info.st_mode))
+    {
+        return mFallback.Open(pFile, pMode);
+    }
+
+    int fd = open(pFile, O_RDONLY);
+    if (fd < 0)
+    {
+        return nullptr;
+    }
+
+    // Replaced by something else since the stat.
+    if (fstat(fd, &info) != 0 || !S_ISREG(info.st_mode))
+    {
+        close(fd);
+        return mFallback.Open(pFile, pMode);
+    }
+
+    std::size_t size = static_cast<std::size_t>(info.st_size);
+    void* pData = nullptr;
+    if (size > 0)
+    {
+        pData = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (pData == MAP_FAILED)
+        {
+            close(fd);
+            return mFallback.Open(pFile, pMode);
+        }
+        madvise(pData, size, MADV_SEQUENTIAL);
+    }
+
+    // The mapping keeps the file alive on its own.
+    close(fd);
+    return new MappedIOStream(pData, size);
+}
+
+void MappedIOSystem::Close(Assimp::IOStream* pFile)
+{
+    if (dynamic_cast<MappedIOStream*>(pFile))
+    {
+        delete pFile;
+        return;
+    }
+
+    mFallback.Close(pFile);
+}
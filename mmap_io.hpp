@@ -0,0 +1,48 @@
+#pragma once
+
+#include <assimp/DefaultIOSystem.h>
+#include <assimp/IOStream.hpp>
+#include <assimp/IOSystem.hpp>
+
+#include <cstddef>
+
+// Read-only stream over a file mapped into memory. If the file is truncated
+// while mapped, reads past its new end stop as if at the end of the file
+// instead of killing the process with SIGBUS.
+class MappedIOStream : public Assimp::IOStream
+{
+public:
+    MappedIOStream(void* pData, std::size_t size);
+    ~MappedIOStream() override;
+
+    std::size_t Read(void* pvBuffer, std::size_t pSize, std::size_t pCount) override;
+    std::size_t Write(const void* pvBuffer, std::size_t pSize, std::size_t pCount) override;
+    aiReturn Seek(std::size_t pOffset, aiOrigin pOrigin) override;
+    std::size_t Tell() const override;
+    std::size_t FileSize() const override;
+    void Flush() override;
+
+private:
+    void* mData;
+    std::size_t mSize;
+    std::size_t mPosition;
+};
+
+// Serves every file Assimp reads, including the ones a model references such
+// as MTL libraries or external buffers, from mmap'ed memory instead of
+// buffered fread copies. Files opened for writing go to the default system.
+// The first one created installs the SIGBUS handler the streams recover
+// with; a SIGBUS raised anywhere else goes on to the handler before it.
+class MappedIOSystem : public Assimp::IOSystem
+{
+public:
+    MappedIOSystem();
+
+    bool Exists(const char* pFile) const override;
+    char getOsSeparator() const override;
+    Assimp::IOStream* Open(const char* pFile, const char* pMode = "rb") override;
+    void Close(Assimp::IOStream* pFile) override;
+
+private:
+    Assimp::DefaultIOSystem mFallback;
+};
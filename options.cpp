@@ -0,0 +1,202 @@
+#include "options.hpp"
+
+#include <cmath>
+#include <cstdlib>
+
+namespace
+{
+
+bool parse_tolerance(const std::string& value, KeyframeTolerance& tolerance)
+{
+    const std::string::size_type first = value.find(',');
+    const std::string::size_type second = first == std::string::npos ? first : value.find(',', first + 1);
+    if (second == std::string::npos)
+    {
+        return false;
+    }
+
+    return parse_number(value.substr(0, first), tolerance.translation) && tolerance.translation >= 0.0
+        && parse_number(value.substr(first + 1, second - first - 1), tolerance.rotation) && tolerance.rotation >= 0.0
+        && parse_number(value.substr(second + 1), tolerance.scale) && tolerance.scale >= 0.0;
+}
+
+OptionResult invalid(const std::string& message, std::string& error)
+{
+    error = message;
+    return OptionResult::Invalid;
+}
+
+}
+
+bool parse_integer(const std::string& value, long& integer)
+{
+    char* pEnd = nullptr;
+    integer = std::strtol(value.c_str(), &pEnd, 10);
+    return !value.empty() && *pEnd == '\0';
+}
+
+bool parse_number(const std::string& value, double& number)
+{
+    char* pEnd = nullptr;
+    number = std::strtod(value.c_str(), &pEnd);
+    return !value.empty() && *pEnd == '\0' && std::isfinite(number);
+}
+
+OptionResult apply_option(const std::string& name, const std::string& value, ConvertSettings& settings,
+        std::string& error)
+{
+    ConvertOptions& convert = settings.convert;
+    ExportOptions& options = convert.export_options;
+
+    if (name == "--compress")
+    {
+        if (!parse_compression(value, settings.compression, error))
+        {
+            return OptionResult::Invalid;
+        }
+    }
+    else if (name == "--hint")
+    {
+        settings.hint = value;
+    }
+    else if (name == "--preset")
+    {
+        if (!preset_flags(value, convert.flags))
+        {
+            return invalid("Unknown preset: " + value, error);
+        }
+    }
+    else if (name == "--process")
+    {
+        if (!settings.explicit_steps)
+        {
+            convert.flags = 0;
+            settings.explicit_steps = true;
+        }
+        if (!parse_post_process_steps(value, convert.flags))
+        {
+            return invalid("Unknown post-process step in: " + value, error);
+        }
+    }
+    else if (name == "--property")
+    {
+        if (!check_importer_property(value))
+        {
+            return invalid("Unknown property or bad value: " + value, error);
+        }
+        convert.properties.push_back(value);
+    }
+    else if (name == "--no-mmap")
+    {
+        convert.mmap_input = false;
+    }
+    else if (name == "--timings")
+    {
+        convert.timings = true;
+    }
+    else if (name == "--reduce-keys")
+    {
+        convert.reduce_keys = true;
+        if (!value.empty() && !parse_tolerance(value, convert.key_tolerance))
+        {
+            return invalid("Bad tolerance: " + value, error);
+        }
+    }
+    else if (name == "--split-meshes")
+    {
+        long limit = 0xffff;
+        if (!value.empty() && (!parse_integer(value, limit) || limit <= 0 || limit > 0x7fffffff))
+        {
+            return invalid("Bad vertex limit: " + value, error);
+        }
+        convert.split_vertex_limit = static_cast<int>(limit);
+    }
+    else if (name == "--sample-rate")
+    {
+        if (!parse_number(value, options.sample_rate) || options.sample_rate <= 0.0)
+        {
+            return invalid("Bad sample rate: " + value, error);
+        }
+    }
+    else if (name == "--bake-skinning")
+    {
+        const std::string::size_type comma = value.find(',');
+        options.skinning_half = comma != std::string::npos && value.substr(comma + 1) == "half";
+        if (!parse_number(value.substr(0, comma), options.skinning_rate) || options.skinning_rate <= 0.0)
+        {
+            return invalid("Bad skinning rate: " + value, error);
+        }
+        if (comma != std::string::npos && !options.skinning_half)
+        {
+            return invalid("Unknown skinning precision: " + value.substr(comma + 1), error);
+        }
+    }
+    else if (name == "--morph-epsilon")
+    {
+        double epsilon = 0.0;
+        if (!parse_number(value, epsilon) || epsilon < 0.0)
+        {
+            return invalid("Bad morph epsilon: " + value, error);
+        }
+        options.morph_epsilon = static_cast<float>(epsilon);
+    }
+    else if (name == "--rotation-bits")
+    {
+        long bits = 0;
+        if (!parse_integer(value, bits) || (bits != 32 && bits != 48))
+        {
+            return invalid("Rotation bits must be 32 or 48", error);
+        }
+        options.encoding.rotation_bits = static_cast<unsigned int>(bits);
+    }
+    else if (name == "--key-times")
+    {
+        if (value == "float")
+        {
+            options.encoding.times = KeyTimes::Float;
+        }
+        else if (value.compare(0, 6, "frames") == 0 && (value.size() == 6 || value[6] == ','))
+        {
+            options.encoding.times = KeyTimes::Frames;
+            if (value.size() > 6)
+            {
+                if (!parse_number(value.substr(7), options.encoding.frame_rate) || options.encoding.frame_rate <= 0.0)
+                {
+                    return invalid("Bad key frame rate: " + value.substr(7), error);
+                }
+            }
+        }
+        else
+        {
+            return invalid("Unknown key times: " + value, error);
+        }
+    }
+    else if (name == "--format")
+    {
+        if (value == "json")
+        {
+            settings.format = OutputFormat::Json;
+        }
+        else if (value == "ndjson")
+        {
+            settings.format = OutputFormat::Ndjson;
+        }
+        else if (value == "cbor")
+        {
+            settings.format = OutputFormat::Cbor;
+        }
+        else if (value == "msgpack")
+        {
+            settings.format = OutputFormat::MessagePack;
+        }
+        else
+        {
+            return invalid("Unknown format: " + value, error);
+        }
+    }
+    else
+    {
+        return OptionResult::Unknown;
+    }
+    return OptionResult::Applied;
+}
@@ -0,0 +1,38 @@
+#pragma once
+
+#include "compress.hpp"
+#include "converter.hpp"
+
+#include <string>
+
+// How one model is converted and encoded, as set by command line options.
+// atj serve applies the options of each request on top of its own.
+struct ConvertSettings
+{
+    ConvertOptions convert;
+    OutputFormat format = OutputFormat::Json;
+    Compression compression;
+
+    // File extension of a model given as bytes.
+    std::string hint;
+
+    // Set once --process has replaced the preset's steps.
+    bool explicit_steps = false;
+};
+
+enum class OptionResult
+{
+    Applied,
+    Unknown,
+    Invalid
+};
+
+// The whole of value as a decimal integer, or as a finite number. False for
+// an empty value or one with anything after the number, such as "30fps".
+bool parse_integer(const std::string& value, long& integer);
+bool parse_number(const std::string& value, double& number);
+
+// Applies one "--name=value" option (value empty without "="). Invalid sets
+// error to a message naming the bad value; Unknown leaves settings alone.
+OptionResult apply_option(const std::string& name, const std::string& value, ConvertSettings& settings,
+        std::string& error);
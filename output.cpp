@@ -0,0 +1,350 @@
+#include "output.hpp"
+
+#include "trace.hpp"
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <climits>
+#include <cstdio>
+#include <cstring>
+#include <vector>
+
+namespace
+{
+
+// umask() can only be read by setting it, which would race with threads
+// creating files, so it is read once before main starts any.
+mode_t read_umask()
+{
+    const mode_t mask = ::umask(0);
+    ::umask(mask);
+    return mask;
+}
+
+const mode_t kUmask = read_umask();
+
+// The file path names once symlinks, even dangling ones, are followed.
+std::string resolve_symlinks(const std::string& path)
+{
+    std::string target = path;
+    for (int depth = 0; depth < 40; ++depth)
+    {
+        struct stat info;
+        char link[PATH_MAX];
+        if (::lstat(target.c_str(), &info) != 0 || !S_ISLNK(info.st_mode))
+        {
+            break;
+        }
+
+        const ssize_t length = ::readlink(target.c_str(), link, sizeof(link));
+        if (length <= 0 || length == static_cast<ssize_t>(sizeof(link)))
+        {
+            break;
+        }
+
+        const std::string::size_type slash = target.rfind('/');
+        target = link[0] == '/' || slash == std::string::npos
+            ? std::string(link, length)
+            : target.substr(0, slash + 1) + std::string(link, length);
+    }
+    return target;
+}
+
+}
+
+FdOutputBuffer::FdOutputBuffer(int fd, bool owns_fd, std::size_t capacity, unsigned int buffer_count)
+    : mFd(fd),
+      mOwnsFd(owns_fd),
+      mFailed(false),
+      mBuffers(std::max(1u, buffer_count), std::vector<char>(capacity)),
+      mCurrent(0),
+      mWriting(false),
+      mStopping(false)
+{
+    setp(mBuffers[0].data(), mBuffers[0].data() + capacity);
+
+    if (mBuffers.size() > 1)
+    {
+        for (std::size_t i = 1; i < mBuffers.size(); ++i)
+        {
+            mFree.push_back(i);
+        }
+        mWriter = std::thread(&FdOutputBuffer::write_loop, this);
+    }
+}
+
+FdOutputBuffer::~FdOutputBuffer()
+{
+    close();
+}
+
+bool FdOutputBuffer::close()
+{
+    if (mFd < 0)
+    {
+        return !mFailed;
+    }
+
+    flush_buffer();
+
+    if (mWriter.joinable())
+    {
+        {
+            std::lock_guard<std::mutex> lock(mMutex);
+            mStopping = true;
+        }
+        mChanged.notify_all();
+        mWriter.join();
+    }
+
+    if (mOwnsFd && ::close(mFd) != 0)
+    {
+        mFailed = true;
+    }
+    mFd = -1;
+
+    return !mFailed;
+}
+
+FdOutputBuffer::int_type FdOutputBuffer::overflow(int_type ch)
+{
+    if (!hand_off())
+    {
+        return traits_type::eof();
+    }
+
+    if (!traits_type::eq_int_type(ch, traits_type::eof()))
+    {
+        *pptr() = traits_type::to_char_type(ch);
+        pbump(1);
+    }
+
+    return traits_type::not_eof(ch);
+}
+
+std::streamsize FdOutputBuffer::xsputn(const char* s, std::streamsize n)
+{
+    std::size_t left = static_cast<std::size_t>(n);
+
+    // Writing synchronously, a block bigger than the whole buffer goes
+    // straight through rather than being copied in piece by piece.
+    if (!mWriter.joinable() && left >= mBuffers[0].size())
+    {
+        if (!hand_off() || !write_all(s, left))
+        {
+            mFailed = true;
+            return 0;
+        }
+        return n;
+    }
+
+    while (left > 0)
+    {
+        std::size_t space = static_cast<std::size_t>(epptr() - pptr());
+        if (space == 0)
+        {
+            if (!hand_off())
+            {
+                return n - static_cast<std::streamsize>(left);
+            }
+            continue;
+        }
+
+        std::size_t take = std::min(left, space);
+        std::memcpy(pptr(), s, take);
+        pbump(static_cast<int>(take));
+        s += take;
+        left -= take;
+    }
+
+    return n;
+}
+
+int FdOutputBuffer::sync()
+{
+    return flush_buffer() ? 0 : -1;
+}
+
+bool FdOutputBuffer::hand_off()
+{
+    std::size_t size = static_cast<std::size_t>(pptr() - pbase());
+
+    if (!mWriter.joinable())
+    {
+        if (size > 0 && !write_all(pbase(), size))
+        {
+            mFailed = true;
+            return false;
+        }
+        setp(pbase(), epptr());
+        return !mFailed;
+    }
+
+    if (size > 0)
+    {
+        std::unique_lock<std::mutex> lock(mMutex);
+        mFull.emplace_back(mCurrent, size);
+        mChanged.notify_all();
+
+        mChanged.wait(lock, [this]() { return !mFree.empty(); });
+        mCurrent = mFree.front();
+        mFree.pop_front();
+    }
+
+    std::vector<char>& buffer = mBuffers[mCurrent];
+    setp(buffer.data(), buffer.data() + buffer.size());
+
+    std::lock_guard<std::mutex> lock(mMutex);
+    return !mFailed;
+}
+
+bool FdOutputBuffer::flush_buffer()
+{
+    if (!hand_off())
+    {
+        return false;
+    }
+
+    if (mWriter.joinable())
+    {
+        std::unique_lock<std::mutex> lock(mMutex);
+        mChanged.wait(lock, [this]() { return mFull.empty() && !mWriting; });
+        return !mFailed;
+    }
+
+    return !mFailed;
+}
+
+void FdOutputBuffer::write_loop()
+{
+    if (trace_enabled())
+    {
+        trace_thread_name("writer");
+    }
+
+    std::unique_lock<std::mutex> lock(mMutex);
+
+    for (;;)
+    {
+        mChanged.wait(lock, [this]() { return mStopping || !mFull.empty(); });
+        if (mFull.empty())
+        {
+            return;
+        }
+
+        std::pair<std::size_t, std::size_t> job = mFull.front();
+        mFull.pop_front();
+        mWriting = true;
+
+        lock.unlock();
+        bool ok = false;
+        {
+            TraceSpan span("WriteBuffer");
+            ok = write_all(mBuffers[job.first].data(), job.second);
+        }
+        lock.lock();
+
+        if (!ok)
+        {
+            mFailed = true;
+        }
+        mWriting = false;
+        mFree.push_back(job.first);
+        mChanged.notify_all();
+    }
+}
+
+bool FdOutputBuffer::write_all(const char* pData, std::size_t size)
+{
+    if (mFd < 0)
+    {
+        return false;
+    }
+
+    while (size > 0)
+    {
+        ssize_t written = ::write(mFd, pData, size);
+        if (written < 0)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            return false;
+        }
+
+        pData += written;
+        size -= static_cast<std::size_t>(written);
+    }
+
+    return true;
+}
+
+void unshare_output(const std::string& path)
+{
+    struct stat info;
+    if (::lstat(path.c_str(), &info) == 0 && S_ISREG(info.st_mode) && info.st_nlink > 1)
+    {
+        ::unlink(path.c_str());
+    }
+}
+
+int open_output(const std::string& path, std::string& error)
+{
+    if (path == "-")
+    {
+        return STDOUT_FILENO;
+    }
+
+    unshare_output(path);
+    int fd = ::open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0)
+    {
+        error = std::strerror(errno);
+    }
+
+    return fd;
+}
+
+int open_replacement(const std::string& path, std::string& temp_name, std::string& error)
+{
+    const std::string target = resolve_symlinks(path);
+
+    // Ends in .tmp, which --watch ignores.
+    std::string pattern = target + ".XXXXXX.tmp";
+    std::vector<char> name(pattern.begin(), pattern.end());
+    name.push_back('\0');
+    int fd = ::mkstemps(name.data(), 4);
+    if (fd < 0)
+    {
+        error = std::strerror(errno);
+        return -1;
+    }
+    temp_name = name.data();
+
+    struct stat info;
+    const mode_t mode = ::stat(target.c_str(), &info) == 0 ? info.st_mode & 07777 : 0644 & ~kUmask;
+    if (::fchmod(fd, mode) != 0)
+    {
+        error = std::strerror(errno);
+        ::close(fd);
+        ::unlink(temp_name.c_str());
+        return -1;
+    }
+    return fd;
+}
+
+bool replace_output(const std::string& temp_name, const std::string& path, std::string& error)
+{
+    if (::rename(temp_name.c_str(), resolve_symlinks(path).c_str()) != 0)
+    {
+        error = std::strerror(errno);
+        ::unlink(temp_name.c_str());
+        return false;
+    }
+    return true;
+}
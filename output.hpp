@@ -0,0 +1,87 @@
+#pragma once
+
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <mutex>
+#include <streambuf>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Stream buffer that collects output in large user-space buffers and hands
+// each full one to the file descriptor with a single write(), instead of
+// going through ofstream's small buffer. With more than one buffer, a
+// background thread does the writing from a ring of buffers, so the caller
+// keeps serializing into the next buffer while the previous one is on its
+// way to disk.
+class FdOutputBuffer : public std::streambuf
+{
+public:
+    static const std::size_t kDefaultCapacity = 4 << 20;
+    static const unsigned int kDefaultBufferCount = 4;
+
+    FdOutputBuffer(int fd, bool owns_fd, std::size_t capacity = kDefaultCapacity,
+            unsigned int buffer_count = kDefaultBufferCount);
+    ~FdOutputBuffer() override;
+
+    FdOutputBuffer(const FdOutputBuffer&) = delete;
+    FdOutputBuffer& operator=(const FdOutputBuffer&) = delete;
+
+    // Flushes and, if owned, closes the descriptor. False if any write failed.
+    bool close();
+
+protected:
+    int_type overflow(int_type ch) override;
+    std::streamsize xsputn(const char* s, std::streamsize n) override;
+    int sync() override;
+
+private:
+    // Passes the filled part of the current buffer on and starts a new one.
+    bool hand_off();
+
+    // hand_off(), then waits until the writer thread has written everything.
+    bool flush_buffer();
+
+    bool write_all(const char* pData, std::size_t size);
+    void write_loop();
+
+    int mFd;
+    bool mOwnsFd;
+    bool mFailed;
+
+    std::vector<std::vector<char>> mBuffers;
+    std::size_t mCurrent;
+
+    // Buffers waiting to be written as (index, size), and buffers free to fill.
+    std::deque<std::pair<std::size_t, std::size_t>> mFull;
+    std::deque<std::size_t> mFree;
+    bool mWriting;
+    bool mStopping;
+    std::mutex mMutex;
+    std::condition_variable mChanged;
+    std::thread mWriter;
+};
+
+// Unlinks path if it is a regular file with other hard links, such as the
+// read-only cache entry a cache hit may link it to, so that writing a new
+// file there leaves the other names' contents alone.
+void unshare_output(const std::string& path);
+
+// Opens path for writing, truncating it, or returns standard output for "-".
+// A path hardlinked elsewhere is replaced rather than written through.
+// Returns -1 and sets error on failure.
+int open_output(const std::string& path, std::string& error);
+
+// Opens a new file to write path's next contents into before renaming it
+// over path with replace_output. It is made with mkstemps next to the file
+// path names after following symlinks, so runs writing the same output
+// never share one, and gets that file's permissions, or those open_output
+// would give a new file. Sets temp_name; returns -1 and sets error on
+// failure.
+int open_replacement(const std::string& path, std::string& temp_name, std::string& error);
+
+// Renames temp_name over the file path names after following symlinks, so
+// a symlinked output stays a symlink. Removes temp_name and sets error on
+// failure.
+bool replace_output(const std::string& temp_name, const std::string& path, std::string& error);
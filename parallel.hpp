@@ -0,0 +1,49 @@
+#pragma once
+
+#include "trace.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <thread>
+#include <vector>
+
+// Calls fn(i) for every i in [0, count), spread over one worker per hardware thread.
+template <typename Function>
+void parallel_for(std::size_t count, Function fn)
+{
+    std::size_t thread_count = std::max(1u, std::thread::hardware_concurrency());
+    thread_count = std::min(thread_count, count);
+
+    if (thread_count <= 1)
+    {
+        for (std::size_t i = 0; i < count; ++i)
+        {
+            fn(i);
+        }
+        return;
+    }
+
+    std::atomic<std::size_t> next(0);
+    std::vector<std::thread> workers;
+    workers.reserve(thread_count);
+
+    for (std::size_t t = 0; t < thread_count; ++t)
+    {
+        workers.emplace_back([&]() {
+            if (trace_enabled())
+            {
+                trace_thread_name("parallel_for");
+            }
+            for (std::size_t i = next++; i < count; i = next++)
+            {
+                fn(i);
+            }
+        });
+    }
+
+    for (auto& worker : workers)
+    {
+        worker.join();
+    }
+}
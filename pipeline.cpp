@@ -0,0 +1,375 @@
+#include "pipeline.hpp"
+
+#include <assimp/config.h>
+#include <assimp/postprocess.h>
+
+#include "options.hpp"
+#include "trace.hpp"
+
+#include <chrono>
+#include <climits>
+#include <sstream>
+
+namespace
+{
+
+struct PostProcessStep
+{
+    const char* name;
+    unsigned int flag;
+};
+
+// In the order Assimp's post-processing pipeline runs them. SplitLargeMeshes
+// is one flag for two passes: it is listed where its triangle pass runs, and
+// its vertex pass runs after JoinIdenticalVertices.
+const PostProcessStep steps[] = {
+    { "ValidateDataStructure", aiProcess_ValidateDataStructure },
+    { "MakeLeftHanded", aiProcess_MakeLeftHanded },
+    { "FlipUVs", aiProcess_FlipUVs },
+    { "FlipWindingOrder", aiProcess_FlipWindingOrder },
+    { "RemoveComponent", aiProcess_RemoveComponent },
+    { "RemoveRedundantMaterials", aiProcess_RemoveRedundantMaterials },
+    { "EmbedTextures", aiProcess_EmbedTextures },
+    { "FindInstances", aiProcess_FindInstances },
+    { "OptimizeGraph", aiProcess_OptimizeGraph },
+    { "FindDegenerates", aiProcess_FindDegenerates },
+    { "GenUVCoords", aiProcess_GenUVCoords },
+    { "TransformUVCoords", aiProcess_TransformUVCoords },
+    { "GlobalScale", aiProcess_GlobalScale },
+    { "PopulateArmatureData", aiProcess_PopulateArmatureData },
+    { "PreTransformVertices", aiProcess_PreTransformVertices },
+    { "Triangulate", aiProcess_Triangulate },
+    { "SortByPType", aiProcess_SortByPType },
+    { "FindInvalidData", aiProcess_FindInvalidData },
+    { "OptimizeMeshes", aiProcess_OptimizeMeshes },
+    { "FixInfacingNormals", aiProcess_FixInfacingNormals },
+    { "SplitByBoneCount", aiProcess_SplitByBoneCount },
+    { "SplitLargeMeshes", aiProcess_SplitLargeMeshes },
+    { "DropNormals", aiProcess_DropNormals },
+    { "GenNormals", aiProcess_GenNormals },
+    { "GenSmoothNormals", aiProcess_GenSmoothNormals },
+    { "CalcTangentSpace", aiProcess_CalcTangentSpace },
+    { "JoinIdenticalVertices", aiProcess_JoinIdenticalVertices },
+    { "Debone", aiProcess_Debone },
+    { "LimitBoneWeights", aiProcess_LimitBoneWeights },
+    { "ImproveCacheLocality", aiProcess_ImproveCacheLocality },
+    { "GenBoundingBoxes", aiProcess_GenBoundingBoxes }
+};
+
+// Not a step of its own but a change to how GenNormals and GenSmoothNormals
+// run, so it goes along with every step applied.
+const unsigned int kModifierFlags = aiProcess_ForceGenNormals;
+
+// The steps SplitLargeMeshes runs between its two passes.
+const unsigned int kBetweenSplitPasses = aiProcess_GenNormals | aiProcess_GenSmoothNormals |
+    aiProcess_CalcTangentSpace | aiProcess_JoinIdenticalVertices;
+
+enum class PropertyType
+{
+    Integer,
+    Boolean,
+    Float,
+    String
+};
+
+struct ImporterProperty
+{
+    const char* name;
+    PropertyType type;
+};
+
+// Assimp keeps integer, float and string properties in separate maps and
+// each reader asks for one type, so a property set as the wrong type is
+// silently never seen. Booleans are integers to Assimp.
+const ImporterProperty importer_properties[] = {
+    { AI_CONFIG_GLOB_MEASURE_TIME, PropertyType::Boolean },
+    { AI_CONFIG_FAVOUR_SPEED, PropertyType::Boolean },
+    { AI_CONFIG_GLOBAL_SCALE_FACTOR_KEY, PropertyType::Float },
+    { AI_CONFIG_APP_SCALE_KEY, PropertyType::Float },
+    { AI_CONFIG_IMPORT_NO_SKELETON_MESHES, PropertyType::Boolean },
+    { AI_CONFIG_IMPORT_REMOVE_EMPTY_BONES, PropertyType::Boolean },
+    { AI_CONFIG_IMPORT_GLOBAL_KEYFRAME, PropertyType::Integer },
+    { AI_CONFIG_IMPORT_FBX_READ_ALL_GEOMETRY_LAYERS, PropertyType::Boolean },
+    { AI_CONFIG_IMPORT_FBX_READ_ALL_MATERIALS, PropertyType::Boolean },
+    { AI_CONFIG_IMPORT_FBX_READ_MATERIALS, PropertyType::Boolean },
+    { AI_CONFIG_IMPORT_FBX_READ_TEXTURES, PropertyType::Boolean },
+    { AI_CONFIG_IMPORT_FBX_READ_CAMERAS, PropertyType::Boolean },
+    { AI_CONFIG_IMPORT_FBX_READ_LIGHTS, PropertyType::Boolean },
+    { AI_CONFIG_IMPORT_FBX_READ_ANIMATIONS, PropertyType::Boolean },
+    { AI_CONFIG_IMPORT_FBX_STRICT_MODE, PropertyType::Boolean },
+    { AI_CONFIG_IMPORT_FBX_PRESERVE_PIVOTS, PropertyType::Boolean },
+    { AI_CONFIG_IMPORT_FBX_OPTIMIZE_EMPTY_ANIMATION_CURVES, PropertyType::Boolean },
+    { AI_CONFIG_IMPORT_COLLADA_IGNORE_UP_DIRECTION, PropertyType::Boolean },
+    { AI_CONFIG_IMPORT_COLLADA_USE_COLLADA_NAMES, PropertyType::Boolean },
+    { AI_CONFIG_PP_SBBC_MAX_BONES, PropertyType::Integer },
+    { AI_CONFIG_PP_CT_MAX_SMOOTHING_ANGLE, PropertyType::Float },
+    { AI_CONFIG_PP_CT_TEXTURE_CHANNEL_INDEX, PropertyType::Integer },
+    { AI_CONFIG_PP_GSN_MAX_SMOOTHING_ANGLE, PropertyType::Float },
+    { AI_CONFIG_PP_RRM_EXCLUDE_LIST, PropertyType::String },
+    { AI_CONFIG_PP_PTV_KEEP_HIERARCHY, PropertyType::Boolean },
+    { AI_CONFIG_PP_PTV_NORMALIZE, PropertyType::Boolean },
+    { AI_CONFIG_PP_PTV_ADD_ROOT_TRANSFORMATION, PropertyType::Boolean },
+    { AI_CONFIG_PP_FD_REMOVE, PropertyType::Boolean },
+    { AI_CONFIG_PP_FD_CHECKAREA, PropertyType::Boolean },
+    { AI_CONFIG_PP_OG_EXCLUDE_LIST, PropertyType::String },
+    { AI_CONFIG_PP_SLM_TRIANGLE_LIMIT, PropertyType::Integer },
+    { AI_CONFIG_PP_SLM_VERTEX_LIMIT, PropertyType::Integer },
+    { AI_CONFIG_PP_LBW_MAX_WEIGHTS, PropertyType::Integer },
+    { AI_CONFIG_PP_DB_THRESHOLD, PropertyType::Float },
+    { AI_CONFIG_PP_DB_ALL_OR_NONE, PropertyType::Boolean },
+    { AI_CONFIG_PP_ICL_PTCACHE_SIZE, PropertyType::Integer },
+    { AI_CONFIG_PP_RVC_FLAGS, PropertyType::Integer },
+    { AI_CONFIG_PP_SBP_REMOVE, PropertyType::Integer },
+    { AI_CONFIG_PP_FID_ANIM_ACCURACY, PropertyType::Float },
+    { AI_CONFIG_PP_FID_IGNORE_TEXTURECOORDS, PropertyType::Boolean },
+    { AI_CONFIG_PP_TUV_EVALUATE, PropertyType::Integer }
+};
+
+// Parses "NAME=value" against the table and, given an importer, sets it.
+bool apply_importer_property(Assimp::Importer* pImporter, const std::string& assignment)
+{
+    const std::string::size_type equals = assignment.find('=');
+    if (equals == std::string::npos)
+    {
+        return false;
+    }
+
+    const std::string name = assignment.substr(0, equals);
+    const std::string value = assignment.substr(equals + 1);
+    for (const ImporterProperty& property : importer_properties)
+    {
+        if (name != property.name)
+        {
+            continue;
+        }
+
+        switch (property.type)
+        {
+        case PropertyType::Integer:
+        {
+            long integer = 0;
+            if (!parse_integer(value, integer) || integer < INT_MIN || integer > INT_MAX)
+            {
+                return false;
+            }
+            return !pImporter || pImporter->SetPropertyInteger(property.name, static_cast<int>(integer));
+        }
+        case PropertyType::Boolean:
+        {
+            if (value != "0" && value != "1" && value != "false" && value != "true")
+            {
+                return false;
+            }
+            return !pImporter || pImporter->SetPropertyBool(property.name, value == "1" || value == "true");
+        }
+        case PropertyType::Float:
+        {
+            double number = 0.0;
+            if (!parse_number(value, number))
+            {
+                return false;
+            }
+            return !pImporter || pImporter->SetPropertyFloat(property.name, static_cast<ai_real>(number));
+        }
+        case PropertyType::String:
+            return !pImporter || pImporter->SetPropertyString(property.name, value);
+        }
+    }
+    return false;
+}
+
+// Every flag in the table.
+unsigned int known_step_flags()
+{
+    unsigned int flags = 0;
+    for (const PostProcessStep& step : steps)
+    {
+        flags |= step.flag;
+    }
+    return flags;
+}
+
+double seconds_since(std::chrono::steady_clock::time_point start)
+{
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+template <typename Read>
+const aiScene* run_import(Assimp::Importer& importer, unsigned int flags,
+        std::vector<StepTiming>* timings, PhaseTimes& phases, Read read)
+{
+    // Steps run one by one only for timings: each call rebuilds what the
+    // steps would have shared, such as the SpatialSort, so a trace shows
+    // post-processing as the one call it otherwise is. A flag this table does
+    // not know cannot be put in its place in the pipeline, so then everything
+    // is applied in one call.
+    const bool stepwise = timings && (flags & ~(known_step_flags() | kModifierFlags)) == 0;
+
+    auto start = std::chrono::steady_clock::now();
+    const aiScene* pScene = nullptr;
+    {
+        TraceSpan span("ReadFile");
+        pScene = read();
+    }
+    const double read_seconds = seconds_since(start);
+    if (timings)
+    {
+        timings->push_back(StepTiming { "ReadFile", read_seconds });
+    }
+
+    double post_process_seconds = 0.0;
+    if (!stepwise)
+    {
+        // The same as ReadFile with the flags, which applies them to the
+        // scene it has just read.
+        start = std::chrono::steady_clock::now();
+        {
+            TraceSpan span("PostProcess");
+            pScene = pScene && flags != 0 ? importer.ApplyPostProcessing(flags) : pScene;
+        }
+        post_process_seconds = seconds_since(start);
+        if (timings && flags != 0)
+        {
+            timings->push_back(StepTiming { "PostProcess", post_process_seconds });
+        }
+    }
+
+    const unsigned int modifiers = flags & kModifierFlags;
+    for (const PostProcessStep& step : steps)
+    {
+        if (!stepwise || !pScene || (flags & step.flag) == 0)
+        {
+            continue;
+        }
+
+        // Applied alone, SplitLargeMeshes would run its two passes back to
+        // back, so the steps between them are applied in the same call.
+        unsigned int step_flags = step.flag;
+        std::string name = step.name;
+        if (step.flag == aiProcess_SplitLargeMeshes)
+        {
+            for (const PostProcessStep& between : steps)
+            {
+                if ((flags & between.flag & kBetweenSplitPasses) != 0)
+                {
+                    step_flags |= between.flag;
+                    name += std::string("+") + between.name;
+                }
+            }
+        }
+        else if ((step.flag & kBetweenSplitPasses) != 0 && (flags & aiProcess_SplitLargeMeshes) != 0)
+        {
+            continue;
+        }
+
+        start = std::chrono::steady_clock::now();
+        {
+            TraceSpan span(step.name, -1, step_flags != step.flag ? name.c_str() : nullptr);
+            pScene = importer.ApplyPostProcessing(step_flags | modifiers);
+        }
+        const double step_seconds = seconds_since(start);
+        if (timings)
+        {
+            timings->push_back(StepTiming { name, step_seconds });
+        }
+        post_process_seconds += step_seconds;
+    }
+
+    phases.import += read_seconds;
+    phases.post_process += post_process_seconds;
+    return pScene;
+}
+
+}
+
+unsigned int default_post_process_flags()
+{
+    return aiProcess_Triangulate |
+        aiProcess_JoinIdenticalVertices |
+        aiProcess_SortByPType;
+}
+
+bool preset_flags(const std::string& name, unsigned int& flags)
+{
+    if (name == "default")
+    {
+        flags = default_post_process_flags();
+    }
+    else if (name == "fast")
+    {
+        flags = aiProcessPreset_TargetRealtime_Fast;
+    }
+    else if (name == "quality")
+    {
+        flags = aiProcessPreset_TargetRealtime_Quality;
+    }
+    else if (name == "realtime-max")
+    {
+        flags = aiProcessPreset_TargetRealtime_MaxQuality;
+    }
+    else
+    {
+        return false;
+    }
+
+    return true;
+}
+
+bool parse_post_process_steps(const std::string& list, unsigned int& flags)
+{
+    std::istringstream stream(list);
+    std::string name;
+
+    while (std::getline(stream, name, ','))
+    {
+        if (name == "ForceGenNormals")
+        {
+            flags |= aiProcess_ForceGenNormals;
+            continue;
+        }
+
+        bool found = false;
+        for (const PostProcessStep& step : steps)
+        {
+            if (name == step.name)
+            {
+                flags |= step.flag;
+                found = true;
+                break;
+            }
+        }
+
+        if (!found)
+        {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+bool check_importer_property(const std::string& assignment)
+{
+    return apply_importer_property(nullptr, assignment);
+}
+
+bool set_importer_property(Assimp::Importer& importer, const std::string& assignment)
+{
+    return apply_importer_property(&importer, assignment);
+}
+
+const aiScene* import_scene(Assimp::Importer& importer, const std::string& filename,
+        unsigned int flags, std::vector<StepTiming>* timings, PhaseTimes& phases)
+{
+    return run_import(importer, flags, timings, phases, [&]() {
+        return importer.ReadFile(filename, 0);
+    });
+}
+
+const aiScene* import_scene_from_memory(Assimp::Importer& importer, const void* pData, std::size_t size,
+        const std::string& hint, unsigned int flags, std::vector<StepTiming>* timings, PhaseTimes& phases)
+{
+    return run_import(importer, flags, timings, phases, [&]() {
+        return importer.ReadFileFromMemory(pData, size, 0, hint.c_str());
+    });
+}
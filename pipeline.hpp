@@ -0,0 +1,60 @@
+#pragma once
+
+#include <assimp/Importer.hpp>
+#include <assimp/scene.h>
+
+#include <cstddef>
+#include <string>
+#include <vector>
+
+// The post-processing flags atj has always imported with.
+unsigned int default_post_process_flags();
+
+// Flags for a named preset: "default", "fast", "quality" or "realtime-max".
+bool preset_flags(const std::string& name, unsigned int& flags);
+
+// Adds the flags of a comma separated list of step names such as
+// "Triangulate,JoinIdenticalVertices" (the aiProcess_ names without prefix).
+bool parse_post_process_steps(const std::string& list, unsigned int& flags);
+
+// Sets an importer property from "NAME=value", where NAME is the string an
+// AI_CONFIG_* macro expands to. Assimp reads each property as one type, so
+// NAME must be one atj knows: value is then parsed as a decimal integer, a
+// boolean (0, 1, false, true), a number or a string to match. False for an
+// unknown NAME or a value of the wrong type.
+bool set_importer_property(Assimp::Importer& importer, const std::string& assignment);
+
+// Whether set_importer_property would accept assignment.
+bool check_importer_property(const std::string& assignment);
+
+struct StepTiming
+{
+    std::string name;
+    double seconds;
+};
+
+// Seconds spent in each phase of one conversion, measured on every
+// conversion at the cost of a few clock reads.
+struct PhaseTimes
+{
+    double import = 0.0;
+    double post_process = 0.0;
+    double serialize = 0.0;
+    double write = 0.0;
+};
+
+// Imports the file. With timings, the file is read without post-processing
+// and then every requested step is applied on its own with
+// ApplyPostProcessing, in Assimp's own pipeline order, recording how long the
+// read and each step took. The steps SplitLargeMeshes brackets are applied
+// together with it, and flags atj does not know in one "PostProcess" call.
+// The read and the post-processing are always two calls, ReadFile without
+// flags and then ApplyPostProcessing, so phases can time each of them.
+const aiScene* import_scene(Assimp::Importer& importer, const std::string& filename,
+        unsigned int flags, std::vector<StepTiming>* timings, PhaseTimes& phases);
+
+// As import_scene, but reads the model from memory through
+// ReadFileFromMemory. hint is the file extension that selects the importer.
+const aiScene* import_scene_from_memory(Assimp::Importer& importer, const void* pData, std::size_t size,
+        const std::string& hint, unsigned int flags, std::vector<StepTiming>* timings,
+        PhaseTimes& phases);
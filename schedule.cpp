@@ -0,0 +1,86 @@
+#include "schedule.hpp"
+
+#include <algorithm>
+
+namespace
+{
+
+// Before anything has been measured: 50 MB/s plus a millisecond of setup.
+const double kDefaultSecondsPerByte = 2e-8;
+const double kOverheadSeconds = 0.001;
+
+// Weight of the newest conversion in a format's average throughput.
+const double kRateWeight = 0.2;
+
+// Past models remembered, for servers seeing endless distinct paths.
+const std::size_t kMaxModels = 16384;
+
+}
+
+bool parse_schedule_policy(const std::string& name, SchedulePolicy& policy)
+{
+    if (name == "fifo")
+    {
+        policy = SchedulePolicy::Fifo;
+    }
+    else if (name == "shortest")
+    {
+        policy = SchedulePolicy::ShortestFirst;
+    }
+    else if (name == "fair")
+    {
+        policy = SchedulePolicy::FairShare;
+    }
+    else if (name == "deadline")
+    {
+        policy = SchedulePolicy::Deadline;
+    }
+    else
+    {
+        return false;
+    }
+    return true;
+}
+
+double CostModel::estimate(const std::string& path, const std::string& format, std::uint64_t bytes) const
+{
+    std::lock_guard<std::mutex> lock(mMutex);
+
+    auto model = path.empty() ? mModels.end() : mModels.find(path);
+    if (model != mModels.end())
+    {
+        const Sample& sample = model->second;
+        return sample.bytes == 0 ? sample.seconds : sample.seconds * bytes / sample.bytes;
+    }
+
+    auto rate = mRates.find(format);
+    return kOverheadSeconds + bytes * (rate != mRates.end() ? rate->second : kDefaultSecondsPerByte);
+}
+
+void CostModel::record(const std::string& path, const std::string& format, std::uint64_t bytes, double seconds)
+{
+    std::lock_guard<std::mutex> lock(mMutex);
+
+    if (!path.empty())
+    {
+        if (mModels.size() >= kMaxModels && mModels.count(path) == 0)
+        {
+            mModels.clear();
+        }
+        mModels[path] = Sample { bytes, seconds };
+    }
+
+    if (bytes != 0)
+    {
+        const double rate = std::max(0.0, seconds - kOverheadSeconds) / bytes;
+        auto known = mRates.find(format);
+        if (known == mRates.end())
+        {
+            mRates[format] = rate;
+        }
+        else
+        {
+            known->second += kRateWeight * (rate - known->second);
+        }
+    }
+}
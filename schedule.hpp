@@ -0,0 +1,222 @@
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <iterator>
+#include <map>
+#include <mutex>
+#include <string>
+#include <vector>
+
+enum class SchedulePolicy
+{
+    // In arrival order.
+    Fifo,
+
+    // Cheapest estimated conversion first. A waiting conversion's estimate
+    // counts down by the time it has waited, so large scenes still start.
+    ShortestFirst,
+
+    // The client that has used the least conversion time first, and each
+    // client's own conversions shortest first.
+    FairShare,
+
+    // Earliest deadline first; conversions without one follow, shortest
+    // first.
+    Deadline
+};
+
+// Parses "fifo", "shortest", "fair" or "deadline".
+bool parse_schedule_policy(const std::string& name, SchedulePolicy& policy);
+
+// Predicts how many seconds converting an input will take: from the same
+// model's last conversion, scaled by size, when there was one; else from the
+// throughput seen for its format; else from a fixed guess. Thread safe.
+class CostModel
+{
+public:
+    // path may be empty for models sent as bytes; format is the file
+    // extension or hint.
+    double estimate(const std::string& path, const std::string& format, std::uint64_t bytes) const;
+
+    // Learns from a finished conversion.
+    void record(const std::string& path, const std::string& format, std::uint64_t bytes, double seconds);
+
+private:
+    struct Sample
+    {
+        std::uint64_t bytes;
+        double seconds;
+    };
+
+    mutable std::mutex mMutex;
+
+    // Seconds per input byte by format, a moving average.
+    std::map<std::string, double> mRates;
+    std::map<std::string, Sample> mModels;
+};
+
+// Conversions waiting for a worker, handed out by policy. Not thread safe;
+// the owner locks around it. pop() scans every waiting item, which is fine
+// for the tens of items a bounded server queues.
+template <typename T>
+class ScheduledQueue
+{
+public:
+    typedef std::chrono::steady_clock Clock;
+
+    struct Ticket
+    {
+        // Estimated seconds, from a CostModel.
+        double cost = 0.0;
+        std::string client;
+        Clock::time_point deadline = Clock::time_point::max();
+    };
+
+    explicit ScheduledQueue(SchedulePolicy policy)
+        : mPolicy(policy), mSequence(0)
+    {
+    }
+
+    bool empty() const
+    {
+        return mWaiting.empty();
+    }
+
+    std::size_t size() const
+    {
+        return mWaiting.size();
+    }
+
+    void push(T item, const Ticket& ticket)
+    {
+        // A client that had nothing waiting starts level with the least
+        // served waiting client, so time spent idle is not credit.
+        double& usage = mUsage[ticket.client];
+        if (!mWaiting.empty() && !waiting(ticket.client))
+        {
+            usage = std::max(usage, usage_floor());
+        }
+
+        mWaiting.push_back(Waiting { item, ticket, Clock::now(), mSequence++ });
+    }
+
+    // Removes the item to start next and charges its estimated cost to its
+    // client. queued receives when it was pushed.
+    T pop(Clock::time_point& queued)
+    {
+        const Clock::time_point now = Clock::now();
+
+        std::size_t best = 0;
+        for (std::size_t i = 1; i < mWaiting.size(); ++i)
+        {
+            if (before(mWaiting[i], mWaiting[best], now))
+            {
+                best = i;
+            }
+        }
+
+        Waiting chosen = mWaiting[best];
+        mWaiting.erase(mWaiting.begin() + best);
+        mUsage[chosen.ticket.client] += chosen.ticket.cost;
+        queued = chosen.queued;
+        return chosen.item;
+    }
+
+    // Replaces the estimate charged to client with what the conversion
+    // actually took.
+    void settle(const std::string& client, double estimated, double seconds)
+    {
+        mUsage[client] += seconds - estimated;
+
+        if (mUsage.size() > kMaxClients)
+        {
+            for (auto it = mUsage.begin(); it != mUsage.end(); )
+            {
+                it = waiting(it->first) ? std::next(it) : mUsage.erase(it);
+            }
+        }
+    }
+
+private:
+    static const std::size_t kMaxClients = 1024;
+
+    struct Waiting
+    {
+        T item;
+        Ticket ticket;
+        Clock::time_point queued;
+        std::uint64_t sequence;
+    };
+
+    bool waiting(const std::string& client) const
+    {
+        for (const Waiting& other : mWaiting)
+        {
+            if (other.ticket.client == client)
+            {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    // Least usage among clients with something waiting; mWaiting is not empty.
+    double usage_floor() const
+    {
+        double floor = mUsage.at(mWaiting.front().ticket.client);
+        for (const Waiting& other : mWaiting)
+        {
+            floor = std::min(floor, mUsage.at(other.ticket.client));
+        }
+        return floor;
+    }
+
+    static double aged_cost(const Waiting& waiting, Clock::time_point now)
+    {
+        return waiting.ticket.cost - std::chrono::duration<double>(now - waiting.queued).count();
+    }
+
+    bool before(const Waiting& a, const Waiting& b, Clock::time_point now) const
+    {
+        switch (mPolicy)
+        {
+        case SchedulePolicy::Fifo:
+            return a.sequence < b.sequence;
+
+        case SchedulePolicy::FairShare:
+        {
+            const double usage_a = mUsage.at(a.ticket.client);
+            const double usage_b = mUsage.at(b.ticket.client);
+            if (usage_a != usage_b)
+            {
+                return usage_a < usage_b;
+            }
+            break;
+        }
+
+        case SchedulePolicy::Deadline:
+            if (a.ticket.deadline != b.ticket.deadline)
+            {
+                return a.ticket.deadline < b.ticket.deadline;
+            }
+            break;
+
+        case SchedulePolicy::ShortestFirst:
+            break;
+        }
+
+        const double cost_a = aged_cost(a, now);
+        const double cost_b = aged_cost(b, now);
+        return cost_a != cost_b ? cost_a < cost_b : a.sequence < b.sequence;
+    }
+
+    SchedulePolicy mPolicy;
+    std::uint64_t mSequence;
+    std::vector<Waiting> mWaiting;
+
+    // Conversion seconds charged to each client.
+    std::map<std::string, double> mUsage;
+};
@@ -0,0 +1,934 @@
+#include "serialize.hpp"
+
+#include "animation.hpp"
+#include "fragment.hpp"
+#include "mesh.hpp"
+#include "trace.hpp"
+
+#include <cstring>
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+
+using json = nlohmann::json;
+
+void to_json(json& j, const aiString& s)
+{
+    j = s.C_Str();
+}
+
+void to_json(json& j, const aiMatrix4x4& matrix)
+{
+    j = json::array({
+            matrix.a1, matrix.a2, matrix.a3, matrix.a4,
+            matrix.b1, matrix.b2, matrix.b3, matrix.b4,
+            matrix.c1, matrix.c2, matrix.c3, matrix.c4,
+            matrix.d1, matrix.d2, matrix.d3, matrix.d4,
+        });
+}
+
+void to_json(json& j, aiVertexWeight weight)
+{
+    j = json {
+        {"id", weight.mVertexId},
+        {"weight", weight.mWeight}
+    };
+}
+
+void to_json(json& j, const aiBone* pBone)
+{
+    j = json {
+        {"name", pBone->mName},
+        {"num_weights", pBone->mNumWeights},
+        {"offset_matrix", pBone->mOffsetMatrix},
+        {"weights", json::array()}
+    };
+
+    for (int i = 0; i < pBone->mNumWeights; ++i)
+    {
+        j["weights"].push_back(pBone->mWeights[i]);
+    }
+}
+
+void to_json(json& j, const aiVector2D& vertex)
+{
+    j = json {vertex.x, vertex.y};
+}
+
+void to_json(json& j, const aiVector3D& vertex)
+{
+    j = json {vertex.x, vertex.y, vertex.z};
+}
+
+void to_json(json& j, const aiColor4D& color)
+{
+    j = json {color.r, color.g, color.b, color.a};
+}
+
+void to_json(json& j, const aiColor3D& color)
+{
+    j = json {color.r, color.g, color.b};
+}
+
+void to_json(json& j, const aiMesh* pMesh, const ExportOptions& options)
+{
+    j["name"] = pMesh->mName;
+    j["primitive_types"] = pMesh->mPrimitiveTypes;
+    j["material_index"] = pMesh->mMaterialIndex;
+
+    if (pMesh->HasPositions())
+    {
+        for (unsigned int i = 0; i < pMesh->mNumVertices; ++i)
+        {
+            j["vertices"].push_back(pMesh->mVertices[i]);
+        }
+    }
+
+    if (pMesh->HasNormals())
+    {
+        for (unsigned int i = 0; i < pMesh->mNumVertices; ++i)
+        {
+            j["normals"].push_back(pMesh->mNormals[i]);
+        }
+    }
+
+    if (pMesh->HasTangentsAndBitangents())
+    {
+        for (unsigned int i = 0; i < pMesh->mNumVertices; ++i)
+        {
+            j["tangents"].push_back(pMesh->mTangents[i]);
+            j["bitangents"].push_back(pMesh->mBitangents[i]);
+        }
+    }
+
+    if (pMesh->HasFaces())
+    {
+        j["num_faces"] = pMesh->mNumFaces;
+        j["faces"] = flat_indices(pMesh);
+    }
+
+    if (pMesh->HasBones())
+    {
+        for (unsigned int i = 0; i < pMesh->mNumBones; ++i)
+        {
+            aiBone* pBone = pMesh->mBones[i];
+            j["bones"].push_back(pBone);
+        }
+    }
+
+    for (unsigned int i = 0; i < pMesh->GetNumColorChannels(); ++i)
+    {
+        if (pMesh->HasVertexColors(i))
+        {
+            std::string key = std::to_string(i);
+            std::vector<aiColor4D> colors(pMesh->mNumVertices);
+            for (unsigned int j = 0; j < pMesh->mNumVertices; ++j)
+            {
+                colors[j] = (pMesh->mColors[i][j]);
+            }
+
+            j["colors"][key] = colors;
+        }
+    }
+
+    for (unsigned int i = 0; i < pMesh->GetNumUVChannels(); ++i)
+    {
+        if (pMesh->HasTextureCoords(i))
+        {
+            std::string key = std::to_string(i);
+            unsigned int size = pMesh->mNumUVComponents[i];
+
+            std::vector<aiVector3D> uvs(pMesh->mNumVertices);
+            for (unsigned int j = 0; j < pMesh->mNumVertices; ++j)
+            {
+                uvs[j] = (pMesh->mTextureCoords[i][j]);
+            }
+
+            j["texturecoords"][key] = {
+                {"numcomponents", size},
+                {"uvs", uvs}
+            };
+        }
+    }
+
+    if (pMesh->mNumAnimMeshes > 0)
+    {
+        j["morph_method"] = pMesh->mMethod;
+        j["anim_meshes"] = morph_targets(pMesh, options.morph_epsilon);
+    }
+}
+
+void to_json(json& j, const aiMesh* pMesh)
+{
+    to_json(j, pMesh, ExportOptions());
+}
+
+std::string texture_string(const aiTextureType& type)
+{
+    std::string name;
+
+    switch (type)
+    {
+        case aiTextureType_DIFFUSE:
+            name = "diffuse";
+            break;
+        case aiTextureType_SPECULAR:
+            name = "specular";
+            break;
+        case aiTextureType_AMBIENT:
+            name = "ambient";
+            break;
+        case aiTextureType_EMISSIVE:
+            name = "emissive";
+            break;
+        case aiTextureType_HEIGHT:
+            name = "height";
+            break;
+        case aiTextureType_NORMALS:
+            name = "normals";
+            break;
+        case aiTextureType_SHININESS:
+            name = "shininess";
+            break;
+        case aiTextureType_OPACITY:
+            name = "opacity";
+            break;
+        case aiTextureType_DISPLACEMENT:
+            name = "displacement";
+            break;
+        case aiTextureType_LIGHTMAP:
+            name = "lightmap";
+            break;
+        case aiTextureType_REFLECTION:
+            name = "reflection";
+            break;
+        case aiTextureType_UNKNOWN:
+            name = "unknown";
+            break;
+        default:
+            name = "none";
+            break;
+    };
+
+    return name;
+}
+
+void to_json(json& j, const aiMaterial* pMaterial)
+{
+    aiString name;
+    if (pMaterial->Get(AI_MATKEY_NAME, name) == AI_SUCCESS)
+    {
+        j["name"] = name;
+    }
+
+    aiColor3D diffuse(0.f, 0.f, 0.f);
+    if (pMaterial->Get(AI_MATKEY_COLOR_DIFFUSE, diffuse) == AI_SUCCESS)
+    {
+        j["diffuse"] = diffuse;
+    }
+
+    aiColor3D specular(0.f, 0.f, 0.f);
+    if (pMaterial->Get(AI_MATKEY_COLOR_SPECULAR, specular) == AI_SUCCESS)
+    {
+        j["specular"] = specular;
+    }
+
+    aiColor3D ambient(0.f, 0.f, 0.f);
+    if (pMaterial->Get(AI_MATKEY_COLOR_AMBIENT, ambient) == AI_SUCCESS)
+    {
+        j["ambient"] = ambient;
+    }
+
+    aiColor3D emissive(0.f, 0.f, 0.f);
+    if (pMaterial->Get(AI_MATKEY_COLOR_EMISSIVE, emissive) == AI_SUCCESS)
+    {
+        j["emissive"] = emissive;
+    }
+
+    aiColor3D trans(0.f, 0.f, 0.f);
+    if (pMaterial->Get(AI_MATKEY_COLOR_TRANSPARENT, trans)== AI_SUCCESS)
+    {
+        j["transparent"] = trans;
+    }
+
+    int wireframe = 0;
+    if (pMaterial->Get(AI_MATKEY_ENABLE_WIREFRAME, wireframe) == AI_SUCCESS)
+    {
+        j["wireframe"] = wireframe == 0 ? false : true;
+    }
+
+    int twosided = 0;
+    if (pMaterial->Get(AI_MATKEY_TWOSIDED, twosided) == AI_SUCCESS)
+    {
+        j["twosided"] = twosided == 0 ? false : true;
+    }
+
+    int shading_model = 0;
+    if (pMaterial->Get(AI_MATKEY_SHADING_MODEL, shading_model) == AI_SUCCESS)
+    {
+        j["shading_model"] = shading_model;
+    }
+
+    int blend_func = 0;
+    if (pMaterial->Get(AI_MATKEY_BLEND_FUNC, blend_func) == AI_SUCCESS)
+    {
+        j["blend_func"] = blend_func;
+    }
+
+    float opacity = 1.f;
+    if (pMaterial->Get(AI_MATKEY_OPACITY, opacity) == AI_SUCCESS)
+    {
+        j["opacity"] = opacity;
+    }
+
+    float shininess = 0.f;
+    if (pMaterial->Get(AI_MATKEY_SHININESS, shininess) == AI_SUCCESS)
+    {
+        j["shininess"] = shininess;
+    }
+
+    float shininess_strength = 1.f;
+    if (pMaterial->Get(AI_MATKEY_SHININESS_STRENGTH, shininess_strength) == AI_SUCCESS)
+    {
+        j["shininess_strength"] = shininess_strength;
+    }
+
+    float refraction = 1.f;
+    if (pMaterial->Get(AI_MATKEY_REFRACTI, refraction) == AI_SUCCESS)
+    {
+        j["refraction"] = refraction;
+    }
+
+    std::vector<json> textures;
+    unsigned int texture_type_count = static_cast<int>(aiTextureType_UNKNOWN) + 1;
+    for (unsigned int i = 1; i < texture_type_count; ++i)
+    {
+        aiTextureType type = static_cast<aiTextureType>(i);
+
+        unsigned int count = pMaterial->GetTextureCount(type);
+        for (unsigned int index = 0; index < count; ++index)
+        {
+            aiString path;
+            aiTextureMapping mapping = aiTextureMapping_UV;
+            unsigned int uvindex = 0;
+            ai_real blend = 1.f;
+            aiTextureOp op = aiTextureOp_Multiply;
+            std::vector<aiTextureMapMode> mapmode(3);
+
+            if (pMaterial->GetTexture(type, index, &path, &mapping, &uvindex, &blend, &op, mapmode.data()) == AI_SUCCESS)
+            {
+                textures.push_back(json {
+                    {"type", texture_string(type)},
+                    {"path", path},
+                    {"mapping", static_cast<unsigned int>(mapping)},
+                    {"uvindex", uvindex},
+                    {"blend", blend},
+                    {"op", static_cast<unsigned int>(op)},
+                    {"mapmode", mapmode}
+                });
+            }
+        }
+    }
+
+    if (textures.empty() == false)
+    {
+        j["textures"] = textures;
+    }
+}
+
+void to_json(json& j, const aiTexel& texel)
+{
+    j = json {texel.a, texel.b, texel.g, texel.r};
+}
+
+void to_json(json& j, const aiTexture* pTexture)
+{
+    std::vector<aiTexel> data(pTexture->mWidth * pTexture->mHeight);
+    std::memcpy(data.data(), pTexture->pcData, data.size() * sizeof(aiTexel));
+
+    j = json {
+        {"format", pTexture->achFormatHint},
+        {"height", pTexture->mHeight},
+        {"width", pTexture->mWidth},
+        {"data", data}
+    };
+}
+
+void to_json(json& j, const aiLight* pLight)
+{
+    j = json {
+        {"name", pLight->mName},
+        {"type", static_cast<unsigned int>(pLight->mType)},
+        {"position", pLight->mPosition},
+        {"direction", pLight->mDirection},
+        {"up", pLight->mUp},
+        {"inner_cone_angle", pLight->mAngleInnerCone},
+        {"outer_cone_angle", pLight->mAngleOuterCone},
+        {"attenuation_constant", pLight->mAttenuationConstant},
+        {"attenuation_linear", pLight->mAttenuationLinear},
+        {"attenuation_quadratic", pLight->mAttenuationQuadratic},
+        {"color_ambient", pLight->mColorAmbient},
+        {"color_diffuse", pLight->mColorDiffuse},
+        {"color_specular", pLight->mColorSpecular},
+        {"size", pLight->mSize}
+    };
+}
+
+void to_json(json& j, const aiCamera* pCamera)
+{
+    j = json {
+        {"name", pCamera->mName},
+        {"position", pCamera->mPosition},
+        {"lookAt", pCamera->mLookAt},
+        {"up", pCamera->mUp}, 
+        {"aspect", pCamera->mAspect},
+        {"far", pCamera->mClipPlaneFar},
+        {"near", pCamera->mClipPlaneNear},
+        {"horizontalFOV", pCamera->mHorizontalFOV}
+    };
+}
+
+void to_json(json& j, const aiVectorKey& key)
+{
+    j = json {
+        {"time", key.mTime},
+        {"value", key.mValue}
+    };
+}
+
+void to_json(json& j, const aiQuaternion& q)
+{
+    j = json { q.x, q.y, q.z, q.w };
+}
+
+void to_json(json& j, const aiQuatKey& key)
+{
+    j = json {
+        {"time", key.mTime},
+        {"value", key.mValue}
+    };
+}
+
+void to_json(json& j, const aiNodeAnim* nodeAnim)
+{
+    unsigned int position_count = nodeAnim->mNumPositionKeys;
+    unsigned int rotation_count = nodeAnim->mNumRotationKeys;
+    unsigned int scaling_count = nodeAnim->mNumScalingKeys;
+
+    std::vector<aiVectorKey> position_keys(position_count);
+    std::vector<aiQuatKey> rotation_keys(rotation_count);
+    std::vector<aiVectorKey> scaling_keys(scaling_count);
+
+    std::memcpy(position_keys.data(), nodeAnim->mPositionKeys, sizeof(aiVectorKey) * position_count);
+    std::memcpy(rotation_keys.data(), nodeAnim->mRotationKeys, sizeof(aiQuatKey) * rotation_count);
+    std::memcpy(scaling_keys.data(), nodeAnim->mScalingKeys, sizeof(aiVectorKey) * scaling_count);
+
+    j = json {
+        {"node_name", nodeAnim->mNodeName},
+        {"num_position_keys", position_count},
+        {"num_rotation_keys", rotation_count},
+        {"num_scaling_keys", scaling_count},
+        {"position_keys", position_keys},
+        {"post_state", static_cast<unsigned int>(nodeAnim->mPostState)},
+        {"pre_state", static_cast<unsigned int>(nodeAnim->mPreState)},
+        {"rotation_keys", rotation_keys},
+        {"scaling_keys", scaling_keys}
+    };
+}
+
+void to_json(json& j, const aiNodeAnim* nodeAnim, double ticks_per_second, const ExportOptions& options)
+{
+    if (options.encoding.compact())
+    {
+        const TrackEncoding& encoding = options.encoding;
+        j = json {
+            {"node_name", nodeAnim->mNodeName},
+            {"num_position_keys", nodeAnim->mNumPositionKeys},
+            {"num_rotation_keys", nodeAnim->mNumRotationKeys},
+            {"num_scaling_keys", nodeAnim->mNumScalingKeys},
+            {"position_keys", encode_track(nodeAnim->mPositionKeys, nodeAnim->mNumPositionKeys, ticks_per_second,
+                    encoding)},
+            {"post_state", static_cast<unsigned int>(nodeAnim->mPostState)},
+            {"pre_state", static_cast<unsigned int>(nodeAnim->mPreState)},
+            {"rotation_bits", options.encoding.rotation_bits},
+            {"rotation_keys", encode_track(nodeAnim->mRotationKeys, nodeAnim->mNumRotationKeys, ticks_per_second,
+                    encoding)},
+            {"scaling_keys", encode_track(nodeAnim->mScalingKeys, nodeAnim->mNumScalingKeys, ticks_per_second,
+                    encoding)}
+        };
+        if (encoding.times == KeyTimes::Frames)
+        {
+            j["frame_rate"] = encoding.frame_rate;
+        }
+        return;
+    }
+
+    to_json(j, nodeAnim);
+}
+
+void to_json(json& j, const aiMeshKey& key)
+{
+    j = json {
+        {"time", key.mTime},
+        {"value", key.mValue}
+    };
+}
+
+void to_json(json& j, const aiMeshAnim* pMeshAnim)
+{
+    unsigned int count = pMeshAnim->mNumKeys;
+    std::vector<aiMeshKey> keys(count);
+    std::memcpy(keys.data(), pMeshAnim->mKeys, sizeof(aiMeshKey) * count);
+
+    j = json {
+        {"keys", keys},
+        {"name", pMeshAnim->mName},
+        {"num_keys", count}
+    };
+}
+
+void to_json(json& j, const aiMeshMorphKey& key)
+{
+    unsigned int count = key.mNumValuesAndWeights;
+    std::vector<unsigned int> values(count);
+    std::vector<double> weights(count);
+
+    std::memcpy(values.data(), key.mValues, sizeof(unsigned int) * count);
+    std::memcpy(weights.data(), key.mWeights, sizeof(double) * count);
+
+    j = json {
+        {"num_values_and_weights", count},
+        {"time", key.mTime},
+        {"values", values},
+        {"weights", weights}
+    };
+}
+
+void to_json(json& j, const aiMeshMorphAnim* pMeshMorphAnim)
+{
+    unsigned int count = pMeshMorphAnim->mNumKeys;
+    std::vector<aiMeshMorphKey> keys(count);
+    std::memcpy(keys.data(), pMeshMorphAnim->mKeys, sizeof(aiMeshMorphKey) * count);
+
+    j = json {
+        {"keys", keys},
+        {"name", pMeshMorphAnim->mName},
+        {"num_keys", count}
+    };
+}
+
+void to_json(json& j, const aiAnimation* pAnimation, const ExportOptions& options)
+{
+    unsigned int c_count = pAnimation->mNumChannels;
+    unsigned int mc_count = pAnimation->mNumMeshChannels;
+    unsigned int mmc_count = pAnimation->mNumMorphMeshChannels;
+
+    std::vector<aiMeshAnim*> meshAnims(mc_count);
+    std::vector<aiMeshMorphAnim*> meshMorphAnims(mmc_count);
+
+    std::memcpy(meshAnims.data(), pAnimation->mMeshChannels, sizeof(aiMeshAnim*) * mc_count);
+    std::memcpy(meshMorphAnims.data(), pAnimation->mMorphMeshChannels, sizeof(aiMeshMorphAnim*) * mmc_count);
+
+    j = json {
+        {"duration", pAnimation->mDuration},
+        {"mesh_channels", meshAnims},
+        {"morph_mesh_channels", meshMorphAnims},
+        {"name", pAnimation->mName},
+        {"num_channels", c_count},
+        {"num_mesh_channels", mc_count},
+        {"num_morph_mesh_channels", mmc_count},
+        {"ticks_per_second", pAnimation->mTicksPerSecond}
+    };
+
+    if (options.sample_rate > 0.0)
+    {
+        json sampled = sample_animation(pAnimation, options.sample_rate, options.encoding);
+        for (auto it = sampled.begin(); it != sampled.end(); ++it)
+        {
+            j[it.key()] = std::move(it.value());
+        }
+    }
+    else
+    {
+        j["channels"] = json::array();
+        for (unsigned int i = 0; i < c_count; ++i)
+        {
+            json channel;
+            to_json(channel, pAnimation->mChannels[i], ticks_per_second(pAnimation), options);
+            j["channels"].push_back(channel);
+        }
+    }
+}
+
+void to_json(json& j, const aiAnimation* pAnimation)
+{
+    to_json(j, pAnimation, ExportOptions());
+}
+
+void to_json(json& j, const aiMetadataEntry& entry)
+{
+
+    switch (entry.mType)
+    {
+        case AI_BOOL:
+            j = json {
+                {"type", "bool"},
+                {"data", *reinterpret_cast<bool*>(entry.mData)}
+            };
+            break;
+        case AI_INT32:
+            j = json {
+                {"type", "int_32"},
+                {"data", *reinterpret_cast<int32_t*>(entry.mData)}
+            };
+            break;
+        case AI_UINT64:
+            j = json {
+                {"type", "uint_64"},
+                {"data", *reinterpret_cast<uint64_t*>(entry.mData)}
+            };
+            break;
+        case AI_FLOAT:
+            j = json {
+                {"type", "float"},
+                {"data", *reinterpret_cast<float*>(entry.mData)}
+            };
+            break;
+        case AI_DOUBLE:
+            j = json {
+                {"type", "double"},
+                {"data", *reinterpret_cast<double*>(entry.mData)}
+            };
+            break;
+        case AI_AISTRING:
+            j = json {
+                {"type", "string"},
+                {"data", *reinterpret_cast<aiString*>(entry.mData)}
+            };
+            break;
+        case AI_AIVECTOR3D:
+            j = json {
+                {"type", "vec3"},
+                {"data", *reinterpret_cast<aiVector3D*>(entry.mData)}
+            };
+            break;
+        default:
+            break;
+    };
+}
+
+void to_json(json& j, const aiMetadata* pMetaData)
+{
+    unsigned int num_properties = pMetaData->mNumProperties;
+
+    std::vector<aiString> keys(num_properties);
+    std::vector<aiMetadataEntry> values(num_properties);
+
+    std::memcpy(keys.data(), pMetaData->mKeys, sizeof(aiString) * num_properties);
+    std::memcpy(values.data(), pMetaData->mValues, sizeof(aiMetadataEntry) * num_properties);
+    
+    j = json {
+        {"num_properties", num_properties},
+        {"keys", keys},
+        {"values", values}
+    };
+}
+
+void to_json(json& j, const aiNode* pNode)
+{
+    unsigned int num_children = pNode->mNumChildren;
+    unsigned int num_meshes = pNode->mNumMeshes;
+
+    std::vector<aiNode*> children(num_children);
+    std::vector<unsigned int> meshes(num_meshes);
+
+    std::memcpy(children.data(), pNode->mChildren, sizeof(aiNode*) * num_children);
+    std::memcpy(meshes.data(), pNode->mMeshes, sizeof(unsigned int) * num_meshes);
+
+    j = json {
+        {"children", children},
+        {"meshes", meshes},
+        {"name", pNode->mName},
+        {"num_children", num_children},
+        {"num_meshes", num_meshes},
+        {"transformation", pNode->mTransformation}
+    };
+
+    if (pNode->mParent)
+    {
+        j["parent"] = pNode->mParent->mName;
+    }
+
+    if (pNode->mMetaData)
+    {
+        j["meta_data"] = pNode->mMetaData;
+    }
+}
+
+namespace
+{
+
+// Compact text of the mesh, from options.pFragments when it has seen the
+// same content before.
+std::shared_ptr<const std::string> mesh_text(const aiMesh* pMesh, const ExportOptions& options)
+{
+    std::uint64_t key = 0;
+    if (options.pFragments)
+    {
+        key = hash_mesh(pMesh, options.morph_epsilon);
+        if (auto pCached = options.pFragments->find(key))
+        {
+            return pCached;
+        }
+    }
+
+    json mesh;
+    to_json(mesh, pMesh, options);
+    auto pText = std::make_shared<const std::string>(mesh.dump());
+    if (options.pFragments)
+    {
+        options.pFragments->insert(key, pText);
+    }
+    return pText;
+}
+
+std::shared_ptr<const std::string> material_text(const aiMaterial* pMaterial, const ExportOptions& options)
+{
+    std::uint64_t key = 0;
+    if (options.pFragments)
+    {
+        key = hash_material(pMaterial);
+        if (auto pCached = options.pFragments->find(key))
+        {
+            return pCached;
+        }
+    }
+
+    auto pText = std::make_shared<const std::string>(json(pMaterial).dump());
+    if (options.pFragments)
+    {
+        options.pFragments->insert(key, pText);
+    }
+    return pText;
+}
+
+}
+
+void to_json(json& j, const aiScene* pScene, const ExportOptions& options)
+{
+    j["flags"] = pScene->mFlags;
+
+    j["num_meshes"] = pScene->mNumMeshes;
+    for (unsigned int i = 0; i < pScene->mNumMeshes; ++i)
+    {
+        TraceSpan span("Mesh", i, pScene->mMeshes[i]->mName.C_Str());
+        json mesh;
+        to_json(mesh, pScene->mMeshes[i], options);
+        j["meshes"].push_back(mesh);
+    }
+
+    j["num_materials"] = pScene->mNumMaterials;
+    for (unsigned int i = 0; i < pScene->mNumMaterials; ++i)
+    {
+        j["materials"].push_back(pScene->mMaterials[i]);
+    }
+
+    j["num_textures"] = pScene->mNumTextures;
+    for (unsigned int i = 0; i < pScene->mNumTextures; ++i)
+    {
+        j["textures"].push_back(pScene->mTextures[i]);
+    }
+
+    j["num_lights"] = pScene->mNumLights;
+    for (unsigned int i = 0; i < pScene->mNumLights; ++i)
+    {
+        j["lights"].push_back(pScene->mLights[i]);
+    }
+
+    j["num_cameras"] = pScene->mNumCameras;
+    for (unsigned int i = 0; i < pScene->mNumCameras; ++i)
+    {
+        j["cameras"].push_back(pScene->mCameras[i]);
+    }
+
+    j["num_animations"] = pScene->mNumAnimations;
+    for (unsigned int i = 0; i < pScene->mNumAnimations; ++i)
+    {
+        TraceSpan span("Animation", i, pScene->mAnimations[i]->mName.C_Str());
+        json animation;
+        to_json(animation, pScene->mAnimations[i], options);
+        j["animations"].push_back(animation);
+    }
+
+    j["root"] = pScene->mRootNode;
+
+    if (options.skinning_rate > 0.0)
+    {
+        j["skinning"] = bake_skinning(pScene, options.skinning_rate, options.skinning_half);
+    }
+}
+
+void to_json(json& j, const aiScene* pScene)
+{
+    to_json(j, pScene, ExportOptions());
+}
+
+namespace
+{
+
+struct RecordWriter
+{
+    std::ostream& output;
+    std::vector<RecordOffset>* pRecords;
+    const RecordFilter& filter;
+    std::uint64_t offset;
+
+    void write(const char* type, unsigned int index, const json& data)
+    {
+        write_data(type, index, data.dump());
+    }
+
+    // As write, with data already dumped. The line is put together exactly
+    // as dump() orders the record's keys.
+    void write_data(const char* type, unsigned int index, const std::string& data)
+    {
+        std::string line;
+        line.reserve(data.size() + 48);
+        line += "{\"data\":";
+        line += data;
+        line += ",\"index\":";
+        line += std::to_string(index);
+        line += ",\"type\":";
+        line += json(type).dump();
+        line += '}';
+        if (filter && !filter(type, index, line))
+        {
+            return;
+        }
+        output << line << '\n';
+
+        if (pRecords)
+        {
+            pRecords->push_back(RecordOffset { type, index, offset, line.size() });
+        }
+        offset += line.size() + 1;
+    }
+};
+
+void list_nodes(const aiNode* pNode, std::vector<const aiNode*>& nodes)
+{
+    nodes.push_back(pNode);
+    for (unsigned int i = 0; i < pNode->mNumChildren; ++i)
+    {
+        list_nodes(pNode->mChildren[i], nodes);
+    }
+}
+
+}
+
+void write_records(std::ostream& output, const aiScene* pScene, const ExportOptions& options,
+        std::vector<RecordOffset>* pRecords, const RecordFilter& filter)
+{
+    RecordWriter writer { output, pRecords, filter, 0 };
+
+    std::vector<const aiNode*> nodes;
+    if (pScene->mRootNode)
+    {
+        list_nodes(pScene->mRootNode, nodes);
+    }
+
+    bool skinning = options.skinning_rate > 0.0;
+
+    json header = {
+        {"flags", pScene->mFlags},
+        {"num_meshes", pScene->mNumMeshes},
+        {"num_materials", pScene->mNumMaterials},
+        {"num_textures", pScene->mNumTextures},
+        {"num_lights", pScene->mNumLights},
+        {"num_cameras", pScene->mNumCameras},
+        {"num_animations", pScene->mNumAnimations},
+        {"num_nodes", nodes.size()},
+        {"skinning", skinning}
+    };
+    writer.write("header", 0, header);
+
+    for (unsigned int i = 0; i < pScene->mNumMeshes; ++i)
+    {
+        TraceSpan span("Mesh", i, pScene->mMeshes[i]->mName.C_Str());
+        writer.write_data("mesh", i, *mesh_text(pScene->mMeshes[i], options));
+    }
+
+    for (unsigned int i = 0; i < pScene->mNumMaterials; ++i)
+    {
+        writer.write_data("material", i, *material_text(pScene->mMaterials[i], options));
+    }
+
+    for (unsigned int i = 0; i < pScene->mNumTextures; ++i)
+    {
+        writer.write("texture", i, pScene->mTextures[i]);
+    }
+
+    for (unsigned int i = 0; i < pScene->mNumLights; ++i)
+    {
+        writer.write("light", i, pScene->mLights[i]);
+    }
+
+    for (unsigned int i = 0; i < pScene->mNumCameras; ++i)
+    {
+        writer.write("camera", i, pScene->mCameras[i]);
+    }
+
+    for (unsigned int i = 0; i < pScene->mNumAnimations; ++i)
+    {
+        TraceSpan span("Animation", i, pScene->mAnimations[i]->mName.C_Str());
+        json animation;
+        to_json(animation, pScene->mAnimations[i], options);
+        writer.write("animation", i, animation);
+    }
+
+    std::map<const aiNode*, unsigned int> node_index;
+    for (unsigned int i = 0; i < nodes.size(); ++i)
+    {
+        node_index[nodes[i]] = i;
+    }
+
+    for (unsigned int i = 0; i < nodes.size(); ++i)
+    {
+        const aiNode* pNode = nodes[i];
+
+        std::vector<unsigned int> children(pNode->mNumChildren);
+        for (unsigned int c = 0; c < pNode->mNumChildren; ++c)
+        {
+            children[c] = node_index[pNode->mChildren[c]];
+        }
+
+        std::vector<unsigned int> meshes(pNode->mMeshes, pNode->mMeshes + pNode->mNumMeshes);
+
+        json node = {
+            {"children", children},
+            {"meshes", meshes},
+            {"name", pNode->mName},
+            {"num_children", pNode->mNumChildren},
+            {"num_meshes", pNode->mNumMeshes},
+            {"transformation", pNode->mTransformation}
+        };
+
+        if (pNode->mParent)
+        {
+            node["parent"] = node_index[pNode->mParent];
+        }
+
+        if (pNode->mMetaData)
+        {
+            node["meta_data"] = pNode->mMetaData;
+        }
+
+        writer.write("node", i, node);
+    }
+
+    if (skinning)
+    {
+        writer.write("skinning", 0, bake_skinning(pScene, options.skinning_rate, options.skinning_half));
+    }
+}
@@ -0,0 +1,65 @@
+#pragma once
+
+#include <assimp/scene.h>
+
+#include <json/json.hpp>
+
+#include "animation.hpp"
+
+#include <cstdint>
+#include <functional>
+#include <ostream>
+#include <string>
+#include <vector>
+
+class FragmentCache;
+
+struct ExportOptions
+{
+    // Frames per second to resample animations at; zero keeps the original keys.
+    double sample_rate = 0.0;
+
+    // Compact key times and packed rotations for animation tracks.
+    TrackEncoding encoding;
+
+    // Frames per second to bake skinning matrices at; zero skips baking.
+    double skinning_rate = 0.0;
+    bool skinning_half = false;
+
+    // Smallest per-component change that keeps a vertex in a morph target.
+    float morph_epsilon = 1e-6f;
+
+    // Reuses the text of meshes and materials already serialized when
+    // writing NDJSON records; null serializes everything. Documents are
+    // always serialized in full, since parsing cached text back into a
+    // value costs more than serializing the mesh again.
+    FragmentCache* pFragments = nullptr;
+};
+
+// The whole scene as one JSON document. The two-argument form is what
+// `json j = pScene;` picks up and uses the default options.
+void to_json(nlohmann::json& j, const aiScene* pScene, const ExportOptions& options);
+void to_json(nlohmann::json& j, const aiScene* pScene);
+
+// Where one record (a mesh, material, node, ...) sits in a written document:
+// its byte range from the first to the last character of its JSON value.
+struct RecordOffset
+{
+    std::string type;
+    unsigned int index;
+    std::uint64_t offset;
+    std::uint64_t length;
+};
+
+// Writes the scene as newline-delimited JSON, one self-describing record
+// {"type": ..., "index": ..., "data": ...} per line. A "header" record with
+// the scene flags and counts comes first, then every mesh, material,
+// texture, light, camera, animation and node (parents before children,
+// linked by node index), and the "skinning" record if baking is on. Each
+// record is written as soon as it is serialized. With pRecords, the byte
+// range of every line (without its newline) is appended to it. A filter sees
+// every serialized line and decides whether it is written.
+typedef std::function<bool(const std::string& type, unsigned int index, const std::string& line)> RecordFilter;
+
+void write_records(std::ostream& output, const aiScene* pScene, const ExportOptions& options,
+        std::vector<RecordOffset>* pRecords = nullptr, const RecordFilter& filter = RecordFilter());
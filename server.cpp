@@ -0,0 +1,1149 @@
+#include "server.hpp"
+
+#include "cache.hpp"
+#include "metrics.hpp"
+#include "output.hpp"
+#include "schedule.hpp"
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <signal.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cctype>
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <functional>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <thread>
+#include <vector>
+
+namespace
+{
+
+// Requests are small; only model bytes come in large frames.
+const std::uint32_t kMaxRequestSize = 1 << 20;
+
+// Frames are read into memory this much at a time, so what a client makes
+// the server allocate grows with what it actually sends.
+const std::size_t kFrameChunk = std::size_t(1) << 20;
+
+// A client that stops sending in the middle of a request is dropped.
+const int kReceiveTimeoutSeconds = 30;
+
+std::atomic<bool> gStop(false);
+
+void request_stop(int)
+{
+    gStop = true;
+}
+
+std::mutex gLogMutex;
+
+// Writes a whole line at once so lines from worker threads do not mix.
+void log_line(const std::string& line)
+{
+    std::lock_guard<std::mutex> lock(gLogMutex);
+    std::cerr << line << std::endl;
+}
+
+bool read_all(int fd, void* pData, std::size_t size)
+{
+    char* p = static_cast<char*>(pData);
+    while (size > 0)
+    {
+        ssize_t count = ::recv(fd, p, size, 0);
+        if (count < 0 && errno == EINTR)
+        {
+            continue;
+        }
+        if (count <= 0)
+        {
+            return false;
+        }
+        p += count;
+        size -= count;
+    }
+    return true;
+}
+
+bool send_all(int fd, const void* pData, std::size_t size)
+{
+    const char* p = static_cast<const char*>(pData);
+    while (size > 0)
+    {
+        ssize_t count = ::send(fd, p, size, MSG_NOSIGNAL);
+        if (count < 0 && errno == EINTR)
+        {
+            continue;
+        }
+        if (count <= 0)
+        {
+            return false;
+        }
+        p += count;
+        size -= count;
+    }
+    return true;
+}
+
+// Waits for the first byte of the next request, giving up once the server
+// is stopping or the client has hung up.
+bool wait_readable(int fd)
+{
+    pollfd descriptor { fd, POLLIN, 0 };
+    while (!gStop)
+    {
+        int ready = ::poll(&descriptor, 1, 250);
+        if (ready > 0)
+        {
+            return true;
+        }
+        if (ready < 0 && errno != EINTR)
+        {
+            return false;
+        }
+    }
+    return false;
+}
+
+// Reads one frame of at most max_size bytes. pSize, if given, is set to the
+// length the frame announced, also when that is too large to read.
+template <typename Buffer>
+bool read_frame(int fd, Buffer& payload, std::uint32_t max_size, std::uint32_t* pSize = nullptr)
+{
+    unsigned char header[4];
+    if (!read_all(fd, header, sizeof(header)))
+    {
+        return false;
+    }
+
+    const std::uint32_t size = (std::uint32_t(header[0]) << 24) | (std::uint32_t(header[1]) << 16)
+            | (std::uint32_t(header[2]) << 8) | std::uint32_t(header[3]);
+    if (pSize)
+    {
+        *pSize = size;
+    }
+    if (size > max_size)
+    {
+        return false;
+    }
+
+    payload.clear();
+    for (std::size_t done = 0; done < size;)
+    {
+        const std::size_t chunk = std::min<std::size_t>(size - done, kFrameChunk);
+        payload.resize(done + chunk);
+        if (!read_all(fd, &payload[done], chunk))
+        {
+            return false;
+        }
+        done += chunk;
+    }
+    return true;
+}
+
+bool send_frame(int fd, const char* pData, std::size_t size)
+{
+    if (size > UINT32_MAX)
+    {
+        return false;
+    }
+
+    const unsigned char header[4] = {
+        static_cast<unsigned char>(size >> 24), static_cast<unsigned char>(size >> 16),
+        static_cast<unsigned char>(size >> 8), static_cast<unsigned char>(size)
+    };
+    return send_all(fd, header, sizeof(header)) && send_all(fd, pData, size);
+}
+
+bool send_json(int fd, const nlohmann::json& message)
+{
+    const std::string text = message.dump();
+    return send_frame(fd, text.data(), text.size());
+}
+
+// One request, from the connection that read it to the worker converting it
+// and back.
+struct Job
+{
+    ConvertSettings settings;
+
+    // Model path, or empty to convert data.
+    std::string input;
+    std::vector<char> data;
+
+    // Where to write the result, or empty to return it in bytes. With an
+    // output, results of up to keep_bytes are also returned in bytes.
+    std::string output;
+    std::uint64_t keep_bytes = 0;
+
+    // Scheduling: who asked, by when, and the estimated seconds of work.
+    std::string client;
+    std::chrono::steady_clock::time_point deadline = std::chrono::steady_clock::time_point::max();
+    double cost = 0.0;
+
+    bool ok = false;
+    bool cached = false;
+    std::string error;
+    std::shared_ptr<const std::string> bytes;
+    std::uint64_t size = 0;
+    std::vector<StepTiming> timings;
+    std::vector<std::string> inputs;
+    std::vector<FileStamp> input_stamps;
+    std::uint64_t input_size = 0;
+    PhaseTimes phases;
+
+    // Time spent waiting for a worker, and converting or answering from the
+    // cache.
+    double queue_seconds = 0.0;
+    double service_seconds = 0.0;
+};
+
+// What the cost model knows the input's format by: the hint, or the file
+// extension.
+std::string job_format(const Job& job)
+{
+    std::string format = job.settings.hint;
+    if (format.empty())
+    {
+        const std::string::size_type dot = job.input.rfind('.');
+        if (dot != std::string::npos && job.input.find('/', dot) == std::string::npos)
+        {
+            format = job.input.substr(dot + 1);
+        }
+    }
+    std::transform(format.begin(), format.end(), format.begin(), ::tolower);
+    return format;
+}
+
+std::uint64_t input_bytes(const Job& job)
+{
+    struct stat info;
+    return !job.input.empty() ? (::stat(job.input.c_str(), &info) == 0 ? info.st_size : 0) : job.data.size();
+}
+
+// Passes output through to a sink while keeping a copy of it, until the
+// copy would grow past max_bytes, when it is dropped.
+class CopyingBuffer : public std::streambuf
+{
+public:
+    CopyingBuffer(std::streambuf* pSink, std::uint64_t max_bytes)
+        : mpSink(pSink), mMaxBytes(max_bytes), mKeeping(true), mBuffer(64 * 1024)
+    {
+        setp(mBuffer.data(), mBuffer.data() + mBuffer.size());
+    }
+
+    // Everything written, or null if it was too big to keep. Call after
+    // pubsync.
+    std::shared_ptr<const std::string> copy() const
+    {
+        return mKeeping ? std::make_shared<const std::string>(mCopy) : nullptr;
+    }
+
+protected:
+    int_type overflow(int_type c) override
+    {
+        if (!flush())
+        {
+            return traits_type::eof();
+        }
+        if (!traits_type::eq_int_type(c, traits_type::eof()))
+        {
+            *pptr() = traits_type::to_char_type(c);
+            pbump(1);
+        }
+        return traits_type::not_eof(c);
+    }
+
+    int sync() override
+    {
+        return flush() ? 0 : -1;
+    }
+
+private:
+    bool flush()
+    {
+        const std::streamsize size = pptr() - pbase();
+        if (mKeeping && mCopy.size() + size <= mMaxBytes)
+        {
+            mCopy.append(pbase(), size);
+        }
+        else
+        {
+            mKeeping = false;
+            std::string().swap(mCopy);
+        }
+        const bool written = mpSink->sputn(pbase(), size) == size;
+        setp(mBuffer.data(), mBuffer.data() + mBuffer.size());
+        return written;
+    }
+
+    std::streambuf* mpSink;
+    std::uint64_t mMaxBytes;
+    bool mKeeping;
+    std::string mCopy;
+    std::vector<char> mBuffer;
+};
+
+// Converts job on a worker's warm converter. Results for an output path go
+// through a temporary file renamed into place, as in watch mode.
+void run_job(Converter& converter, int write_buffers, Job& job)
+{
+    auto start = std::chrono::steady_clock::now();
+
+    const ConvertSettings& settings = job.settings;
+    ConvertResult result;
+    bool converted = false;
+    bool written = false;
+
+    auto convert = [&](std::streambuf* pSink) {
+        std::unique_ptr<CompressingOutputBuffer> compressor;
+        if (settings.compression.codec != Codec::None)
+        {
+            compressor.reset(new CompressingOutputBuffer(pSink, settings.compression));
+        }
+        std::ostream output(compressor ? static_cast<std::streambuf*>(compressor.get()) : pSink);
+
+        converted = job.input.empty()
+                ? converter.convert_memory(job.data.data(), job.data.size(), settings.hint, settings.convert,
+                        settings.format, output, result)
+                : converter.convert_file(job.input, settings.convert, settings.format, output, result);
+        written = (!compressor || compressor->finish()) && static_cast<bool>(output);
+    };
+
+    if (job.output.empty())
+    {
+        std::stringbuf buffer(std::ios::out);
+        convert(&buffer);
+        job.bytes = std::make_shared<const std::string>(buffer.str());
+        job.size = job.bytes->size();
+    }
+    else
+    {
+        std::string temp_name;
+        int fd = open_replacement(job.output, temp_name, job.error);
+        if (fd < 0)
+        {
+            job.error = "Failed to open file: " + job.output + ": " + job.error;
+            return;
+        }
+
+        std::shared_ptr<const std::string> copy;
+        {
+            FdOutputBuffer buffer(fd, true, FdOutputBuffer::kDefaultCapacity, write_buffers);
+            if (job.keep_bytes > 0)
+            {
+                CopyingBuffer copying(&buffer, job.keep_bytes);
+                convert(&copying);
+                written = copying.pubsync() == 0 && written;
+                copy = copying.copy();
+            }
+            else
+            {
+                convert(&buffer);
+            }
+
+            // Whatever the writer thread had not drained yet.
+            auto closing = std::chrono::steady_clock::now();
+            written = buffer.close() && written;
+            result.phases.write += std::chrono::duration<double>(std::chrono::steady_clock::now() - closing).count();
+        }
+
+        struct stat info;
+        std::string error;
+        if (converted && written && replace_output(temp_name, job.output, error)
+                && ::stat(job.output.c_str(), &info) == 0)
+        {
+            job.size = info.st_size;
+            job.bytes = copy;
+        }
+        else
+        {
+            std::remove(temp_name.c_str());
+            written = false;
+        }
+    }
+
+    job.ok = converted && written;
+    if (!converted)
+    {
+        job.error = result.error.empty() ? "Something went wrong importing scene" : result.error;
+    }
+    else if (!written)
+    {
+        job.error = "Failed to write " + (job.output.empty() ? std::string("the result") : job.output);
+    }
+    job.timings = result.timings;
+    job.inputs = result.input_files;
+    job.input_stamps = result.input_stamps;
+    job.phases = result.phases;
+    job.service_seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+// Fixed set of conversion threads, each with its own Converter, taking jobs
+// in the order the schedule policy picks from their estimated cost, client
+// and deadline. The destructor lets queued jobs finish.
+class WorkerPool
+{
+public:
+    WorkerPool(unsigned int count, int write_buffers, SchedulePolicy policy)
+        : mWriteBuffers(write_buffers), mQueue(policy), mBusy(0), mStopping(false)
+    {
+        for (unsigned int i = 0; i < count; ++i)
+        {
+            mThreads.emplace_back([this] { work(); });
+        }
+    }
+
+    ~WorkerPool()
+    {
+        {
+            std::lock_guard<std::mutex> lock(mMutex);
+            mStopping = true;
+        }
+        mQueued.notify_all();
+        for (std::thread& thread : mThreads)
+        {
+            thread.join();
+        }
+    }
+
+    WorkerPool(const WorkerPool&) = delete;
+    WorkerPool& operator=(const WorkerPool&) = delete;
+
+    unsigned int size() const
+    {
+        return static_cast<unsigned int>(mThreads.size());
+    }
+
+    // Jobs waiting for a worker, and workers converting.
+    std::uint64_t depth() const
+    {
+        std::lock_guard<std::mutex> lock(mMutex);
+        return mQueue.size();
+    }
+
+    unsigned int busy() const
+    {
+        std::lock_guard<std::mutex> lock(mMutex);
+        return mBusy;
+    }
+
+    // Queues job and blocks until a worker has run it.
+    void run(Job& job)
+    {
+        const std::uint64_t bytes = input_bytes(job);
+        job.input_size = bytes;
+        job.cost = mCosts.estimate(job.input, job_format(job), bytes);
+
+        Pending pending { &job, bytes, false };
+        ScheduledQueue<Pending*>::Ticket ticket;
+        ticket.cost = job.cost;
+        ticket.client = job.client;
+        ticket.deadline = job.deadline;
+
+        std::unique_lock<std::mutex> lock(mMutex);
+        mQueue.push(&pending, ticket);
+        mQueued.notify_one();
+        mFinished.wait(lock, [&] { return pending.done; });
+    }
+
+private:
+    struct Pending
+    {
+        Job* pJob;
+        std::uint64_t bytes;
+        bool done;
+    };
+
+    void work()
+    {
+        Converter converter;
+
+        std::unique_lock<std::mutex> lock(mMutex);
+        for (;;)
+        {
+            mQueued.wait(lock, [this] { return mStopping || !mQueue.empty(); });
+            if (mQueue.empty())
+            {
+                return;
+            }
+
+            std::chrono::steady_clock::time_point queued;
+            Pending* pPending = mQueue.pop(queued);
+            Job& job = *pPending->pJob;
+            job.queue_seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - queued).count();
+
+            ++mBusy;
+            lock.unlock();
+            run_job(converter, mWriteBuffers, job);
+            if (job.ok)
+            {
+                mCosts.record(job.input, job_format(job), pPending->bytes, job.service_seconds);
+            }
+            lock.lock();
+
+            --mBusy;
+            mQueue.settle(job.client, job.cost, job.service_seconds);
+            pPending->done = true;
+            mFinished.notify_all();
+        }
+    }
+
+    int mWriteBuffers;
+    CostModel mCosts;
+
+    mutable std::mutex mMutex;
+    std::condition_variable mQueued;
+    std::condition_variable mFinished;
+    ScheduledQueue<Pending*> mQueue;
+    unsigned int mBusy;
+    bool mStopping;
+    std::vector<std::thread> mThreads;
+};
+
+// Writes bytes to path through a temporary file renamed into place.
+bool write_output(const std::string& path, const std::string& bytes, std::string& error)
+{
+    std::string temp_name;
+    int fd = open_replacement(path, temp_name, error);
+    if (fd < 0)
+    {
+        error = "Failed to open file: " + path + ": " + error;
+        return false;
+    }
+
+    bool written = false;
+    {
+        FdOutputBuffer buffer(fd, true, FdOutputBuffer::kDefaultCapacity, 1);
+        written = buffer.sputn(bytes.data(), bytes.size()) == static_cast<std::streamsize>(bytes.size());
+        written = buffer.close() && written;
+    }
+
+    if (!written || !replace_output(temp_name, path, error))
+    {
+        std::remove(temp_name.c_str());
+        error = "Failed to write " + path;
+        return false;
+    }
+    return true;
+}
+
+// Everything that decides job's output: the path and identity of the input
+// file, or the hash of the bytes sent, and the options. Empty when the input
+// file cannot be stat'ed, which leaves the error to the conversion.
+std::string result_key(const Job& job)
+{
+    const ConvertSettings& settings = job.settings;
+
+    std::ostringstream key;
+    if (job.input.empty())
+    {
+        key << "data=" << hash_bytes(job.data.data(), job.data.size()) << "," << job.data.size();
+    }
+    else
+    {
+        FileStamp stamp;
+        if (!stamp_file(job.input, stamp))
+        {
+            return std::string();
+        }
+        key << "file=" << job.input << "," << stamp.device << "," << stamp.inode << "," << stamp.size << ","
+            << stamp.mtime_ns;
+    }
+
+    key << ";" << describe_options(settings.convert) << ";format=" << static_cast<int>(settings.format)
+        << ";compress=" << static_cast<int>(settings.compression.codec) << "," << settings.compression.level
+        << ";hint=" << settings.hint;
+    return key.str();
+}
+
+// Answers job from the result cache, converting on the pool only when no
+// stored or in-flight conversion matches. A conversion for job.output is
+// written there directly, keeping a copy for the cache only if it fits; one
+// that did not fit is made again for any request that was waiting on it.
+void run_cached(WorkerPool& pool, ResultCache& cache, Job& job)
+{
+    auto start = std::chrono::steady_clock::now();
+
+    const std::string key = result_key(job);
+    if (key.empty())
+    {
+        pool.run(job);
+        return;
+    }
+
+    auto produce = [&] {
+        Job work;
+        work.settings = job.settings;
+        work.settings.convert.record_inputs = true;
+        work.input = job.input;
+        work.output = job.output;
+        work.keep_bytes = cache.max_bytes();
+        work.client = job.client;
+        work.deadline = job.deadline;
+        work.data.swap(job.data);
+        pool.run(work);
+        work.data.swap(job.data);
+
+        job.timings = work.timings;
+        job.phases = work.phases;
+        job.input_size = work.input_size;
+        job.queue_seconds = work.queue_seconds;
+        job.service_seconds = work.service_seconds;
+        job.ok = work.ok;
+        job.error = work.error;
+        job.size = work.size;
+
+        // Stamped as each input was opened, so a change made during the
+        // conversion shows on the next lookup.
+        ResultCache::Result result;
+        result.error = work.error;
+        if (work.ok)
+        {
+            result.bytes = work.bytes;
+        }
+        result.inputs = work.input_stamps;
+        return result;
+    };
+
+    bool produced = false;
+    std::shared_ptr<const ResultCache::Result> result = cache.get(key, produce, produced);
+    if (produced && !job.output.empty())
+    {
+        // produce wrote job.output itself.
+        return;
+    }
+    if (!result->bytes && result->error.empty())
+    {
+        // Another request's result, too big to have been kept.
+        pool.run(job);
+        return;
+    }
+
+    job.cached = !produced;
+    job.error = result->error;
+    if (result->bytes)
+    {
+        job.size = result->bytes->size();
+        if (job.output.empty())
+        {
+            job.bytes = result->bytes;
+            job.ok = true;
+        }
+        else
+        {
+            job.ok = write_output(job.output, *result->bytes, job.error);
+        }
+    }
+    if (!produced)
+    {
+        job.service_seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    }
+}
+
+// Fills job from a request frame, reading the frame of model bytes that
+// follows one without "input". False with job.error set for a bad request;
+// connection_ok is cleared when the connection can no longer be trusted to
+// be at a frame boundary.
+bool parse_request(int fd, const std::string& text, const ServeOptions& options, const std::string& client,
+        Job& job, bool& connection_ok)
+{
+    const std::chrono::steady_clock::time_point arrived = std::chrono::steady_clock::now();
+
+    nlohmann::json request;
+    try
+    {
+        request = nlohmann::json::parse(text);
+    }
+    catch (const std::exception& e)
+    {
+        job.error = std::string("Bad request: ") + e.what();
+        connection_ok = false;
+        return false;
+    }
+
+    if (!request.is_object())
+    {
+        job.error = "Bad request: expected an object";
+        connection_ok = false;
+        return false;
+    }
+
+    auto input = request.find("input");
+    if (input == request.end())
+    {
+        const std::uint32_t max_size = static_cast<std::uint32_t>(
+                std::min<std::uint64_t>(options.max_input_bytes, UINT32_MAX));
+        std::uint32_t size = 0;
+        if (!read_frame(fd, job.data, max_size, &size))
+        {
+            job.error = size > max_size
+                ? "Bad request: model of " + std::to_string(size) + " bytes is over the "
+                    + std::to_string(max_size) + " byte limit (--max-input-size)"
+                : "Bad request: missing model bytes";
+            connection_ok = false;
+            return false;
+        }
+    }
+    else if (input->is_string())
+    {
+        job.input = input->get<std::string>();
+    }
+    else
+    {
+        job.error = "Bad request: \"input\" must be a string";
+        return false;
+    }
+
+    job.settings = options.defaults;
+    job.settings.explicit_steps = false;
+
+    auto hint = request.find("hint");
+    if (hint != request.end() && hint->is_string())
+    {
+        job.settings.hint = hint->get<std::string>();
+    }
+
+    auto output = request.find("output");
+    if (output != request.end() && output->is_string())
+    {
+        job.output = output->get<std::string>();
+    }
+
+    auto name = request.find("client");
+    job.client = name != request.end() && name->is_string() ? name->get<std::string>() : client;
+
+    auto deadline = request.find("deadline_ms");
+    if (deadline != request.end() && deadline->is_number())
+    {
+        job.deadline = arrived + std::chrono::microseconds(static_cast<std::int64_t>(deadline->get<double>() * 1000.0));
+    }
+
+    auto args = request.find("args");
+    if (args != request.end())
+    {
+        if (!args->is_array())
+        {
+            job.error = "Bad request: \"args\" must be an array";
+            return false;
+        }
+
+        for (const nlohmann::json& arg : *args)
+        {
+            const std::string option = arg.is_string() ? arg.get<std::string>() : arg.dump();
+            const std::string::size_type equals = option.find('=');
+            const std::string name = option.substr(0, equals);
+            const std::string value = equals == std::string::npos ? "" : option.substr(equals + 1);
+
+            OptionResult applied = apply_option(name, value, job.settings, job.error);
+            if (applied == OptionResult::Unknown)
+            {
+                job.error = "Unknown option: " + option;
+            }
+            if (applied != OptionResult::Applied)
+            {
+                return false;
+            }
+        }
+    }
+
+    return true;
+}
+
+nlohmann::json make_response(const Job& job)
+{
+    nlohmann::json response = { {"ok", job.ok} };
+    if (!job.ok)
+    {
+        response["error"] = job.error;
+        return response;
+    }
+
+    response["size"] = job.size;
+    response["queue_ms"] = job.queue_seconds * 1000.0;
+    response["service_ms"] = job.service_seconds * 1000.0;
+    if (job.cached)
+    {
+        response["cached"] = true;
+    }
+    if (!job.output.empty())
+    {
+        response["output"] = job.output;
+    }
+    if (job.settings.convert.timings)
+    {
+        nlohmann::json timings = nlohmann::json::array();
+        for (const StepTiming& timing : job.timings)
+        {
+            timings.push_back({ {"name", timing.name}, {"ms", timing.seconds * 1000.0} });
+        }
+        response["timings"] = timings;
+    }
+    return response;
+}
+
+std::string describe_job(const Job& job)
+{
+    std::ostringstream line;
+    line << (job.input.empty() ? std::to_string(job.data.size()) + " bytes" : job.input) << " -> "
+         << (job.output.empty() ? std::to_string(job.size) + " bytes" : job.output);
+    if (job.ok)
+    {
+        line << ": " << job.service_seconds * 1000.0 << " ms" << (job.cached ? " (cached)" : "");
+        line << ", queued " << job.queue_seconds * 1000.0 << " ms";
+    }
+    else
+    {
+        line << ": " << job.error;
+    }
+    return line.str();
+}
+
+// Answers requests on one connection until the client hangs up, sends
+// something unreadable or the server stops. pCache is null when caching
+// is off.
+void serve_connection(int fd, const ServeOptions& options, WorkerPool& pool, ResultCache* pCache,
+        ServerMetrics& metrics)
+{
+    timeval timeout { kReceiveTimeoutSeconds, 0 };
+    ::setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+
+    // Requests without a "client" share fairly by process.
+    ucred peer = {};
+    socklen_t peer_size = sizeof(peer);
+    const std::string client = ::getsockopt(fd, SOL_SOCKET, SO_PEERCRED, &peer, &peer_size) == 0
+            ? "pid:" + std::to_string(peer.pid) : "fd:" + std::to_string(fd);
+
+    std::string text;
+    while (wait_readable(fd) && read_frame(fd, text, kMaxRequestSize))
+    {
+        Job job;
+        bool connection_ok = true;
+        if (parse_request(fd, text, options, client, job, connection_ok))
+        {
+            if (pCache)
+            {
+                run_cached(pool, *pCache, job);
+            }
+            else
+            {
+                pool.run(job);
+            }
+        }
+
+        // Rejected requests count as errors too.
+        log_line(describe_job(job));
+        metrics.record(job.settings.format, job.ok, job.cached, job.input_size, job.size, job.queue_seconds,
+                job.service_seconds, job.phases);
+
+        if (!send_json(fd, make_response(job)) || (job.ok && job.output.empty()
+                && !send_frame(fd, job.bytes->data(), job.bytes->size())))
+        {
+            break;
+        }
+        if (!connection_ok)
+        {
+            break;
+        }
+    }
+    ::close(fd);
+}
+
+// Binds the socket, replacing a file left behind by a server that is gone
+// but refusing to take over from one still answering.
+int listen_on(const std::string& path, std::string& error)
+{
+    sockaddr_un address = {};
+    address.sun_family = AF_UNIX;
+    if (path.size() >= sizeof(address.sun_path))
+    {
+        error = path + ": path too long for a socket";
+        return -1;
+    }
+    std::strcpy(address.sun_path, path.c_str());
+
+    int fd = ::socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0)
+    {
+        error = std::strerror(errno);
+        return -1;
+    }
+
+    if (::access(path.c_str(), F_OK) == 0)
+    {
+        int probe = ::socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        bool live = probe >= 0 && ::connect(probe, reinterpret_cast<sockaddr*>(&address), sizeof(address)) == 0;
+        if (probe >= 0)
+        {
+            ::close(probe);
+        }
+        if (live)
+        {
+            ::close(fd);
+            error = path + ": another server is listening";
+            return -1;
+        }
+        ::unlink(path.c_str());
+    }
+
+    if (::bind(fd, reinterpret_cast<sockaddr*>(&address), sizeof(address)) != 0 || ::listen(fd, SOMAXCONN) != 0)
+    {
+        error = path + ": " + std::strerror(errno);
+        ::close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+}
+
+// Listens on a loopback TCP port for "<port>" or "<host>:<port>" with an
+// IPv4 host, and on a Unix domain socket for anything else.
+int listen_metrics(const std::string& address, std::string& error)
+{
+    const std::string::size_type colon = address.rfind(':');
+    const std::string port = colon == std::string::npos ? address : address.substr(colon + 1);
+    const bool numeric = !port.empty() && port.find_first_not_of("0123456789") == std::string::npos;
+    if (!numeric || address.find('/') != std::string::npos)
+    {
+        return listen_on(address, error);
+    }
+
+    const unsigned long number = port.size() <= 5 ? std::strtoul(port.c_str(), nullptr, 10) : 0;
+    if (number == 0 || number > 65535)
+    {
+        error = address + ": port out of range";
+        return -1;
+    }
+
+    sockaddr_in inet = {};
+    inet.sin_family = AF_INET;
+    inet.sin_port = htons(static_cast<std::uint16_t>(number));
+    const std::string host = colon == std::string::npos ? "127.0.0.1" : address.substr(0, colon);
+    if (::inet_pton(AF_INET, host.c_str(), &inet.sin_addr) != 1)
+    {
+        error = address + ": expected <port>, <ipv4>:<port> or a socket path";
+        return -1;
+    }
+
+    int fd = ::socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    int reuse = 1;
+    if (fd < 0 || ::setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse)) != 0
+            || ::bind(fd, reinterpret_cast<sockaddr*>(&inet), sizeof(inet)) != 0 || ::listen(fd, SOMAXCONN) != 0)
+    {
+        error = address + ": " + std::strerror(errno);
+        if (fd >= 0)
+        {
+            ::close(fd);
+        }
+        return -1;
+    }
+    return fd;
+}
+
+// Answers HTTP GET /metrics on listener with what metrics() writes, one
+// connection at a time, until the server stops.
+void serve_metrics(int listener, const std::function<void(std::ostream&)>& metrics)
+{
+    pollfd descriptor { listener, POLLIN, 0 };
+    while (!gStop)
+    {
+        if (::poll(&descriptor, 1, 250) <= 0)
+        {
+            continue;
+        }
+
+        int fd = ::accept4(listener, nullptr, nullptr, SOCK_CLOEXEC);
+        if (fd < 0)
+        {
+            continue;
+        }
+
+        timeval timeout { 2, 0 };
+        ::setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+
+        std::string request;
+        char buffer[1024];
+        while (request.find("\r\n\r\n") == std::string::npos && request.size() < 8192)
+        {
+            ssize_t count = ::recv(fd, buffer, sizeof(buffer), 0);
+            if (count <= 0)
+            {
+                break;
+            }
+            request.append(buffer, count);
+        }
+
+        std::string status = "404 Not Found";
+        std::string body = "Not found\n";
+        if (request.compare(0, 13, "GET /metrics ") == 0 || request.compare(0, 14, "GET /metrics?") == 0)
+        {
+            std::ostringstream text;
+            metrics(text);
+            status = "200 OK";
+            body = text.str();
+        }
+
+        const std::string response = "HTTP/1.1 " + status + "\r\n"
+                "Content-Type: text/plain; version=0.0.4\r\n"
+                "Content-Length: " + std::to_string(body.size()) + "\r\n"
+                "Connection: close\r\n\r\n" + body;
+        send_all(fd, response.data(), response.size());
+        ::close(fd);
+    }
+}
+
+int run_server(const ServeOptions& options)
+{
+    std::string error;
+    int listener = listen_on(options.socket_path, error);
+    if (listener < 0)
+    {
+        std::cerr << "Error: " << error << std::endl;
+        return 1;
+    }
+
+    struct sigaction action = {};
+    action.sa_handler = request_stop;
+    ::sigaction(SIGINT, &action, nullptr);
+    ::sigaction(SIGTERM, &action, nullptr);
+    ::signal(SIGPIPE, SIG_IGN);
+
+    const unsigned int workers = options.workers != 0
+            ? options.workers : std::max(1u, std::thread::hardware_concurrency());
+
+    int metrics_listener = -1;
+    if (!options.metrics_address.empty())
+    {
+        metrics_listener = listen_metrics(options.metrics_address, error);
+        if (metrics_listener < 0)
+        {
+            std::cerr << "Error: " << error << std::endl;
+            ::close(listener);
+            ::unlink(options.socket_path.c_str());
+            return 1;
+        }
+    }
+
+    std::unique_ptr<ResultCache> cache;
+    if (options.cache_bytes != 0)
+    {
+        cache.reset(new ResultCache(options.cache_bytes));
+    }
+
+    std::mutex mutex;
+    std::condition_variable closed;
+    unsigned int connections = 0;
+    {
+        WorkerPool pool(workers, options.write_buffers, options.schedule);
+        ServerMetrics metrics;
+
+        std::thread metrics_thread;
+        if (metrics_listener >= 0)
+        {
+            metrics_thread = std::thread(serve_metrics, metrics_listener, [&](std::ostream& output) {
+                ServerGauges gauges;
+                gauges.queue_depth = pool.depth();
+                gauges.workers = pool.size();
+                gauges.busy_workers = pool.busy();
+                {
+                    std::lock_guard<std::mutex> lock(mutex);
+                    gauges.connections = connections;
+                }
+                gauges.caching = cache != nullptr;
+                if (cache)
+                {
+                    gauges.cache = cache->stats();
+                }
+                metrics.write(output, gauges);
+            });
+        }
+
+        log_line("Serving on " + options.socket_path + " (" + std::to_string(workers) + " workers)");
+
+        pollfd descriptor { listener, POLLIN, 0 };
+        while (!gStop)
+        {
+            int ready = ::poll(&descriptor, 1, 250);
+            if (ready <= 0)
+            {
+                continue;
+            }
+
+            int fd = ::accept4(listener, nullptr, nullptr, SOCK_CLOEXEC);
+            if (fd < 0)
+            {
+                continue;
+            }
+
+            std::unique_lock<std::mutex> lock(mutex);
+            if (connections >= options.max_connections)
+            {
+                lock.unlock();
+                send_json(fd, { {"ok", false}, {"error", "Too many connections"} });
+                ::close(fd);
+                continue;
+            }
+            ++connections;
+
+            std::thread([&, fd] {
+                serve_connection(fd, options, pool, cache.get(), metrics);
+
+                // Notified under the lock: run_server may return as soon as
+                // it sees the count reach zero.
+                std::lock_guard<std::mutex> guard(mutex);
+                --connections;
+                closed.notify_all();
+            }).detach();
+        }
+
+        ::close(listener);
+        ::unlink(options.socket_path.c_str());
+
+        // Connections notice the stop between requests; ones mid-request
+        // get their answer first.
+        std::unique_lock<std::mutex> lock(mutex);
+        closed.wait(lock, [&] { return connections == 0; });
+        lock.unlock();
+
+        if (metrics_thread.joinable())
+        {
+            metrics_thread.join();
+            ::close(metrics_listener);
+            if (options.metrics_address.find('/') != std::string::npos)
+            {
+                ::unlink(options.metrics_address.c_str());
+            }
+        }
+    }
+
+    if (cache)
+    {
+        const CacheStats stats = cache->stats();
+        std::ostringstream line;
+        line << "Memory cache: " << stats.hits << " hits, " << stats.coalesced << " coalesced, " << stats.misses
+             << " misses, " << stats.entries << " entries, " << stats.bytes / 1048576.0 << " MiB";
+        log_line(line.str());
+    }
+
+    log_line("Stopped serving on " + options.socket_path);
+    return 0;
+}
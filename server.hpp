@@ -0,0 +1,70 @@
+#pragma once
+
+#include "options.hpp"
+#include "schedule.hpp"
+
+#include <cstdint>
+#include <string>
+
+// atj serve: converts models for clients of a Unix domain socket on a fixed
+// pool of worker threads, each keeping its importer warm between requests.
+//
+// Every message is a frame: a 4-byte big-endian length, then that many bytes.
+// A client sends a JSON request frame, optionally followed by a frame of
+// model bytes, and may send further requests on the same connection once
+// each response has arrived:
+//
+//   {"input": "/abs/model.fbx"}               convert a file, or
+//   {"hint": "obj"}                           convert the bytes in the next frame
+//   "args": ["--format=cbor", ...]            conversion options as on the
+//                                             command line, applied on top of
+//                                             the server's own
+//   "output": "/abs/model.cbor"               write the result there instead
+//                                             of returning it
+//   "client": "importer-3"                    who to share workers fairly
+//                                             between (the peer's pid by
+//                                             default)
+//   "deadline_ms": 500                        for the deadline policy
+//
+// The response is a JSON frame, {"ok": true, "size": n} or {"ok": false,
+// "error": "..."}, with "queue_ms" and "service_ms" (time waiting for a
+// worker and converting), "output" echoed back, "cached": true for results
+// from the memory cache and "timings" (ms per step) when asked for with
+// --timings. A successful request without "output" is followed by one
+// frame holding the converted bytes.
+struct ServeOptions
+{
+    std::string socket_path;
+
+    // Starting point for every request.
+    ConvertSettings defaults;
+
+    // Conversion threads; zero for one per hardware thread.
+    unsigned int workers = 0;
+
+    // Order queued conversions start in.
+    SchedulePolicy schedule = SchedulePolicy::ShortestFirst;
+
+    // Connections served at once. Clients past this get an error response.
+    unsigned int max_connections = 64;
+
+    // Largest frame of model bytes accepted; bigger ones get an error
+    // response and the connection is closed. Models read from "input"
+    // paths are not limited.
+    std::uint64_t max_input_bytes = std::uint64_t(256) << 20;
+
+    int write_buffers = 4;
+
+    // Budget of the in-memory result cache, keyed by input file identity
+    // (device, inode, size, mtime) or content hash and the options; zero
+    // converts every request.
+    std::uint64_t cache_bytes = std::uint64_t(512) << 20;
+
+    // Where to answer HTTP GET /metrics in the Prometheus text format: a
+    // loopback port, "<ipv4>:<port>", or a Unix socket path. Empty for none.
+    std::string metrics_address;
+};
+
+// Serves until SIGINT or SIGTERM, then stops accepting, finishes the
+// requests already read and removes the socket. Returns the process exit code.
+int run_server(const ServeOptions& options);
@@ -0,0 +1,22 @@
+#pragma once
+
+#include <iostream>
+
+// Minimal assertions for the test executables. A failed CHECK prints the
+// expression and where it is; main returns the number of failures.
+
+inline int& check_failures()
+{
+    static int failures = 0;
+    return failures;
+}
+
+#define CHECK(expression) \
+    do \
+    { \
+        if (!(expression)) \
+        { \
+            std::cerr << __FILE__ << ":" << __LINE__ << ": CHECK(" #expression ") failed" << std::endl; \
+            ++check_failures(); \
+        } \
+    } while (false)
@@ -0,0 +1,309 @@
+#include "animation.hpp"
+
+#include "check.hpp"
+
+#include <assimp/scene.h>
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <vector>
+
+namespace
+{
+
+// From the chord between a and the nearer of b and -b, which unlike acos
+// of the dot product stays exact for the tiny angles packing loses.
+double rotation_angle(const aiQuaternion& a, const aiQuaternion& b)
+{
+    const double dot = a.x * b.x + a.y * b.y + a.z * b.z + a.w * b.w;
+    const double sign = dot < 0.0 ? -1.0 : 1.0;
+    const double dw = a.w - sign * b.w;
+    const double dx = a.x - sign * b.x;
+    const double dy = a.y - sign * b.y;
+    const double dz = a.z - sign * b.z;
+    const double chord = std::sqrt(dw * dw + dx * dx + dy * dy + dz * dz);
+    return 4.0 * std::asin(std::min(chord / 2.0, 1.0));
+}
+
+// Unit quaternions spread over the sphere, from a fixed seed.
+std::vector<aiQuaternion> test_rotations()
+{
+    std::vector<aiQuaternion> rotations;
+    std::uint32_t seed = 12345;
+    auto next = [&seed]() {
+        seed = seed * 1664525u + 1013904223u;
+        return static_cast<float>(seed >> 8) / 16777216.f * 2.f - 1.f;
+    };
+    while (rotations.size() < 2000)
+    {
+        aiQuaternion q(next(), next(), next(), next());
+        const float length = std::sqrt(q.w * q.w + q.x * q.x + q.y * q.y + q.z * q.z);
+        if (length > 0.1f)
+        {
+            rotations.push_back(q.Normalize());
+        }
+    }
+
+    // Ties for the largest component, and the axes.
+    rotations.push_back(aiQuaternion(1.f, 0.f, 0.f, 0.f));
+    rotations.push_back(aiQuaternion(0.f, 0.f, 0.f, -1.f));
+    rotations.push_back(aiQuaternion(0.5f, 0.5f, -0.5f, 0.5f));
+    rotations.push_back(aiQuaternion(0.70710678f, 0.f, 0.70710678f, 0.f));
+    return rotations;
+}
+
+// Each kept component is off by at most half a quantization step, which
+// bounds the rotation error; q and -q pack the same.
+void rotation_packing_round_trips()
+{
+    const double range = std::sqrt(2.0);
+    const double bound32 = 4.0 * std::sqrt(3.0) * range / 1023.0 / 2.0;
+    const double bound48 = 4.0 * std::sqrt(3.0) * range / 32767.0 / 2.0;
+
+    for (const aiQuaternion& q : test_rotations())
+    {
+        const aiQuaternion negated(-q.w, -q.x, -q.y, -q.z);
+
+        const std::uint32_t packed32 = pack_rotation32(q);
+        CHECK(rotation_angle(unpack_rotation32(packed32), q) <= bound32);
+        CHECK(pack_rotation32(negated) == packed32);
+
+        std::uint16_t words[3];
+        std::uint16_t negated_words[3];
+        pack_rotation48(q, words);
+        pack_rotation48(negated, negated_words);
+        CHECK(rotation_angle(unpack_rotation48(words), q) <= bound48);
+        CHECK(std::equal(words, words + 3, negated_words));
+        CHECK((words[2] & 0x8000) == 0);
+    }
+}
+
+void to_half_edge_cases()
+{
+    CHECK(to_half(0.f) == 0x0000);
+    CHECK(to_half(-0.f) == 0x8000);
+    CHECK(to_half(1.f) == 0x3c00);
+    CHECK(to_half(-2.f) == 0xc000);
+
+    // Ties round to even.
+    CHECK(to_half(1.f + std::ldexp(1.f, -11)) == 0x3c00);
+    CHECK(to_half(1.f + 3.f * std::ldexp(1.f, -11)) == 0x3c02);
+
+    // The largest half, and past it infinity.
+    CHECK(to_half(65504.f) == 0x7bff);
+    CHECK(to_half(65520.f) == 0x7c00);
+    CHECK(to_half(1e6f) == 0x7c00);
+    CHECK(to_half(-1e6f) == 0xfc00);
+
+    // Denormals: the smallest normal, the largest and smallest denormal, and
+    // half the smallest, which ties down to zero.
+    CHECK(to_half(std::ldexp(1.f, -14)) == 0x0400);
+    CHECK(to_half(1023.f * std::ldexp(1.f, -24)) == 0x03ff);
+    CHECK(to_half(std::ldexp(1.f, -24)) == 0x0001);
+    CHECK(to_half(1.5f * std::ldexp(1.f, -25)) == 0x0001);
+    CHECK(to_half(std::ldexp(1.f, -25)) == 0x0000);
+    CHECK(to_half(-std::ldexp(1.f, -26)) == 0x8000);
+
+    CHECK(to_half(INFINITY) == 0x7c00);
+    CHECK(to_half(-INFINITY) == 0xfc00);
+    const std::uint16_t nan = to_half(NAN);
+    CHECK((nan & 0x7c00) == 0x7c00 && (nan & 0x03ff) != 0);
+}
+
+// Every key dropped can be rebuilt from the ones kept within tolerance.
+void reduced_tracks_stay_within_tolerance()
+{
+    const unsigned int count = 200;
+
+    aiNodeAnim* pChannel = new aiNodeAnim();
+    pChannel->mNodeName.Set("bone");
+    pChannel->mNumPositionKeys = count;
+    pChannel->mPositionKeys = new aiVectorKey[count];
+    pChannel->mNumRotationKeys = count;
+    pChannel->mRotationKeys = new aiQuatKey[count];
+
+    std::vector<aiVectorKey> positions(count);
+    std::vector<aiQuatKey> rotations(count);
+    for (unsigned int i = 0; i < count; ++i)
+    {
+        const double t = i * 0.05;
+        positions[i].mTime = t;
+        positions[i].mValue = aiVector3D(static_cast<float>(std::sin(t)), static_cast<float>(t), 0.f);
+        rotations[i].mTime = t;
+        const double half_angle = 0.01 * t * t;
+        rotations[i].mValue = aiQuaternion(static_cast<float>(std::cos(half_angle)), 0.f, 0.f,
+                static_cast<float>(std::sin(half_angle)));
+    }
+    std::copy(positions.begin(), positions.end(), pChannel->mPositionKeys);
+    std::copy(rotations.begin(), rotations.end(), pChannel->mRotationKeys);
+
+    aiAnimation* pAnimation = new aiAnimation();
+    pAnimation->mDuration = (count - 1) * 0.05;
+    pAnimation->mTicksPerSecond = 1.0;
+    pAnimation->mNumChannels = 1;
+    pAnimation->mChannels = new aiNodeAnim*[1] { pChannel };
+
+    aiScene* pScene = new aiScene();
+    pScene->mNumAnimations = 1;
+    pScene->mAnimations = new aiAnimation*[1] { pAnimation };
+
+    KeyframeTolerance tolerance;
+    tolerance.translation = 0.01;
+    tolerance.rotation = 0.005;
+    tolerance.scale = 0.01;
+    reduce_keyframes(pScene, tolerance);
+
+    CHECK(pChannel->mNumPositionKeys < count);
+    CHECK(pChannel->mNumRotationKeys < count);
+    for (unsigned int i = 0; i < count; ++i)
+    {
+        const aiVector3D position = sample_vector(pChannel->mPositionKeys, pChannel->mNumPositionKeys,
+                positions[i].mTime, aiVector3D());
+        CHECK((position - positions[i].mValue).Length() <= tolerance.translation + 1e-6);
+
+        const aiQuaternion rotation = sample_rotation(pChannel->mRotationKeys, pChannel->mNumRotationKeys,
+                rotations[i].mTime);
+        CHECK(rotation_angle(rotation, rotations[i].mValue) <= tolerance.rotation + 1e-4);
+    }
+
+    delete pScene;
+}
+
+// A root with one child node "bone", and a mesh per offset whose single bone
+// is that node, bound with the given x translation. Owned like an imported
+// scene, so deleting it frees everything.
+aiScene* skinned_scene(const std::vector<float>& offsets)
+{
+    aiScene* pScene = new aiScene();
+
+    aiNode* pBoneNode = new aiNode();
+    pBoneNode->mName.Set("bone");
+    pScene->mRootNode = new aiNode();
+    pScene->mRootNode->mName.Set("root");
+    pScene->mRootNode->mNumChildren = 1;
+    pScene->mRootNode->mChildren = new aiNode*[1] { pBoneNode };
+    pBoneNode->mParent = pScene->mRootNode;
+
+    pScene->mNumMeshes = static_cast<unsigned int>(offsets.size());
+    pScene->mMeshes = new aiMesh*[offsets.size()];
+    for (std::size_t m = 0; m < offsets.size(); ++m)
+    {
+        aiBone* pBone = new aiBone();
+        pBone->mName.Set("bone");
+        pBone->mOffsetMatrix.a4 = offsets[m];
+
+        aiMesh* pMesh = new aiMesh();
+        pMesh->mNumBones = 1;
+        pMesh->mBones = new aiBone*[1] { pBone };
+        pScene->mMeshes[m] = pMesh;
+    }
+
+    aiAnimation* pAnimation = new aiAnimation();
+    pAnimation->mName.Set("idle");
+    pAnimation->mDuration = 0.0;
+    pAnimation->mTicksPerSecond = 1.0;
+    pScene->mNumAnimations = 1;
+    pScene->mAnimations = new aiAnimation*[1] { pAnimation };
+
+    return pScene;
+}
+
+// A bone bound with different offsets in two meshes needs one matrix per
+// offset; with the same offset the meshes share it.
+void skinning_keeps_offsets_per_mesh()
+{
+    aiScene* pScene = skinned_scene({ 1.f, 2.f });
+    nlohmann::json baked = bake_skinning(pScene, 30.0, false);
+    CHECK(baked["num_bones"] == 2);
+    CHECK(baked["mesh_bones"] == nlohmann::json({ { 0 }, { 1 } }));
+
+    const nlohmann::json& matrices = baked["animations"][0]["matrices"];
+    CHECK(matrices.size() == 24);
+    CHECK(matrices[3] == 1.0);
+    CHECK(matrices[15] == 2.0);
+    delete pScene;
+
+    pScene = skinned_scene({ 1.f, 1.f });
+    baked = bake_skinning(pScene, 30.0, false);
+    CHECK(baked["num_bones"] == 1);
+    CHECK(baked["mesh_bones"] == nlohmann::json({ { 0 }, { 0 } }));
+    delete pScene;
+}
+
+// Frame times count frames at the encoding's rate, whatever the ticks are.
+void frame_times_convert_ticks()
+{
+    aiVectorKey keys[3];
+    keys[0].mTime = 0.0;
+    keys[1].mTime = 480.0;
+    keys[2].mTime = 1000.0;
+
+    TrackEncoding encoding;
+    encoding.times = KeyTimes::Frames;
+    encoding.frame_rate = 24.0;
+    nlohmann::json track = encode_track(keys, 3, 960.0, encoding);
+    CHECK(track["times"] == nlohmann::json({ 0, 12, 25 }));
+}
+
+// A 1.1 second animation sampled at 2 fps ends with a sample at 1.1, or at
+// whole frame 3 when times are frame numbers, and a rotation key stored as
+// -q comes out in the hemisphere of the ones before.
+void sampling_keeps_end_and_hemisphere()
+{
+    aiQuatKey rotations[2];
+    rotations[0].mTime = 0.0;
+    rotations[0].mValue = aiQuaternion(1.f, 0.f, 0.f, 0.f);
+    rotations[1].mTime = 1.1;
+    rotations[1].mValue = aiQuaternion(-0.99f, -0.141f, 0.f, 0.f);
+
+    aiNodeAnim channel;
+    channel.mNodeName.Set("bone");
+    channel.mNumRotationKeys = 2;
+    channel.mRotationKeys = rotations;
+
+    aiAnimation animation;
+    animation.mDuration = 1.1;
+    animation.mTicksPerSecond = 1.0;
+    aiNodeAnim* channels[] = { &channel };
+    animation.mNumChannels = 1;
+    animation.mChannels = channels;
+
+    nlohmann::json sampled = sample_animation(&animation, 2.0, TrackEncoding());
+    CHECK(sampled["num_frames"] == 4);
+    CHECK(sampled["times"].size() == 4 && std::abs(sampled["times"][3].get<double>() - 1.1) < 1e-9);
+
+    const nlohmann::json values = sampled["channels"][0]["rotations"];
+    CHECK(values.size() == 16);
+    for (std::size_t f = 0; f < 4 && values.size() == 16; ++f)
+    {
+        CHECK(values[f * 4 + 3].get<float>() > 0.f);
+    }
+
+    TrackEncoding frames;
+    frames.times = KeyTimes::Frames;
+    sampled = sample_animation(&animation, 2.0, frames);
+    CHECK(sampled["times"] == nlohmann::json({ 0, 1, 2, 3 }));
+    CHECK(sampled["channels"][0]["rotations"].size() == 16
+            && sampled["channels"][0]["rotations"][12] == values[12]
+            && sampled["channels"][0]["rotations"][15] == values[15]);
+
+    // Owned by the stack, not the node animation and animation.
+    channel.mRotationKeys = nullptr;
+    channel.mNumRotationKeys = 0;
+    animation.mChannels = nullptr;
+    animation.mNumChannels = 0;
+}
+
+}
+
+int main()
+{
+    rotation_packing_round_trips();
+    to_half_edge_cases();
+    reduced_tracks_stay_within_tolerance();
+    skinning_keeps_offsets_per_mesh();
+    frame_times_convert_ticks();
+    sampling_keeps_end_and_hemisphere();
+    return check_failures();
+}
@@ -0,0 +1,131 @@
+#include "cache.hpp"
+
+#include "check.hpp"
+
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <unistd.h>
+
+#include <cstdlib>
+#include <ctime>
+#include <fstream>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace
+{
+
+void set_age(const std::string& path, time_t seconds)
+{
+    struct timeval times[2] = {};
+    times[0].tv_sec = times[1].tv_sec = ::time(nullptr) - seconds;
+    ::utimes(path.c_str(), times);
+}
+
+bool exists(const std::string& path)
+{
+    return ::access(path.c_str(), F_OK) == 0;
+}
+
+// Temporary files and staging directories left behind by a crashed run are
+// cleared when the cache is opened; ones still being written are kept.
+void open_removes_stale_temps()
+{
+    char directory[] = "/tmp/atj-test-XXXXXX";
+    CHECK(::mkdtemp(directory) != nullptr);
+    const std::string stale_file = std::string(directory) + "/tmp.1.1";
+    const std::string stale_directory = std::string(directory) + "/tmp.1.2";
+    const std::string fresh_file = std::string(directory) + "/tmp.2.1";
+
+    std::ofstream(stale_file) << "partial";
+    CHECK(::mkdir(stale_directory.c_str(), 0755) == 0);
+    std::ofstream(stale_directory + "/output") << "partial";
+    std::ofstream(fresh_file) << "partial";
+    set_age(stale_file, 2 * 60 * 60);
+    set_age(stale_directory, 2 * 60 * 60);
+
+    ConversionCache cache(directory, 1 << 20);
+    std::string error;
+    CHECK(cache.open(error));
+
+    CHECK(!exists(stale_file));
+    CHECK(!exists(stale_directory));
+    CHECK(exists(fresh_file));
+
+    std::remove(fresh_file.c_str());
+    ::rmdir(directory);
+}
+
+// An entry made while a referenced file was missing is stale once the file
+// is created.
+void entries_expire_when_absent_files_appear()
+{
+    char directory[] = "/tmp/atj-test-XXXXXX";
+    CHECK(::mkdtemp(directory) != nullptr);
+    const std::string cache_directory = std::string(directory) + "/cache";
+    const std::string output = std::string(directory) + "/output";
+    const std::string material = std::string(directory) + "/model.mtl";
+
+    ConversionCache cache(cache_directory, 1 << 20);
+    std::string error;
+    CHECK(cache.open(error));
+
+    std::ofstream(output) << "converted";
+    CHECK(cache.store("key", CacheArtifacts { { "output", output } }, {}, { material }, error));
+
+    std::vector<std::string> absent;
+    CHECK(cache.lookup("key", nullptr, &absent));
+    CHECK(absent.size() == 1 && absent[0] == material);
+
+    std::ofstream(material) << "newmtl red";
+    CHECK(!cache.lookup("key"));
+    CHECK(!exists(cache.artifact_path("key", "output")));
+
+    std::remove(material.c_str());
+    std::remove(std::string(cache_directory + "/stats").c_str());
+    ::rmdir(cache_directory.c_str());
+    ::rmdir(directory);
+}
+
+// The same for results kept in memory.
+void results_expire_when_absent_files_appear()
+{
+    char directory[] = "/tmp/atj-test-XXXXXX";
+    CHECK(::mkdtemp(directory) != nullptr);
+    const std::string material = std::string(directory) + "/model.mtl";
+
+    ResultCache cache(1 << 20);
+    auto produce = [&] {
+        ResultCache::Result result;
+        result.bytes = std::make_shared<const std::string>("converted");
+        FileStamp stamp;
+        stamp.path = material;
+        stamp.exists = false;
+        result.inputs.push_back(stamp);
+        return result;
+    };
+
+    bool produced = false;
+    cache.get("key", produce, produced);
+    CHECK(produced);
+    cache.get("key", produce, produced);
+    CHECK(!produced);
+
+    std::ofstream(material) << "newmtl red";
+    cache.get("key", produce, produced);
+    CHECK(produced);
+
+    std::remove(material.c_str());
+    ::rmdir(directory);
+}
+
+}
+
+int main()
+{
+    open_removes_stale_temps();
+    entries_expire_when_absent_files_appear();
+    results_expire_when_absent_files_appear();
+    return check_failures();
+}
@@ -0,0 +1,147 @@
+#include "converter.hpp"
+
+#include "check.hpp"
+
+#include <assimp/postprocess.h>
+
+#include <unistd.h>
+
+#include <cstdio>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+namespace
+{
+
+// Two triangles folded 90 degrees along a shared edge: four vertices, so a
+// three vertex limit splits it into one mesh per triangle.
+const char* const kFoldedQuad =
+    "v 0 0 0\n"
+    "v 1 0 0\n"
+    "v 1 1 0\n"
+    "v 0 0 1\n"
+    "f 1 2 3\n"
+    "f 1 3 4\n";
+
+std::string convert_with(Converter& converter, const std::string& path, const ConvertOptions& options)
+{
+    std::ostringstream output;
+    ConvertResult result;
+    CHECK(converter.convert_file(path, options, OutputFormat::Json, output, result));
+    return output.str();
+}
+
+// A property one request sets must not stay on the reused importer and
+// change a later request that does not set it.
+void properties_do_not_leak_between_conversions(const std::string& path)
+{
+    ConvertOptions plain;
+    plain.flags = aiProcess_SplitLargeMeshes;
+
+    ConvertOptions split = plain;
+    split.properties.push_back("PP_SLM_VERTEX_LIMIT=3");
+
+    Converter fresh;
+    const std::string expected = convert_with(fresh, path, plain);
+
+    Converter fresh_split;
+    const std::string expected_split = convert_with(fresh_split, path, split);
+    CHECK(nlohmann::json::parse(expected)["meshes"].size() == 1);
+    CHECK(nlohmann::json::parse(expected_split)["meshes"].size() == 2);
+
+    Converter reused;
+    CHECK(convert_with(reused, path, split) == expected_split);
+    CHECK(convert_with(reused, path, plain) == expected);
+    CHECK(convert_with(reused, path, split) == expected_split);
+}
+
+void collect_nodes(const nlohmann::json& node, std::vector<const nlohmann::json*>& nodes)
+{
+    nodes.push_back(&node);
+    if (node.find("children") != node.end())
+    {
+        for (const nlohmann::json& child : node["children"])
+        {
+            collect_nodes(child, nodes);
+        }
+    }
+}
+
+// The indexed writer must write exactly what dump(4) does, and every
+// recorded range must parse back to the record it names.
+void indexed_document_matches_dump()
+{
+    const nlohmann::json document = {
+        {"flags", 0},
+        {"meshes", {
+            { {"name", "first"}, {"vertices", {0.5, 1.0, -2.0}}, {"faces", nlohmann::json::array()} },
+            { {"name", "second \"quoted\"\nline"}, {"vertices", {3, 4, 5}} }
+        }},
+        {"materials", { { {"name", "default"} } }},
+        {"root", {
+            {"name", "root"},
+            {"transformation", {1, 0, 0, 1}},
+            {"children", {
+                { {"name", "a"}, {"children", { { {"name", "a1"} }, { {"name", "a2"}, {"meshes", {0, 1}} } }} },
+                { {"name", "b"}, {"children", nlohmann::json::array()} }
+            }}
+        }},
+        {"skinning", { {"bones", {"a1", "a2"}} }},
+        {"textures", nlohmann::json::array()}
+    };
+
+    std::ostringstream output;
+    std::vector<RecordOffset> records;
+    write_indexed_document(output, document, records);
+    const std::string text = output.str();
+    CHECK(text == document.dump(4) + "\n");
+
+    std::vector<const nlohmann::json*> nodes;
+    collect_nodes(document["root"], nodes);
+
+    std::size_t node_records = 0;
+    for (const RecordOffset& record : records)
+    {
+        CHECK(record.offset + record.length <= text.size());
+        const nlohmann::json parsed = nlohmann::json::parse(text.substr(record.offset, record.length));
+        if (record.type == "node")
+        {
+            ++node_records;
+            CHECK(record.index < nodes.size() && parsed == *nodes[record.index]);
+        }
+        else if (record.type == "skinning")
+        {
+            CHECK(parsed == document["skinning"]);
+        }
+        else
+        {
+            const std::string array = record.type == "mesh" ? "meshes" : record.type + "s";
+            CHECK(parsed == document[array][record.index]);
+        }
+    }
+    CHECK(node_records == nodes.size());
+    CHECK(records.size() == nodes.size() + 2 + 1 + 1);
+}
+
+}
+
+int main()
+{
+    char path[] = "/tmp/atj-test-XXXXXX.obj";
+    int fd = ::mkstemps(path, 4);
+    CHECK(fd >= 0);
+    if (fd < 0)
+    {
+        return check_failures();
+    }
+    ::close(fd);
+    std::ofstream(path) << kFoldedQuad;
+
+    properties_do_not_leak_between_conversions(path);
+    indexed_document_matches_dump();
+
+    std::remove(path);
+    return check_failures();
+}
@@ -0,0 +1,60 @@
+#include "metrics.hpp"
+
+#include "check.hpp"
+
+#include <sstream>
+#include <string>
+
+namespace
+{
+
+std::string bucket_line(const std::string& text, const std::string& le)
+{
+    const std::string prefix = "latency_bucket{le=\"" + le + "\"} ";
+    const std::string::size_type at = text.find(prefix);
+    if (at == std::string::npos)
+    {
+        return std::string();
+    }
+    return text.substr(at + prefix.size(), text.find('\n', at) - at - prefix.size());
+}
+
+// Two bounds an octave are written, each with the exact cumulative count of
+// the finer buckets recorded into.
+void exported_buckets_are_coarse_and_exact()
+{
+    Histogram histogram;
+    histogram.record(0.000300);
+    histogram.record(0.000384);
+    histogram.record(0.000385);
+    histogram.record(0.001);
+    histogram.record(100.0);
+
+    std::ostringstream output;
+    histogram.write(output, "latency", "");
+    const std::string text = output.str();
+
+    std::size_t buckets = 0;
+    for (std::string::size_type at = text.find("latency_bucket"); at != std::string::npos;
+            at = text.find("latency_bucket", at + 1))
+    {
+        ++buckets;
+    }
+    CHECK(buckets == 2 * (35 - 7) + 1 + 1);
+
+    CHECK(bucket_line(text, "0.000256") == "0");
+    CHECK(bucket_line(text, "0.000384") == "2");
+    CHECK(bucket_line(text, "0.000512") == "3");
+    CHECK(bucket_line(text, "0.001024") == "4");
+    CHECK(bucket_line(text, "+Inf") == "5");
+    CHECK(bucket_line(text, "0.00032").empty());
+    CHECK(text.find("latency_count 5\n") != std::string::npos);
+}
+
+}
+
+int main()
+{
+    exported_buckets_are_coarse_and_exact();
+    return check_failures();
+}
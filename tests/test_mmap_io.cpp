@@ -0,0 +1,71 @@
+#include "mmap_io.hpp"
+
+#include "check.hpp"
+
+#include <unistd.h>
+
+#include <cstdio>
+#include <memory>
+#include <vector>
+
+namespace
+{
+
+// A file truncated while mapped must read as ended, not raise SIGBUS.
+void truncated_file_reads_as_ended()
+{
+    char path[] = "/tmp/atj-test-XXXXXX";
+    int fd = ::mkstemp(path);
+    CHECK(fd >= 0);
+    if (fd < 0)
+    {
+        return;
+    }
+
+    const std::size_t size = 1 << 20;
+    std::vector<char> bytes(size, 'x');
+    CHECK(::write(fd, bytes.data(), size) == static_cast<ssize_t>(size));
+
+    MappedIOSystem io;
+    Assimp::IOStream* pStream = io.Open(path, "rb");
+    CHECK(pStream != nullptr);
+    if (pStream)
+    {
+        std::vector<char> buffer(size);
+        CHECK(pStream->Read(buffer.data(), 1, 4096) == 4096);
+
+        CHECK(::ftruncate(fd, 0) == 0);
+        CHECK(pStream->Read(buffer.data(), 1, size - 4096) == 0);
+        CHECK(pStream->Tell() == pStream->FileSize());
+        io.Close(pStream);
+    }
+
+    ::close(fd);
+    std::remove(path);
+}
+
+// What cannot be mapped, such as a character device, is still opened
+// through the default IOSystem.
+void unmappable_files_fall_back()
+{
+    MappedIOSystem io;
+    Assimp::IOStream* pStream = io.Open("/dev/null", "rb");
+    CHECK(pStream != nullptr);
+    if (pStream)
+    {
+        char byte = 0;
+        CHECK(pStream->Read(&byte, 1, 1) == 0);
+        io.Close(pStream);
+    }
+
+    CHECK(io.Open("/nonexistent/atj-test", "rb") == nullptr);
+}
+
+}
+
+int main()
+{
+    truncated_file_reads_as_ended();
+    unmappable_files_fall_back();
+    return check_failures();
+}
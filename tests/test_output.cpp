@@ -0,0 +1,102 @@
+#include "output.hpp"
+
+#include "check.hpp"
+
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <sstream>
+#include <string>
+
+namespace
+{
+
+std::string read_file(const std::string& path)
+{
+    std::ifstream input(path);
+    std::ostringstream text;
+    text << input.rdbuf();
+    return text.str();
+}
+
+bool write_replacement(const std::string& path, const std::string& text)
+{
+    std::string temp_name;
+    std::string error;
+    int fd = open_replacement(path, temp_name, error);
+    if (fd < 0)
+    {
+        return false;
+    }
+    const bool written = ::write(fd, text.data(), text.size()) == static_cast<ssize_t>(text.size());
+    ::close(fd);
+    return written && replace_output(temp_name, path, error);
+}
+
+// Replacing an output through a symlink must replace the file it points
+// at, keep its permissions and leave the symlink alone.
+void replacement_follows_symlinks_and_keeps_mode()
+{
+    char directory[] = "/tmp/atj-test-XXXXXX";
+    CHECK(::mkdtemp(directory) != nullptr);
+    const std::string target = std::string(directory) + "/target.json";
+    const std::string link = std::string(directory) + "/link.json";
+
+    std::ofstream(target) << "old";
+    CHECK(::chmod(target.c_str(), 0640) == 0);
+    CHECK(::symlink("target.json", link.c_str()) == 0);
+
+    CHECK(write_replacement(link, "new"));
+
+    struct stat info;
+    CHECK(::lstat(link.c_str(), &info) == 0 && S_ISLNK(info.st_mode));
+    CHECK(::stat(target.c_str(), &info) == 0 && (info.st_mode & 07777) == 0640);
+    CHECK(read_file(target) == "new");
+
+    std::remove(link.c_str());
+    std::remove(target.c_str());
+    ::rmdir(directory);
+}
+
+// Two writers of one output each get their own temporary file.
+void replacements_do_not_share_a_temporary_file()
+{
+    char directory[] = "/tmp/atj-test-XXXXXX";
+    CHECK(::mkdtemp(directory) != nullptr);
+    const std::string path = std::string(directory) + "/model.json";
+
+    std::string first;
+    std::string second;
+    std::string error;
+    int first_fd = open_replacement(path, first, error);
+    int second_fd = open_replacement(path, second, error);
+    CHECK(first_fd >= 0 && second_fd >= 0);
+    CHECK(first != second);
+    CHECK(first.compare(0, path.size(), path) == 0 && first.compare(first.size() - 4, 4, ".tmp") == 0);
+
+    struct stat info;
+    const mode_t mask = ::umask(0);
+    ::umask(mask);
+    CHECK(::fstat(first_fd, &info) == 0 && (info.st_mode & 07777) == (0644 & ~mask));
+
+    ::close(first_fd);
+    ::close(second_fd);
+    CHECK(replace_output(first, path, error));
+    CHECK(replace_output(second, path, error));
+    CHECK(::access(first.c_str(), F_OK) != 0 && ::access(second.c_str(), F_OK) != 0);
+
+    std::remove(path.c_str());
+    ::rmdir(directory);
+}
+
+}
+
+int main()
+{
+    replacement_follows_symlinks_and_keeps_mode();
+    replacements_do_not_share_a_temporary_file();
+    return check_failures();
+}
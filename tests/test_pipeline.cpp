@@ -0,0 +1,48 @@
+#include "pipeline.hpp"
+
+#include "check.hpp"
+
+#include <assimp/config.h>
+
+namespace
+{
+
+// Each property must land in the map Assimp reads it from: an angle is a
+// float, a vertex limit an integer.
+void properties_keep_their_type()
+{
+    Assimp::Importer importer;
+    CHECK(set_importer_property(importer, "PP_GSN_MAX_SMOOTHING_ANGLE=80"));
+    CHECK(importer.GetPropertyFloat(AI_CONFIG_PP_GSN_MAX_SMOOTHING_ANGLE, 0.f) == 80.f);
+
+    CHECK(set_importer_property(importer, "PP_SLM_VERTEX_LIMIT=010"));
+    CHECK(importer.GetPropertyInteger(AI_CONFIG_PP_SLM_VERTEX_LIMIT, 0) == 10);
+
+    CHECK(set_importer_property(importer, "PP_FD_REMOVE=true"));
+    CHECK(importer.GetPropertyBool(AI_CONFIG_PP_FD_REMOVE, false));
+
+    CHECK(set_importer_property(importer, "PP_RRM_EXCLUDE_LIST=brick 'glass pane'"));
+    CHECK(importer.GetPropertyString(AI_CONFIG_PP_RRM_EXCLUDE_LIST, "") == "brick 'glass pane'");
+}
+
+void bad_properties_are_rejected()
+{
+    CHECK(!check_importer_property("PP_GSN_MAX_SMOOTHING_ANGEL=80"));
+    CHECK(!check_importer_property("PP_SLM_VERTEX_LIMIT"));
+    CHECK(!check_importer_property("PP_SLM_VERTEX_LIMIT="));
+    CHECK(!check_importer_property("PP_SLM_VERTEX_LIMIT=1.5"));
+    CHECK(!check_importer_property("PP_SLM_VERTEX_LIMIT=0x10"));
+    CHECK(!check_importer_property("PP_SLM_VERTEX_LIMIT=99999999999"));
+    CHECK(!check_importer_property("PP_GSN_MAX_SMOOTHING_ANGLE=wide"));
+    CHECK(!check_importer_property("PP_FD_REMOVE=2"));
+    CHECK(check_importer_property("PP_GSN_MAX_SMOOTHING_ANGLE=66.5"));
+}
+
+}
+
+int main()
+{
+    properties_keep_their_type();
+    bad_properties_are_rejected();
+    return check_failures();
+}
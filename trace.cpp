@@ -0,0 +1,144 @@
+#include "trace.hpp"
+
+#include <json/json.hpp>
+
+#include <fstream>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+std::atomic<bool> gTraceEnabled(false);
+
+namespace
+{
+
+struct TraceEvent
+{
+    const char* pName;
+    std::string label;
+    long index;
+    double start_us;
+    double duration_us;
+};
+
+// Spans of one thread. Only that thread appends, so the lock is
+// uncontended until write_trace reads it.
+struct ThreadTrace
+{
+    std::mutex mutex;
+    unsigned int tid;
+    std::string name;
+    std::vector<TraceEvent> events;
+};
+
+std::chrono::steady_clock::time_point gTraceStart;
+
+std::mutex gThreadsMutex;
+std::vector<std::shared_ptr<ThreadTrace>> gThreads;
+
+// Kept alive by gThreads after its thread exits, so a finished worker's
+// spans are still written.
+thread_local std::shared_ptr<ThreadTrace> tThread;
+
+ThreadTrace& this_thread_trace()
+{
+    if (!tThread)
+    {
+        tThread = std::make_shared<ThreadTrace>();
+        std::lock_guard<std::mutex> lock(gThreadsMutex);
+        tThread->tid = static_cast<unsigned int>(gThreads.size()) + 1;
+        gThreads.push_back(tThread);
+    }
+    return *tThread;
+}
+
+double microseconds_since_start(std::chrono::steady_clock::time_point time)
+{
+    return std::chrono::duration<double, std::micro>(time - gTraceStart).count();
+}
+
+}
+
+void start_trace()
+{
+    gTraceStart = std::chrono::steady_clock::now();
+    trace_thread_name("main");
+    gTraceEnabled.store(true);
+}
+
+bool write_trace(const std::string& path, std::string& error)
+{
+    gTraceEnabled.store(false);
+
+    nlohmann::json events = nlohmann::json::array();
+
+    std::lock_guard<std::mutex> threads_lock(gThreadsMutex);
+    for (const std::shared_ptr<ThreadTrace>& pThread : gThreads)
+    {
+        std::lock_guard<std::mutex> lock(pThread->mutex);
+
+        if (!pThread->name.empty())
+        {
+            events.push_back({
+                {"name", "thread_name"},
+                {"ph", "M"},
+                {"pid", 1},
+                {"tid", pThread->tid},
+                {"args", { {"name", pThread->name} }}
+            });
+        }
+
+        for (const TraceEvent& event : pThread->events)
+        {
+            nlohmann::json span = {
+                {"name", event.pName},
+                {"cat", "atj"},
+                {"ph", "X"},
+                {"ts", event.start_us},
+                {"dur", event.duration_us},
+                {"pid", 1},
+                {"tid", pThread->tid}
+            };
+            if (event.index >= 0)
+            {
+                span["args"]["index"] = event.index;
+            }
+            if (!event.label.empty())
+            {
+                span["args"]["name"] = event.label;
+            }
+            events.push_back(span);
+        }
+    }
+
+    std::ofstream output(path);
+    output << nlohmann::json { {"traceEvents", events}, {"displayTimeUnit", "ms"} }.dump() << '\n';
+    if (!output)
+    {
+        error = "could not write " + path;
+        return false;
+    }
+    return true;
+}
+
+void trace_thread_name(const char* pName)
+{
+    ThreadTrace& thread = this_thread_trace();
+    std::lock_guard<std::mutex> lock(thread.mutex);
+    thread.name = pName;
+}
+
+void TraceSpan::finish()
+{
+    const auto end = std::chrono::steady_clock::now();
+
+    ThreadTrace& thread = this_thread_trace();
+    std::lock_guard<std::mutex> lock(thread.mutex);
+    thread.events.push_back(TraceEvent {
+        mpName,
+        mpLabel ? mpLabel : "",
+        mIndex,
+        microseconds_since_start(mStart),
+        std::chrono::duration<double, std::micro>(end - mStart).count()
+    });
+}
@@ -0,0 +1,62 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <string>
+
+// Chrome trace-event recording (chrome://tracing, ui.perfetto.dev) for
+// --trace. Spans are kept per thread in memory while tracing and written
+// out at the end; with tracing off a span costs one relaxed atomic load.
+
+extern std::atomic<bool> gTraceEnabled;
+
+inline bool trace_enabled()
+{
+    return gTraceEnabled.load(std::memory_order_relaxed);
+}
+
+// Starts recording, with the calling thread named "main". Once per process.
+void start_trace();
+
+// Stops recording and writes every span recorded so far to path as a
+// {"traceEvents": [...]} document.
+bool write_trace(const std::string& path, std::string& error);
+
+// Names the calling thread in the trace.
+void trace_thread_name(const char* pName);
+
+// Records the time from construction to destruction as a span on the
+// calling thread. pName must outlive the trace (a literal or a static
+// table entry); pLabel and index, when given, are shown as the span's
+// arguments, so a mesh span can carry the mesh's index and name.
+class TraceSpan
+{
+public:
+    explicit TraceSpan(const char* pName, long index = -1, const char* pLabel = nullptr)
+        : mpName(trace_enabled() ? pName : nullptr), mIndex(index), mpLabel(pLabel)
+    {
+        if (mpName)
+        {
+            mStart = std::chrono::steady_clock::now();
+        }
+    }
+
+    ~TraceSpan()
+    {
+        if (mpName)
+        {
+            finish();
+        }
+    }
+
+    TraceSpan(const TraceSpan&) = delete;
+    TraceSpan& operator=(const TraceSpan&) = delete;
+
+private:
+    void finish();
+
+    const char* mpName;
+    long mIndex;
+    const char* mpLabel;
+    std::chrono::steady_clock::time_point mStart;
+};
@@ -0,0 +1,485 @@
+#include "watch.hpp"
+
+#include "output.hpp"
+#include "parallel.hpp"
+
+#include <dirent.h>
+#include <poll.h>
+#include <signal.h>
+#include <sys/inotify.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <climits>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <sstream>
+
+namespace
+{
+
+const std::uint32_t kWatchMask = IN_CLOSE_WRITE | IN_MOVED_TO | IN_CREATE | IN_DELETE | IN_MOVED_FROM;
+
+std::atomic<bool> gStop(false);
+
+void request_stop(int)
+{
+    gStop = true;
+}
+
+std::mutex gLogMutex;
+
+// Writes a whole line at once so lines from worker threads do not mix.
+void log_line(const std::string& line)
+{
+    std::lock_guard<std::mutex> lock(gLogMutex);
+    std::cerr << line << std::endl;
+}
+
+std::string real_path(const std::string& path)
+{
+    char resolved[PATH_MAX];
+    return ::realpath(path.c_str(), resolved) ? std::string(resolved) : std::string();
+}
+
+// As real_path, but for a file that is gone resolves only its directory, so
+// it still matches the path it was recorded under.
+std::string resolved_path(const std::string& path)
+{
+    std::string resolved = real_path(path);
+    const std::string::size_type slash = path.rfind('/');
+    if (resolved.empty() && slash != std::string::npos)
+    {
+        const std::string directory = real_path(path.substr(0, slash));
+        if (!directory.empty())
+        {
+            resolved = directory + path.substr(slash);
+        }
+    }
+    return resolved;
+}
+
+std::string extension(const std::string& path)
+{
+    const std::string::size_type dot = path.rfind('.');
+    const std::string::size_type slash = path.rfind('/');
+    if (dot == std::string::npos || (slash != std::string::npos && dot < slash))
+    {
+        return std::string();
+    }
+
+    std::string ext = path.substr(dot);
+    std::transform(ext.begin(), ext.end(), ext.begin(), ::tolower);
+    return ext;
+}
+
+std::string output_path(const std::string& model, const WatchOptions& options)
+{
+    static const char* const kExtensions[] = { ".json", ".cbor", ".msgpack", ".ndjson" };
+
+    std::string path = model + kExtensions[static_cast<int>(options.format)];
+    if (options.compression.codec == Codec::Gzip)
+    {
+        path += ".gz";
+    }
+    else if (options.compression.codec == Codec::Zstd)
+    {
+        path += ".zst";
+    }
+    return path;
+}
+
+// Converts model into a temporary file next to its output and renames it
+// into place, so readers never see a partly written result. Fills
+// dependencies with the other files the importer read and seconds with the
+// time converting took; queued is how long the model waited for a worker.
+bool convert_model(Converter& converter, const std::string& model, const WatchOptions& options,
+        std::vector<std::string>& dependencies, double queued, double& seconds)
+{
+    auto start = std::chrono::steady_clock::now();
+
+    const std::string output_name = output_path(model, options);
+
+    std::string error;
+    std::string temp_name;
+    int fd = open_replacement(output_name, temp_name, error);
+    if (fd < 0)
+    {
+        log_line("Failed to open file: " + output_name + ": " + error);
+        return false;
+    }
+
+    ConvertResult result;
+    bool converted = false;
+    bool written = false;
+    {
+        FdOutputBuffer buffer(fd, true, FdOutputBuffer::kDefaultCapacity, options.write_buffers);
+        std::unique_ptr<CompressingOutputBuffer> compressor;
+        if (options.compression.codec != Codec::None)
+        {
+            compressor.reset(new CompressingOutputBuffer(&buffer, options.compression));
+        }
+        std::ostream output(compressor ? static_cast<std::streambuf*>(compressor.get()) : &buffer);
+
+        converted = converter.convert_file(model, options.convert, options.format, output, result);
+        written = !compressor || compressor->finish();
+        written = buffer.close() && written;
+    }
+
+    if (!converted || !written || !replace_output(temp_name, output_name, error))
+    {
+        std::remove(temp_name.c_str());
+        log_line("Error: " + model + ": " + (converted ? "Failed to write " + output_name : result.error));
+        return false;
+    }
+
+    dependencies.clear();
+    for (const std::string& input : result.input_files)
+    {
+        const std::string path = real_path(input);
+        if (!path.empty() && path != model)
+        {
+            dependencies.push_back(path);
+        }
+    }
+
+    seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    std::ostringstream line;
+    line << model << " -> " << output_name << ": " << seconds * 1000.0 << " ms, queued " << queued * 1000.0 << " ms";
+    log_line(line.str());
+    return true;
+}
+
+}
+
+DirectoryWatcher::DirectoryWatcher()
+    : mFd(-1)
+{
+}
+
+DirectoryWatcher::~DirectoryWatcher()
+{
+    if (mFd >= 0)
+    {
+        ::close(mFd);
+    }
+}
+
+bool DirectoryWatcher::open(const std::string& directory, std::vector<std::string>& files, std::string& error)
+{
+    mFd = ::inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (mFd < 0)
+    {
+        error = std::strerror(errno);
+        return false;
+    }
+
+    struct stat info;
+    if (::stat(directory.c_str(), &info) != 0 || !S_ISDIR(info.st_mode))
+    {
+        error = directory + ": not a directory";
+        return false;
+    }
+
+    add_tree(directory, &files);
+    return true;
+}
+
+void DirectoryWatcher::add_tree(const std::string& directory, std::vector<std::string>* pFiles)
+{
+    int wd = ::inotify_add_watch(mFd, directory.c_str(), kWatchMask);
+    if (wd < 0)
+    {
+        return;
+    }
+    mDirectories[wd] = directory;
+
+    DIR* pDir = ::opendir(directory.c_str());
+    if (!pDir)
+    {
+        return;
+    }
+
+    while (dirent* pEntry = ::readdir(pDir))
+    {
+        const std::string name = pEntry->d_name;
+        if (name == "." || name == "..")
+        {
+            continue;
+        }
+
+        const std::string path = directory + "/" + name;
+        struct stat info;
+        if (::stat(path.c_str(), &info) != 0)
+        {
+            continue;
+        }
+
+        if (S_ISDIR(info.st_mode))
+        {
+            add_tree(path, pFiles);
+        }
+        else if (pFiles && S_ISREG(info.st_mode))
+        {
+            pFiles->push_back(path);
+        }
+    }
+    ::closedir(pDir);
+}
+
+void DirectoryWatcher::read_events(std::vector<std::string>& changed, bool& overflowed)
+{
+    alignas(inotify_event) char buffer[64 * 1024];
+    for (;;)
+    {
+        ssize_t length = ::read(mFd, buffer, sizeof(buffer));
+        if (length <= 0)
+        {
+            return;
+        }
+
+        for (char* p = buffer; p < buffer + length; )
+        {
+            const inotify_event* pEvent = reinterpret_cast<const inotify_event*>(p);
+            p += sizeof(inotify_event) + pEvent->len;
+
+            if (pEvent->mask & IN_Q_OVERFLOW)
+            {
+                overflowed = true;
+                continue;
+            }
+            if (pEvent->mask & IN_IGNORED)
+            {
+                // The directory is gone.
+                mDirectories.erase(pEvent->wd);
+                continue;
+            }
+
+            auto directory = mDirectories.find(pEvent->wd);
+            if (directory == mDirectories.end() || pEvent->len == 0)
+            {
+                continue;
+            }
+
+            const std::string path = directory->second + "/" + pEvent->name;
+            if (pEvent->mask & IN_ISDIR)
+            {
+                // Files may already be in a directory that was just created
+                // or moved in.
+                if (pEvent->mask & (IN_CREATE | IN_MOVED_TO))
+                {
+                    add_tree(path, &changed);
+                }
+            }
+            else if (pEvent->mask & (IN_CLOSE_WRITE | IN_MOVED_TO | IN_DELETE | IN_MOVED_FROM))
+            {
+                changed.push_back(path);
+            }
+        }
+    }
+}
+
+std::vector<std::string> DirectoryWatcher::wait(int debounce_ms, const std::atomic<bool>& stop, bool& overflowed)
+{
+    std::vector<std::string> changed;
+    overflowed = false;
+
+    pollfd descriptor { mFd, POLLIN, 0 };
+    while (!stop)
+    {
+        // Wake up now and then to notice stop.
+        int timeout = changed.empty() && !overflowed ? 250 : debounce_ms;
+        int ready = ::poll(&descriptor, 1, timeout);
+        if (ready > 0)
+        {
+            read_events(changed, overflowed);
+        }
+        else if (ready == 0 && (!changed.empty() || overflowed))
+        {
+            break;
+        }
+        else if (ready < 0 && errno != EINTR)
+        {
+            break;
+        }
+    }
+
+    if (stop)
+    {
+        return std::vector<std::string>();
+    }
+
+    std::vector<std::string> unique;
+    std::set<std::string> seen;
+    for (const std::string& path : changed)
+    {
+        if (seen.insert(path).second)
+        {
+            unique.push_back(path);
+        }
+    }
+    return unique;
+}
+
+int run_watch(const WatchOptions& options)
+{
+    WatchOptions watch = options;
+    watch.convert.record_inputs = true;
+
+    std::vector<std::string> files;
+    std::string error;
+    DirectoryWatcher watcher;
+    if (!watcher.open(options.directory, files, error))
+    {
+        std::cerr << "Error: " << error << std::endl;
+        return 1;
+    }
+
+    struct sigaction action = {};
+    action.sa_handler = request_stop;
+    ::sigaction(SIGINT, &action, nullptr);
+    ::sigaction(SIGTERM, &action, nullptr);
+
+    // Importers stay alive between batches; a worker takes a free one for
+    // each model.
+    Converter probe;
+    std::mutex mutex;
+    std::vector<std::unique_ptr<Converter>> idle;
+    std::map<std::string, std::vector<std::string>> dependencies;
+    CostModel costs;
+
+    auto is_model = [&](const std::string& path) {
+        const std::string ext = extension(path);
+        return !ext.empty() && ext != ".tmp" && probe.supports(ext);
+    };
+
+    auto convert_models = [&](std::vector<std::string> models) {
+        // parallel_for hands out indices in order, so sorting by estimated
+        // cost starts small props before large scenes.
+        if (watch.schedule != SchedulePolicy::Fifo)
+        {
+            std::vector<std::pair<double, std::string>> estimated;
+            for (const std::string& model : models)
+            {
+                struct stat info;
+                const std::uint64_t bytes = ::stat(model.c_str(), &info) == 0 ? info.st_size : 0;
+                estimated.push_back({ costs.estimate(model, extension(model), bytes), model });
+            }
+            std::stable_sort(estimated.begin(), estimated.end(), [](const std::pair<double, std::string>& a,
+                    const std::pair<double, std::string>& b) { return a.first < b.first; });
+            for (std::size_t i = 0; i < models.size(); ++i)
+            {
+                models[i] = estimated[i].second;
+            }
+        }
+
+        const auto batch_start = std::chrono::steady_clock::now();
+        parallel_for(models.size(), [&](std::size_t i) {
+            std::unique_ptr<Converter> converter;
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                if (!idle.empty())
+                {
+                    converter = std::move(idle.back());
+                    idle.pop_back();
+                }
+            }
+            if (!converter)
+            {
+                converter.reset(new Converter());
+            }
+
+            struct stat info;
+            const std::uint64_t bytes = ::stat(models[i].c_str(), &info) == 0 ? info.st_size : 0;
+            const double queued = std::chrono::duration<double>(std::chrono::steady_clock::now() - batch_start).count();
+
+            std::vector<std::string> inputs;
+            double seconds = 0.0;
+            bool converted = convert_model(*converter, models[i], watch, inputs, queued, seconds);
+            if (converted)
+            {
+                costs.record(models[i], extension(models[i]), bytes, seconds);
+            }
+
+            std::lock_guard<std::mutex> lock(mutex);
+            if (converted)
+            {
+                dependencies[models[i]] = inputs;
+            }
+            else if (::access(models[i].c_str(), F_OK) != 0)
+            {
+                dependencies.erase(models[i]);
+            }
+            idle.push_back(std::move(converter));
+        });
+    };
+
+    auto models_in = [&](const std::vector<std::string>& paths) {
+        std::vector<std::string> models;
+        for (const std::string& path : paths)
+        {
+            const std::string model = real_path(path);
+            if (!model.empty() && is_model(model) && std::find(models.begin(), models.end(), model) == models.end())
+            {
+                models.push_back(model);
+            }
+        }
+        return models;
+    };
+
+    std::vector<std::string> models = models_in(files);
+    convert_models(models);
+    log_line("Watching " + options.directory + " (" + std::to_string(models.size()) + " models)");
+
+    while (!gStop)
+    {
+        bool overflowed = false;
+        std::vector<std::string> changed = watcher.wait(watch.debounce_ms, gStop, overflowed);
+        if (gStop)
+        {
+            break;
+        }
+
+        std::vector<std::string> affected = models_in(changed);
+
+        // Models that read a changed or deleted file, such as an MTL library
+        // or an external buffer, or every known model when events were lost.
+        // Models that are gone themselves are forgotten.
+        std::set<std::string> changed_paths;
+        for (const std::string& path : changed)
+        {
+            const std::string resolved = resolved_path(path);
+            changed_paths.insert(resolved);
+            if (::access(path.c_str(), F_OK) != 0)
+            {
+                dependencies.erase(resolved);
+            }
+        }
+        for (const auto& model : dependencies)
+        {
+            bool uses_changed = overflowed;
+            for (const std::string& dependency : model.second)
+            {
+                uses_changed = uses_changed || changed_paths.count(dependency) != 0;
+            }
+            if (uses_changed && std::find(affected.begin(), affected.end(), model.first) == affected.end())
+            {
+                affected.push_back(model.first);
+            }
+        }
+
+        convert_models(affected);
+    }
+
+    log_line("Stopped watching " + options.directory);
+    return 0;
+}
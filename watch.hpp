@@ -0,0 +1,59 @@
+#pragma once
+
+#include "compress.hpp"
+#include "converter.hpp"
+#include "schedule.hpp"
+
+#include <atomic>
+#include <map>
+#include <string>
+#include <vector>
+
+// inotify watch over a directory tree, following directories created in it.
+class DirectoryWatcher
+{
+public:
+    DirectoryWatcher();
+    ~DirectoryWatcher();
+
+    DirectoryWatcher(const DirectoryWatcher&) = delete;
+    DirectoryWatcher& operator=(const DirectoryWatcher&) = delete;
+
+    // Starts watching the tree and lists the files already in it.
+    bool open(const std::string& directory, std::vector<std::string>& files, std::string& error);
+
+    // Blocks until files are written, created, deleted or moved in or out,
+    // then keeps collecting until no event has come for debounce_ms, so a
+    // burst of saves is one change. Returns the changed paths, each once, or
+    // nothing once stop is set. overflowed is set when events were lost and
+    // everything should be treated as changed.
+    std::vector<std::string> wait(int debounce_ms, const std::atomic<bool>& stop, bool& overflowed);
+
+private:
+    void add_tree(const std::string& directory, std::vector<std::string>* pFiles);
+    void read_events(std::vector<std::string>& changed, bool& overflowed);
+
+    int mFd;
+    std::map<int, std::string> mDirectories;
+};
+
+struct WatchOptions
+{
+    std::string directory;
+    ConvertOptions convert;
+    OutputFormat format = OutputFormat::Json;
+    Compression compression;
+    int write_buffers = 4;
+    int debounce_ms = 200;
+
+    // Fifo converts a batch in the order found; every other policy starts
+    // the models expected to be quickest first.
+    SchedulePolicy schedule = SchedulePolicy::ShortestFirst;
+};
+
+// Converts every model under options.directory next to its source (model.obj
+// to model.obj.json, model.obj.ndjson, ..., so model.fbx beside it does not
+// share its output), then reconverts models whenever they or
+// the files they reference change, on one warm Converter per worker thread,
+// until interrupted. Returns the process exit code.
+int run_watch(const WatchOptions& options);